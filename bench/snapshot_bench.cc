@@ -0,0 +1,185 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+//
+// Times Snapshot::Save() and Snapshot::Load() with 10k (or the given number
+// of) clients. It needs an X server without a WM, e.g.,
+//
+//   $ Xvfb :99 &
+//   $ DISPLAY=:99 ./snapshot_bench [client_count]
+//
+// This process creates the windows and owns them throughout, so that they
+// outlive the two WMs it forks: the first one manages the windows and saves
+// the snapshot once it's told to quit (with SIGTERM, like a restart does),
+// and the second one loads it. HOME is pointed at a temporary directory, so
+// the user's config, cookie and snapshot are left alone.
+//
+// Usage: snapshot_bench [client_count]
+extern "C" {
+#include <X11/Xlib.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+}
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "snapshot.h"
+#include "window_manager.h"
+#include "window_registry.h"
+
+using std::string;
+using wmderland::WindowManager;
+using wmderland::WindowRegistry;
+
+namespace {
+
+// What a WM process reports back to this one.
+struct Result {
+  double ms;
+  size_t client_count;
+};
+
+// Runs f() once, and returns the time it took in ms.
+template <typename Function>
+double Measure(Function f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+bool WriteAll(int fd, const void* data, size_t size) {
+  return write(fd, data, size) == static_cast<ssize_t>(size);
+}
+
+bool ReadAll(int fd, void* data, size_t size) {
+  return read(fd, data, size) == static_cast<ssize_t>(size);
+}
+
+// Manages the windows until SIGTERM, and then saves the snapshot. A byte is
+// written to `fd` once the WM is ready to manage windows, and then the Result.
+void SaveSnapshot(int fd) {
+  WindowManager* wm = WindowManager::GetInstance();
+  if (!wm || !WriteAll(fd, "", 1)) {
+    _exit(EXIT_FAILURE);
+  }
+  wm->Run();
+
+  Result result = {};
+  result.client_count = WindowRegistry::GetInstance()->count(WindowRegistry::CLIENT);
+  result.ms = Measure([wm]() { wm->snapshot().Save(); });
+  _exit(WriteAll(fd, &result, sizeof(result)) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// Loads the snapshot, and writes the Result to `fd`.
+void LoadSnapshot(int fd) {
+  WindowManager* wm = WindowManager::GetInstance();
+  if (!wm) {
+    _exit(EXIT_FAILURE);
+  }
+
+  Result result = {};
+  result.ms = Measure([wm]() { wm->snapshot().Load(); });
+  result.client_count = WindowRegistry::GetInstance()->count(WindowRegistry::CLIENT);
+  _exit(WriteAll(fd, &result, sizeof(result)) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// Forks a child which runs body(fd), and returns its pid. The other end of
+// the pipe is returned via `read_fd`.
+pid_t Spawn(void (*body)(int), int* read_fd) {
+  int fds[2];
+  if (pipe(fds) == -1) {
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    body(fds[1]);
+  }
+  close(fds[1]);
+  *read_fd = fds[0];
+  return pid;
+}
+
+}  // namespace
+
+int main(int argc, char* args[]) {
+  size_t client_count = (argc > 1) ? std::strtoul(args[1], nullptr, 10) : 10000;
+
+  Display* dpy = XOpenDisplay(nullptr);
+  if (!dpy) {
+    std::fprintf(stderr, "Failed to open display to X server.\n");
+    return EXIT_FAILURE;
+  }
+
+  char home[] = "/tmp/snapshot_bench.XXXXXX";
+  if (!mkdtemp(home)) {
+    std::perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+  setenv("HOME", home, 1);
+  for (const char* dir : {"/.cache", "/.cache/Wmderland", "/.config", "/.config/Wmderland"}) {
+    mkdir((string(home) + dir).c_str(), 0700);
+  }
+  string snapshot_filename = string(home) + "/.cache/Wmderland/snapshot";
+
+  // 1. Start a WM, and have it manage the windows.
+  int fd = -1;
+  char ready = 0;
+  pid_t pid = Spawn(&SaveSnapshot, &fd);
+  if (pid == -1 || !ReadAll(fd, &ready, 1)) {
+    std::fprintf(stderr, "Failed to start the WM (is another WM running?)\n");
+    return EXIT_FAILURE;
+  }
+
+  double map_ms = Measure([&]() {
+    for (size_t i = 0; i < client_count; i++) {
+      Window window =
+          XCreateSimpleWindow(dpy, DefaultRootWindow(dpy), 0, 0, 100, 100, 0, 0, 0);
+      XSelectInput(dpy, window, StructureNotifyMask);
+      XMapWindow(dpy, window);
+    }
+
+    // The WM maps a window once it has managed it.
+    XEvent event;
+    for (size_t mapped = 0; mapped < client_count;) {
+      XNextEvent(dpy, &event);
+      mapped += (event.type == MapNotify);
+    }
+  });
+  std::printf("manage %6zu clients: %10.1f ms\n", client_count, map_ms);
+
+  // 2. Stop it, which saves the snapshot.
+  Result result = {};
+  kill(pid, SIGTERM);
+  bool ok = ReadAll(fd, &result, sizeof(result));
+  close(fd);
+  waitpid(pid, nullptr, 0);
+  if (!ok) {
+    std::fprintf(stderr, "The WM failed to save the snapshot\n");
+    return EXIT_FAILURE;
+  }
+
+  struct stat st = {};
+  stat(snapshot_filename.c_str(), &st);
+  std::printf("save   %6zu clients: %10.1f ms (%lld bytes)\n", result.client_count, result.ms,
+              static_cast<long long>(st.st_size));
+
+  // 3. Start another WM, which loads the snapshot.
+  pid = Spawn(&LoadSnapshot, &fd);
+  ok = pid != -1 && ReadAll(fd, &result, sizeof(result));
+  close(fd);
+  waitpid(pid, nullptr, 0);
+  if (!ok) {
+    std::fprintf(stderr, "The WM failed to load the snapshot\n");
+    return EXIT_FAILURE;
+  }
+  std::printf("load   %6zu clients: %10.1f ms\n", result.client_count, result.ms);
+
+  XCloseDisplay(dpy);
+  std::system(("rm -rf " + string(home)).c_str());
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,216 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+//
+// Compares the flat client tree (src/tree.h) with the pointer-based tree it
+// replaced, which is reproduced below as PointerNode, at 10, 100 and 10k
+// leaves. The trees have a fan-out of 4 and no clients, since creating a
+// client needs an X server.
+//
+// Usage: tree_bench
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <stack>
+#include <vector>
+
+#include "tree.h"
+
+using std::unique_ptr;
+using std::vector;
+using wmderland::Tree;
+
+namespace {
+
+const size_t kFanOut = 4;
+
+// The pointer-based tree node, as it was before the tree became flat.
+class PointerNode {
+ public:
+  PointerNode() : parent_() {}
+
+  void AddChild(unique_ptr<PointerNode> child) {
+    child->parent_ = this;
+    children_.push_back(std::move(child));
+  }
+
+  void RemoveChild(PointerNode* child) {
+    child->parent_ = nullptr;
+    children_.erase(
+        std::remove_if(children_.begin(), children_.end(),
+                       [&](unique_ptr<PointerNode>& node) { return node.get() == child; }),
+        children_.end());
+  }
+
+  PointerNode* GetLeftSibling() const {
+    vector<PointerNode*> siblings = parent_->children();
+
+    if (this == siblings.front()) {
+      return nullptr;
+    }
+    ptrdiff_t idx = std::find(siblings.begin(), siblings.end(), this) - siblings.begin();
+    return siblings[idx - 1];
+  }
+
+  vector<PointerNode*> GetLeaves() {
+    vector<PointerNode*> leaves;
+    std::stack<PointerNode*> st;
+    st.push(this);
+
+    while (!st.empty()) {
+      PointerNode* node = st.top();
+      st.pop();
+
+      if (node->children().empty()) {
+        leaves.push_back(node);
+      }
+      for (int i = node->children().size() - 1; i >= 0; i--) {
+        st.push(node->children().at(i));
+      }
+    }
+    return leaves;
+  }
+
+  vector<PointerNode*> children() const {
+    vector<PointerNode*> children(children_.size());
+    for (size_t i = 0; i < children.size(); i++) {
+      children[i] = children_[i].get();
+    }
+    return children;
+  }
+
+  PointerNode* parent() const {
+    return parent_;
+  }
+
+ private:
+  vector<unique_ptr<PointerNode>> children_;
+  PointerNode* parent_;
+};
+
+// Builds a subtree with `leaf_count` leaves under `parent`.
+void Build(PointerNode* parent, size_t leaf_count) {
+  if (leaf_count <= kFanOut) {
+    for (size_t i = 0; i < leaf_count; i++) {
+      parent->AddChild(std::make_unique<PointerNode>());
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < kFanOut; i++) {
+    auto child = std::make_unique<PointerNode>();
+    Build(child.get(), leaf_count / kFanOut + (i < leaf_count % kFanOut));
+    parent->AddChild(std::move(child));
+  }
+}
+
+void Build(Tree& tree, Tree::NodeId parent, size_t leaf_count) {
+  if (leaf_count <= kFanOut) {
+    for (size_t i = 0; i < leaf_count; i++) {
+      tree.AddChild(parent, tree.CreateNode(nullptr));
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < kFanOut; i++) {
+    Tree::NodeId child = tree.CreateNode(nullptr);
+    tree.AddChild(parent, child);
+    Build(tree, child, leaf_count / kFanOut + (i < leaf_count % kFanOut));
+  }
+}
+
+// Runs f() `iterations` times, and returns the average time in ns.
+template <typename Function>
+double Measure(size_t iterations, Function f) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    f();
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+void Report(const char* name, size_t leaf_count, double pointer_ns, double flat_ns) {
+  std::printf("%-10s %6zu leaves: pointer %12.0f ns, flat %12.0f ns (%.1fx)\n", name,
+              leaf_count, pointer_ns, flat_ns, pointer_ns / flat_ns);
+}
+
+void Run(size_t leaf_count) {
+  size_t iterations = std::max<size_t>(10, 200000 / leaf_count);
+  size_t sink = 0;  // keeps the results alive
+
+  // Building (and destroying) the whole tree.
+  double pointer_ns = Measure(iterations, [&]() {
+    PointerNode root;
+    Build(&root, leaf_count);
+    sink += root.children().size();
+  });
+  double flat_ns = Measure(iterations, [&]() {
+    Tree tree;
+    Build(tree, tree.root_node(), leaf_count);
+    sink += tree.child_count(tree.root_node());
+  });
+  Report("build", leaf_count, pointer_ns, flat_ns);
+
+  PointerNode root;
+  Build(&root, leaf_count);
+  Tree tree;
+  Build(tree, tree.root_node(), leaf_count);
+
+  // Visiting every leaf from left to right.
+  pointer_ns = Measure(iterations, [&]() {
+    for (PointerNode* leaf : root.GetLeaves()) {
+      sink += reinterpret_cast<uintptr_t>(leaf);
+    }
+  });
+  flat_ns = Measure(iterations, [&]() {
+    for (Tree::NodeId leaf : tree.leaves()) {
+      sink += leaf;
+    }
+  });
+  Report("leaves", leaf_count, pointer_ns, flat_ns);
+
+  // Finding the left sibling of every leaf.
+  vector<PointerNode*> pointer_leaves = root.GetLeaves();
+  vector<Tree::NodeId> flat_leaves;
+  for (Tree::NodeId leaf : tree.leaves()) {
+    flat_leaves.push_back(leaf);
+  }
+
+  pointer_ns = Measure(iterations, [&]() {
+    for (PointerNode* leaf : pointer_leaves) {
+      sink += (leaf->GetLeftSibling() != nullptr);
+    }
+  });
+  flat_ns = Measure(iterations, [&]() {
+    for (Tree::NodeId leaf : flat_leaves) {
+      sink += (tree.GetLeftSibling(leaf) != Tree::kNull_);
+    }
+  });
+  Report("siblings", leaf_count, pointer_ns, flat_ns);
+
+  // Removing every leaf, one at a time.
+  pointer_ns = Measure(1, [&]() {
+    for (PointerNode* leaf : pointer_leaves) {
+      leaf->parent()->RemoveChild(leaf);
+    }
+  });
+  flat_ns = Measure(1, [&]() {
+    for (Tree::NodeId leaf : flat_leaves) {
+      tree.RemoveChild(tree.parent(leaf), leaf);
+    }
+  });
+  Report("remove", leaf_count, pointer_ns, flat_ns);
+
+  if (sink == 42) {
+    std::printf("\n");
+  }
+}
+
+}  // namespace
+
+int main() {
+  for (size_t leaf_count : {10, 100, 10000}) {
+    Run(leaf_count);
+  }
+  return 0;
+}
@@ -0,0 +1,180 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+//
+// Round-trips the text form of a client tree (see Tree::Serialize()) at 10,
+// 100 and 10k nodes, with the buffer-based codec in src/tree.cc and with the
+// string-based one it replaced, which is reproduced below. The trees have a
+// fan-out of 4 and no clients, since creating a client needs an X server,
+// so every node is written as an internal node.
+//
+// Usage: tree_text_bench
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <queue>
+#include <stack>
+#include <string>
+#include <vector>
+
+#include "tree.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+using wmderland::TilingDirection;
+using wmderland::Tree;
+
+namespace {
+
+const size_t kFanOut = 4;
+
+// Builds a subtree with `leaf_count` leaves under `parent`.
+void Build(Tree& tree, Tree::NodeId parent, size_t leaf_count) {
+  if (leaf_count <= kFanOut) {
+    for (size_t i = 0; i < leaf_count; i++) {
+      Tree::NodeId child = tree.CreateNode(nullptr);
+      tree.set_tiling_direction(child, TilingDirection::HORIZONTAL);
+      tree.AddChild(parent, child);
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < kFanOut; i++) {
+    Tree::NodeId child = tree.CreateNode(nullptr);
+    tree.set_tiling_direction(child, TilingDirection::VERTICAL);
+    tree.AddChild(parent, child);
+    Build(tree, child, leaf_count / kFanOut + (i < leaf_count % kFanOut));
+  }
+}
+
+// The string-based encoder, as it was before the codec took a buffer.
+void OldSerializeHelper(const Tree& tree, Tree::NodeId node, string& data) {
+  data += 'i' + std::to_string(static_cast<int>(tree.tiling_direction(node)));
+  data += ',';
+
+  for (Tree::NodeId child : tree.children(node)) {
+    OldSerializeHelper(tree, child, data);
+  }
+  data += "b,";
+}
+
+string OldSerialize(const Tree& tree) {
+  string data = "none|";
+  Tree::NodeId root = tree.root_node();
+  if (!tree.child_count(root)) {
+    return data + 'i' + std::to_string(static_cast<int>(tree.tiling_direction(root)));
+  }
+  OldSerializeHelper(tree, root, data);
+  return data.erase(data.rfind(",b,"));
+}
+
+// The string-based decoder, as it was before the codec took a buffer.
+void OldDeserialize(Tree& tree, string data) {
+  data.erase(0, data.find('|') + 1);
+
+  std::queue<string> val_queue;
+  for (const auto& token : wmderland::string_utils::Split(data, ',')) {
+    val_queue.push(token);
+  }
+
+  string root_val = val_queue.front();
+  val_queue.pop();
+  root_val.erase(0, 1);
+  tree.set_tiling_direction(tree.root_node(),
+                            static_cast<TilingDirection>(std::stoi(root_val)));
+
+  std::stack<Tree::NodeId> st;
+  st.push(tree.root_node());
+
+  while (!val_queue.empty()) {
+    string val = val_queue.front();
+    val_queue.pop();
+
+    if (val == "b") {
+      st.pop();
+      continue;
+    }
+
+    val.erase(0, 1);
+    Tree::NodeId node = tree.CreateNode(nullptr);
+    tree.set_tiling_direction(node, static_cast<TilingDirection>(std::stoi(val)));
+    tree.AddChild(st.top(), node);
+    st.push(node);
+  }
+}
+
+// Runs f() `iterations` times, and returns the average time in ns.
+template <typename Function>
+double Measure(size_t iterations, Function f) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    f();
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+void Report(const char* name, size_t leaf_count, double old_ns, double new_ns) {
+  std::printf("%-12s %6zu leaves: string %12.0f ns, buffer %12.0f ns (%.1fx)\n", name,
+              leaf_count, old_ns, new_ns, old_ns / new_ns);
+}
+
+void Run(size_t leaf_count) {
+  size_t iterations = std::max<size_t>(10, 200000 / leaf_count);
+  size_t sink = 0;  // keeps the results alive
+
+  Tree tree;
+  Build(tree, tree.root_node(), leaf_count);
+
+  // The buffer is sized once, like the tree dump keeps its buffer around.
+  vector<char> buf(tree.Serialize(nullptr, 0));
+  tree.Serialize(buf.data(), buf.size());
+  if (string(buf.begin(), buf.end()) != OldSerialize(tree)) {
+    std::fprintf(stderr, "the two encoders disagree at %zu leaves\n", leaf_count);
+    return;
+  }
+
+  // Encoding.
+  double old_ns = Measure(iterations, [&]() { sink += OldSerialize(tree).size(); });
+  double new_ns =
+      Measure(iterations, [&]() { sink += tree.Serialize(buf.data(), buf.size()); });
+  Report("serialize", leaf_count, old_ns, new_ns);
+
+  // Decoding (into a fresh tree, which is included in both).
+  string data = OldSerialize(tree);
+  old_ns = Measure(iterations, [&]() {
+    Tree t;
+    OldDeserialize(t, data);
+    sink += t.child_count(t.root_node());
+  });
+  new_ns = Measure(iterations, [&]() {
+    Tree t;
+    sink += t.Deserialize(buf.data(), buf.size());
+  });
+  Report("deserialize", leaf_count, old_ns, new_ns);
+
+  // Both, one after the other.
+  old_ns = Measure(iterations, [&]() {
+    Tree t;
+    OldDeserialize(t, OldSerialize(tree));
+    sink += t.child_count(t.root_node());
+  });
+  new_ns = Measure(iterations, [&]() {
+    Tree t;
+    size_t length = tree.Serialize(buf.data(), buf.size());
+    sink += t.Deserialize(buf.data(), length);
+  });
+  Report("round trip", leaf_count, old_ns, new_ns);
+
+  if (sink == 42) {
+    std::printf("\n");
+  }
+}
+
+}  // namespace
+
+int main() {
+  for (size_t leaf_count : {10, 100, 10000}) {
+    Run(leaf_count);
+  }
+  return 0;
+}
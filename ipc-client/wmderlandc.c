@@ -38,6 +38,10 @@ static Command cmd_table[] = {
   {"exit",                     0, ARG_TYPE_NONE},
   {"reload",                   0, ARG_TYPE_NONE},
   {"debug_crash",              0, ARG_TYPE_NONE},
+  {"dump_stats",               0, ARG_TYPE_NONE},
+  {"set_layout",               1, ARG_TYPE_DEC },
+  {"restart",                  0, ARG_TYPE_NONE},
+  {"dump_trees",               0, ARG_TYPE_NONE},
   {NULL,                       0, ARG_TYPE_NONE}
 };
 
@@ -67,6 +67,14 @@ Action::Type Action::StrToActionType(const string& s) {
     return Action::Type::RELOAD;
   } else if (s == "debug_crash") {
     return Action::Type::DEBUG_CRASH;
+  } else if (s == "dump_stats") {
+    return Action::Type::DUMP_STATS;
+  } else if (s == "set_layout") {
+    return Action::Type::SET_LAYOUT;
+  } else if (s == "restart") {
+    return Action::Type::RESTART;
+  } else if (s == "dump_trees") {
+    return Action::Type::DUMP_TREES;
   } else if (s == "exec") {
     return Action::Type::EXEC;
   } else {
@@ -74,4 +82,51 @@ Action::Type Action::StrToActionType(const string& s) {
   }
 }
 
+const char* Action::TypeToStr(Action::Type type) {
+  switch (type) {
+    case Action::Type::NAVIGATE_LEFT:
+      return "navigate_left";
+    case Action::Type::NAVIGATE_RIGHT:
+      return "navigate_right";
+    case Action::Type::NAVIGATE_DOWN:
+      return "navigate_down";
+    case Action::Type::NAVIGATE_UP:
+      return "navigate_up";
+    case Action::Type::TILE_H:
+      return "tile_h";
+    case Action::Type::TILE_V:
+      return "tile_v";
+    case Action::Type::TOGGLE_FLOATING:
+      return "toggle_floating";
+    case Action::Type::TOGGLE_FULLSCREEN:
+      return "toggle_fullscreen";
+    case Action::Type::GOTO_WORKSPACE:
+      return "goto_workspace";
+    case Action::Type::WORKSPACE:
+      return "workspace";
+    case Action::Type::MOVE_WINDOW_TO_WORKSPACE:
+      return "move_window_to_workspace";
+    case Action::Type::KILL:
+      return "kill";
+    case Action::Type::EXIT:
+      return "exit";
+    case Action::Type::RELOAD:
+      return "reload";
+    case Action::Type::DEBUG_CRASH:
+      return "debug_crash";
+    case Action::Type::DUMP_STATS:
+      return "dump_stats";
+    case Action::Type::SET_LAYOUT:
+      return "set_layout";
+    case Action::Type::RESTART:
+      return "restart";
+    case Action::Type::DUMP_TREES:
+      return "dump_trees";
+    case Action::Type::EXEC:
+      return "exec";
+    default:
+      return "undefined";
+  }
+}
+
 }  // namespace wmderland
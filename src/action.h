@@ -24,6 +24,10 @@ class Action {
     EXIT,
     RELOAD,
     DEBUG_CRASH,
+    DUMP_STATS,
+    SET_LAYOUT,
+    RESTART,
+    DUMP_TREES,
     EXEC,
     UNDEFINED,
   };
@@ -36,6 +40,8 @@ class Action {
   Action::Type type() const;
   const std::string& argument() const;
 
+  static const char* TypeToStr(Action::Type type);
+
  private:
   static Action::Type StrToActionType(const std::string& s);
 
@@ -0,0 +1,58 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#include "arena.h"
+
+#include <algorithm>
+
+namespace wmderland {
+
+Arena::Arena(size_t block_size)
+    : blocks_(),
+      block_size_(block_size),
+      current_(),
+      offset_(),
+      allocations_(),
+      heap_allocations_() {}
+
+// `alignment` must be a power of two which is no greater than
+// alignof(std::max_align_t).
+void* Arena::Allocate(size_t size, size_t alignment) {
+  allocations_++;
+
+  for (; current_ < blocks_.size(); current_++, offset_ = 0) {
+    Block& block = blocks_[current_];
+    size_t offset = (offset_ + alignment - 1) & ~(alignment - 1);
+    if (offset + size <= block.size) {
+      offset_ = offset + size;
+      return block.data.get() + offset;
+    }
+  }
+
+  // None of the existing blocks has enough room left, so allocate a new one
+  // (which is large enough even for an oversized request).
+  size_t block_size = std::max(size, block_size_);
+  blocks_.push_back({std::unique_ptr<char[]>(new char[block_size]), block_size});
+  heap_allocations_++;
+  current_ = blocks_.size() - 1;
+  offset_ = size;
+  return blocks_.back().data.get();
+}
+
+void Arena::Reset() {
+  current_ = 0;
+  offset_ = 0;
+}
+
+Arena& Arena::per_event() {
+  static Arena arena;
+  return arena;
+}
+
+const unsigned long* Arena::allocations() const {
+  return &allocations_;
+}
+
+const unsigned long* Arena::heap_allocations() const {
+  return &heap_allocations_;
+}
+
+}  // namespace wmderland
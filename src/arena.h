@@ -0,0 +1,90 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#ifndef WMDERLAND_ARENA_H_
+#define WMDERLAND_ARENA_H_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace wmderland {
+
+// Arena is a monotonic (bump) allocator. Allocating from it is a pointer
+// increment, deallocation is a no-op, and Reset() frees everything at once
+// while keeping the memory blocks for reuse, so once the arena has grown to
+// the size of a typical event, handling an event costs no heap allocation.
+class Arena {
+ public:
+  explicit Arena(size_t block_size = kDefaultBlockSize_);
+  virtual ~Arena() = default;
+
+  void* Allocate(size_t size, size_t alignment);
+  void Reset();
+
+  // The arena for the temporary containers created while handling an X
+  // event. It is reset by WindowManager::Run() after each dispatch, so
+  // nothing allocated from it may be kept across events.
+  static Arena& per_event();
+
+  const unsigned long* allocations() const;
+  const unsigned long* heap_allocations() const;
+
+ private:
+  static const size_t kDefaultBlockSize_ = 64 * 1024;
+
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  std::vector<Block> blocks_;
+  size_t block_size_;
+  size_t current_;  // the block being allocated from
+  size_t offset_;   // the offset of the first free byte in that block
+
+  unsigned long allocations_;       // served by the arena (i.e., avoided)
+  unsigned long heap_allocations_;  // new blocks allocated from the heap
+};
+
+// An allocator-aware container can draw from an Arena via ArenaAllocator.
+// A default-constructed ArenaAllocator uses Arena::per_event().
+template <typename T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+
+  ArenaAllocator() : arena_(&Arena::per_event()) {}
+  explicit ArenaAllocator(Arena* arena) : arena_(arena) {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T*, size_t) {}
+
+  Arena* arena() const {
+    return arena_;
+  }
+
+ private:
+  Arena* arena_;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() != b.arena();
+}
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+}  // namespace wmderland
+
+#endif  // WMDERLAND_ARENA_H_
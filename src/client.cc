@@ -2,80 +2,107 @@
 #include "client.h"
 
 #include "config.h"
+#include "reconciler.h"
 #include "util.h"
+#include "window_manager.h"
+#include "window_registry.h"
 #include "workspace.h"
 
 using std::string;
-using std::unordered_map;
 
 namespace wmderland {
 
-unordered_map<Window, Client*> Client::mapper_;
-
 Client::Client(Display* dpy, Window window, Workspace* workspace)
     : dpy_(dpy),
+      reconciler_(&WindowManager::GetInstance()->reconciler()),
       window_(window),
       workspace_(workspace),
       size_hints_(wm_utils::GetWmNormalHints(window)),
-      attr_cache_(),
+      geometry_(),
+      saved_geometry_(),
+      configure_serial_(),
+      focus_order_(),
       is_mapped_(),
       is_floating_(),
       is_fullscreen_(),
+      is_parked_(),
       has_unmap_req_from_wm_() {
-  Client::mapper_[window] = this;
+  WindowRegistry::GetInstance()->AddRole(window, WindowRegistry::CLIENT).client = this;
+
+  // The window's attributes have usually been prefetched by the WM
+  // (see wm_utils::Prefetch()), in which case this is not a round trip.
+  XWindowAttributes attr = wm_utils::GetXWindowAttributes(window);
+  geometry_ = {attr.x, attr.y, attr.width, attr.height};
+
   SetBorderWidth(workspace->config()->border_width());
   SetBorderColor(workspace->config()->unfocused_color());
 }
 
 Client::~Client() {
-  Client::mapper_.erase(window_);
+  WindowRegistry::GetInstance()->RemoveRole(window_, WindowRegistry::CLIENT);
 }
 
 void Client::Map() const {
-  XMapWindow(dpy_, window_);
+  reconciler_->Map(window_);
 }
 
 void Client::Unmap() {
-  // If this client is already unmapped, or the WM has already sent a request
-  // to unmap it, then no need to do it again.
-  if (!is_mapped_ || has_unmap_req_from_wm_) {
+  reconciler_->Unmap(window_);
+}
+
+// Parking a client instead of unmapping it spares the client from dropping
+// and repainting its contents. _NET_WM_STATE_HIDDEN tells the client it
+// can't be seen anyway, so it may throttle itself.
+void Client::Park() {
+  if (is_parked_) {
     return;
   }
 
-  has_unmap_req_from_wm_ = true;  // will be set to false in WindowManager::OnUnmapNotify
-  XUnmapWindow(dpy_, window_);
+  is_parked_ = true;
+  reconciler_->Park(window_, geometry_, true);
+  wm_utils::SetNetWmStateHidden(window_, true);
 }
 
-void Client::Raise() const {
-  XRaiseWindow(dpy_, window_);
+void Client::Unpark() {
+  if (!is_parked_) {
+    return;
+  }
+
+  is_parked_ = false;
+  reconciler_->Park(window_, geometry_, false);
+  wm_utils::SetNetWmStateHidden(window_, false);
 }
 
-void Client::Move(int x, int y) const {
-  XMoveWindow(dpy_, window_, x, y);
+void Client::Move(int x, int y) {
+  MoveResize(x, y, geometry_.w, geometry_.h);
 }
 
-void Client::Resize(int w, int h) const {
-  XResizeWindow(dpy_, window_, w, h);
+void Client::Resize(int w, int h) {
+  MoveResize(geometry_.x, geometry_.y, w, h);
 }
 
-void Client::MoveResize(int x, int y, int w, int h) const {
-  XMoveResizeWindow(dpy_, window_, x, y, w, h);
+// The configure request will be sent later (if at all), so its serial will
+// be no less than the next one at this moment.
+void Client::MoveResize(int x, int y, int w, int h) {
+  set_geometry({x, y, w, h});
+  configure_serial_ = NextRequest(dpy_);
+  reconciler_->MoveResize(window_, geometry_);
 }
 
-void Client::MoveResize(int x, int y, const std::pair<int, int>& size) const {
-  XMoveResizeWindow(dpy_, window_, x, y, size.first, size.second);
+void Client::MoveResize(int x, int y, const std::pair<int, int>& size) {
+  MoveResize(x, y, size.first, size.second);
 }
 
 void Client::SetInputFocus() const {
-  XSetInputFocus(dpy_, window_, RevertToParent, CurrentTime);
+  reconciler_->SetInputFocus(window_);
 }
 
 void Client::SetBorderWidth(unsigned int width) const {
-  XSetWindowBorderWidth(dpy_, window_, width);
+  reconciler_->SetBorderWidth(window_, width);
 }
 
 void Client::SetBorderColor(unsigned long color) const {
-  XSetWindowBorder(dpy_, window_, color);
+  reconciler_->SetBorderColor(window_, color);
 }
 
 XWindowAttributes Client::GetXWindowAttributes() const {
@@ -94,8 +121,20 @@ const XSizeHints& Client::size_hints() const {
   return size_hints_;
 }
 
-const XWindowAttributes& Client::attr_cache() const {
-  return attr_cache_;
+const Client::Area& Client::geometry() const {
+  return geometry_;
+}
+
+const Client::Area& Client::saved_geometry() const {
+  return saved_geometry_;
+}
+
+unsigned long Client::configure_serial() const {
+  return configure_serial_;
+}
+
+unsigned long Client::focus_order() const {
+  return focus_order_;
 }
 
 bool Client::is_mapped() const {
@@ -110,6 +149,10 @@ bool Client::is_fullscreen() const {
   return is_fullscreen_;
 }
 
+bool Client::is_parked() const {
+  return is_parked_;
+}
+
 bool Client::has_unmap_req_from_wm() const {
   return has_unmap_req_from_wm_;
 }
@@ -123,30 +166,56 @@ void Client::set_mapped(bool mapped) {
 }
 
 void Client::set_floating(bool floating) {
+  if (is_floating_ == floating) {
+    return;
+  }
+
+  // Whether a client is floating decides which subtrees will be tiled.
   is_floating_ = floating;
+  workspace_->UpdateClientCounts(this);
 }
 
 void Client::set_fullscreen(bool fullscreen) {
   is_fullscreen_ = fullscreen;
 }
 
+void Client::set_parked(bool parked) {
+  is_parked_ = parked;
+}
+
 void Client::set_has_unmap_req_from_wm(bool has_unmap_req_from_wm) {
   has_unmap_req_from_wm_ = has_unmap_req_from_wm;
 }
 
-void Client::set_attr_cache(const XWindowAttributes& attr) {
-  attr_cache_ = attr;
+// If a window has been moved or resized by anyone other than
+// Workspace::Tile(), its tree node has to be re-tiled.
+void Client::set_geometry(const Client::Area& geometry) {
+  if (geometry_ == geometry) {
+    return;
+  }
+
+  geometry_ = geometry;
+  workspace_->MarkDirty(this);
+  workspace_->UpdateNavigationIndex(this);
+}
+
+void Client::set_saved_geometry(const Client::Area& saved_geometry) {
+  saved_geometry_ = saved_geometry;
+}
+
+void Client::set_focus_order(unsigned long focus_order) {
+  focus_order_ = focus_order;
 }
 
 Client::Area::Area() : x(), y(), w(), h() {}
 
 Client::Area::Area(int x, int y, int w, int h) : x(x), y(y), w(w), h(h) {}
 
-bool Client::Area::operator==(const Client::Area& other) {
+bool Client::Area::operator==(const Client::Area& other) const {
   return (x == other.x) && (y == other.y) && (w == other.w) && (h == other.h);
 }
 
-bool Client::Area::operator!=(const Client::Area& other) {
+bool Client::Area::operator!=(const Client::Area& other) const {
   return (x != other.x) || (y != other.y) || (w != other.w) || (h != other.h);
 }
 
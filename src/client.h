@@ -7,38 +7,39 @@ extern "C" {
 #include <X11/Xutil.h>
 }
 #include <string>
-#include <unordered_map>
 
 namespace wmderland {
 
+class Reconciler;
 class Workspace;
 
 // A Client is any window that we have decided to manage. It is a wrapper class
 // of Window which provides some useful information and methods.
+//
+// The methods which change the window on the X server only declare the
+// change, which will be sent by Reconciler::Commit() if it's still needed.
 class Client {
  public:
   struct Area {
     Area();
     Area(int x, int y, int w, int h);
-    bool operator==(const Client::Area& other);
-    bool operator!=(const Client::Area& other);
+    bool operator==(const Client::Area& other) const;
+    bool operator!=(const Client::Area& other) const;
 
     int x, y, w, h;
   };
 
-  // The lightning fast mapper which maps Window to Client* in O(1)
-  static std::unordered_map<Window, Client*> mapper_;
-
   Client(Display* dpy, Window window, Workspace* workspace);
   virtual ~Client();
 
   void Map() const;
   void Unmap();
-  void Raise() const;
-  void Move(int x, int y) const;
-  void Resize(int w, int h) const;
-  void MoveResize(int x, int y, int w, int h) const;
-  void MoveResize(int x, int y, const std::pair<int, int>& size) const;
+  void Park();
+  void Unpark();
+  void Move(int x, int y);
+  void Resize(int w, int h);
+  void MoveResize(int x, int y, int w, int h);
+  void MoveResize(int x, int y, const std::pair<int, int>& size);
   void SetInputFocus() const;
   void SetBorderWidth(unsigned int width) const;
   void SetBorderColor(unsigned long color) const;
@@ -47,30 +48,49 @@ class Client {
   Window window() const;
   Workspace* workspace() const;
   const XSizeHints& size_hints() const;
-  const XWindowAttributes& attr_cache() const;
+  const Client::Area& geometry() const;
+  const Client::Area& saved_geometry() const;
+  unsigned long configure_serial() const;
+  unsigned long focus_order() const;
 
   bool is_mapped() const;
   bool is_floating() const;
   bool is_fullscreen() const;
+  bool is_parked() const;
   bool has_unmap_req_from_wm() const;
 
   void set_workspace(Workspace* workspace);
   void set_mapped(bool mapped);
   void set_floating(bool floating);
   void set_fullscreen(bool fullscreen);
+  void set_parked(bool parked);
   void set_has_unmap_req_from_wm(bool has_unmap_req_from_user);
-  void set_attr_cache(const XWindowAttributes& attr);
+  void set_geometry(const Client::Area& geometry);
+  void set_saved_geometry(const Client::Area& saved_geometry);
+  void set_focus_order(unsigned long focus_order);
 
  private:
   Display* dpy_;
+  Reconciler* reconciler_;
   Window window_;
   Workspace* workspace_;
   XSizeHints size_hints_;
-  XWindowAttributes attr_cache_;
+
+  // The geometry cache of this window. It is updated whenever we configure
+  // the window, and by WindowManager::OnConfigureNotify(). configure_serial_
+  // is a lower bound of the serial of our last configure request, which is
+  // used to discard the ConfigureNotify events that have been superseded.
+  Client::Area geometry_;
+  Client::Area saved_geometry_;  // restored after leaving fullscreen
+  unsigned long configure_serial_;
+
+  // The larger, the more recently this client has been focused.
+  unsigned long focus_order_;
 
   bool is_mapped_;
   bool is_floating_;
   bool is_fullscreen_;
+  bool is_parked_;  // kept mapped but off-screen, see Reconciler::Park()
 
   bool has_unmap_req_from_wm_;
 };
@@ -31,44 +31,9 @@ void Config::Load() {
   fin >> *this;
 }
 
-int Config::GetSpawnWorkspaceId(Window window) const {
-  for (const auto& key : GeneratePossibleConfigKeys(window)) {
-    auto it = spawn_rules_.find(key);
-    if (it != spawn_rules_.end()) {
-      return it->second - 1;  // workspace id starts from 0.
-    }
-  }
-  return UNSPECIFIED_WORKSPACE;
-}
-
-bool Config::ShouldFloat(Window window) const {
-  for (const auto& key : GeneratePossibleConfigKeys(window)) {
-    auto it = float_rules_.find(key);
-    if (it != float_rules_.end()) {
-      return it->second;
-    }
-  }
-  return false;
-}
-
-bool Config::ShouldFullscreen(Window window) const {
-  for (const auto& key : GeneratePossibleConfigKeys(window)) {
-    auto it = fullscreen_rules_.find(key);
-    if (it != fullscreen_rules_.end()) {
-      return it->second;
-    }
-  }
-  return false;
-}
-
-bool Config::ShouldProhibit(Window window) const {
-  for (const auto& key : GeneratePossibleConfigKeys(window)) {
-    auto it = prohibit_rules_.find(key);
-    if (it != prohibit_rules_.end()) {
-      return it->second;
-    }
-  }
-  return false;
+WindowRules Config::GetWindowRules(Window window) const {
+  pair<string, string> hint = wm_utils::GetXClassHint(window);
+  return window_rules_.Match(hint.first, hint.second, wm_utils::GetNetWmName(window));
 }
 
 const vector<Action>& Config::GetKeybindActions(unsigned int modifier, KeyCode keycode) const {
@@ -95,6 +60,18 @@ unsigned int Config::min_window_height() const {
   return min_window_height_;
 }
 
+unsigned int Config::move_resize_rate() const {
+  return move_resize_rate_;
+}
+
+unsigned int Config::stats_interval() const {
+  return stats_interval_;
+}
+
+bool Config::park_workspaces() const {
+  return park_workspaces_;
+}
+
 unsigned long Config::focused_color() const {
   return focused_color_;
 }
@@ -142,20 +119,6 @@ string Config::ExtractWindowIdentifier(const std::string& s) {
   return identifier.substr(0, identifier.rfind(' '));
 }
 
-vector<string> Config::GeneratePossibleConfigKeys(Window window) const {
-  pair<string, string> hint = wm_utils::GetXClassHint(window);
-  const string& res_class = hint.first;
-  const string& res_name = hint.second;
-  string net_wm_name = wm_utils::GetNetWmName(window);
-
-  return {
-      res_class + ',' + res_name + ',' + net_wm_name,
-      res_class + ',' + res_name,
-      res_class + ',' + net_wm_name,
-      res_class,
-  };
-}
-
 const string& Config::ReplaceSymbols(string& s) {
   for (const auto& symtab_record : symtab_) {
     string_utils::Replace(s, symtab_record.first, symtab_record.second);
@@ -169,14 +132,14 @@ ifstream& operator>>(ifstream& ifs, Config& config) {
   config.border_width_ = DEFAULT_BORDER_WIDTH;
   config.min_window_width_ = MIN_WINDOW_WIDTH;
   config.min_window_height_ = MIN_WINDOW_HEIGHT;
+  config.move_resize_rate_ = DEFAULT_MOVE_RESIZE_RATE;
+  config.stats_interval_ = DEFAULT_STATS_INTERVAL;
+  config.park_workspaces_ = DEFAULT_PARK_WORKSPACES;
   config.focused_color_ = DEFAULT_FOCUSED_COLOR;
   config.unfocused_color_ = DEFAULT_UNFOCUSED_COLOR;
 
   config.symtab_.clear();
-  config.spawn_rules_.clear();
-  config.float_rules_.clear();
-  config.fullscreen_rules_.clear();
-  config.prohibit_rules_.clear();
+  config.window_rules_.Clear();
   config.keybind_rules_.clear();
   config.autostart_cmds_.clear();
   config.autostart_cmds_on_reload_.clear();
@@ -220,6 +183,12 @@ ifstream& operator>>(ifstream& ifs, Config& config) {
             config.min_window_width_ = std::stoi(value);
           } else if (key == "min_window_height") {
             config.min_window_height_ = std::stoi(value);
+          } else if (key == "move_resize_rate") {
+            config.move_resize_rate_ = std::stoi(value);
+          } else if (key == "stats_interval") {
+            config.stats_interval_ = std::stoi(value);
+          } else if (key == "park_workspaces") {
+            stringstream(value) >> std::boolalpha >> config.park_workspaces_;
           } else if (key == "focused_color") {
             config.focused_color_ = std::stoul(value, nullptr, 16);
           } else if (key == "unfocused_color") {
@@ -232,25 +201,25 @@ ifstream& operator>>(ifstream& ifs, Config& config) {
       }
       case Config::Keyword::ASSIGN: {
         string window_identifier = config.ExtractWindowIdentifier(line);
-        config.spawn_rules_[window_identifier] = std::stoi(tokens.back());
-        break;
-      }
-      case Config::Keyword::FLOATING: {
-        string window_identifier = config.ExtractWindowIdentifier(line);
-        stringstream(tokens.back()) >> std::boolalpha >>
-            config.float_rules_[window_identifier];
-        break;
-      }
-      case Config::Keyword::FULLSCREEN: {
-        string window_identifier = config.ExtractWindowIdentifier(line);
-        stringstream(tokens.back()) >> std::boolalpha >>
-            config.fullscreen_rules_[window_identifier];
+        int workspace_id = std::stoi(tokens.back()) - 1;  // workspace id starts from 0.
+        config.window_rules_.Add(window_identifier, RuleMatcher::RuleType::SPAWN,
+                                 workspace_id);
         break;
       }
+      case Config::Keyword::FLOATING:
+      case Config::Keyword::FULLSCREEN:
       case Config::Keyword::PROHIBIT: {
         string window_identifier = config.ExtractWindowIdentifier(line);
-        stringstream(tokens.back()) >> std::boolalpha >>
-            config.prohibit_rules_[window_identifier];
+        bool value = false;
+        stringstream(tokens.back()) >> std::boolalpha >> value;
+
+        RuleMatcher::RuleType type = RuleMatcher::RuleType::PROHIBIT;
+        if (keyword == Config::Keyword::FLOATING) {
+          type = RuleMatcher::RuleType::FLOAT;
+        } else if (keyword == Config::Keyword::FULLSCREEN) {
+          type = RuleMatcher::RuleType::FULLSCREEN;
+        }
+        config.window_rules_.Add(window_identifier, type, value);
         break;
       }
       case Config::Keyword::BINDSYM: {
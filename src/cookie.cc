@@ -1,11 +1,22 @@
 // Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
 #include "cookie.h"
 
+extern "C" {
+#include <sys/wait.h>
+#include <unistd.h>
+}
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <sstream>
 #include <vector>
 
 #include "client.h"
+#include "config.h"
 #include "util.h"
+#include "window_manager.h"
 
 using std::endl;
 using std::ifstream;
@@ -21,10 +32,35 @@ namespace wmderland {
 const char Cookie::kDelimiter_ = ' ';
 
 Cookie::Cookie(Display* dpy, Properties* prop, string filename)
-    : dpy_(dpy), prop_(prop), filename_(sys_utils::ToAbsPath(filename)) {
-  // Load cookie from file.
-  ifstream fin(filename_);
-  fin >> *this;
+    : dpy_(dpy),
+      prop_(prop),
+      filename_(sys_utils::ToAbsPath(filename)),
+      log_filename_(filename_ + ".log"),
+      compacting_filename_(filename_ + ".log.old"),
+      client_area_map_(),
+      pending_(),
+      log_size_(),
+      flush_timer_(EventLoop::kNoTimer_),
+      compaction_pid_(-1),
+      has_compacting_log_() {
+  // Load the base, and then the logs in the order they were written,
+  // including the one whose compaction may have been interrupted. Only the
+  // entries of the logs count towards log_size_.
+  ifstream base(filename_);
+  base >> *this;
+  log_size_ = 0;
+
+  ifstream compacting_log(compacting_filename_);
+  compacting_log >> *this;
+  has_compacting_log_ = compacting_log.is_open();
+  ifstream log(log_filename_);
+  log >> *this;
+}
+
+// The event loop is already gone by now, so the updates which are still
+// pending are appended right away.
+Cookie::~Cookie() {
+  Flush();
 }
 
 Client::Area Cookie::Get(Window window) const {
@@ -36,11 +72,115 @@ Client::Area Cookie::Get(Window window) const {
 }
 
 void Cookie::Put(Window window, const Client::Area& area) {
-  client_area_map_[GetCookieKey(window)] = area;
+  string key = GetCookieKey(window);
+  auto it = client_area_map_.find(key);
+  if (it != client_area_map_.end() && it->second == area) {
+    return;
+  }
+  client_area_map_[key] = area;
+
+  pending_ += std::to_string(area.x) + kDelimiter_ + std::to_string(area.y) + kDelimiter_ +
+              std::to_string(area.w) + kDelimiter_ + std::to_string(area.h) + kDelimiter_ +
+              key + '\n';
+  log_size_++;
+
+  // Append the updates once the user is done moving windows around for a
+  // while, and compact the log if it has outgrown the base.
+  EventLoop& event_loop = WindowManager::GetInstance()->event_loop_;
+  event_loop.CancelTimer(flush_timer_);
+  flush_timer_ = event_loop.AddTimer(std::chrono::milliseconds(COOKIE_FLUSH_DELAY), [this]() {
+    flush_timer_ = EventLoop::kNoTimer_;
+    Flush();
+    if (log_size_ >= std::max<size_t>(COOKIE_COMPACTION_THRESHOLD, client_area_map_.size())) {
+      Compact();
+    }
+  });
+}
+
+// Appends the pending updates to the log.
+void Cookie::Flush() {
+  if (pending_.empty()) {
+    return;
+  }
+
+  ofstream fout(log_filename_, std::ios::app);
+  fout << pending_;
+  fout.flush();
+  if (!fout) {
+    WM_LOG(ERROR, "Failed to write " << log_filename_);
+  }
+  pending_.clear();
+}
+
+// Sets the log aside, and forks a child which writes all the entries as the
+// new base and then removes the old log, so the event loop never waits for
+// the whole cookie to be written. The updates in the meantime go to a new
+// log, which is loaded after the base.
+void Cookie::Compact() {
+  if (compaction_pid_ != -1) {
+    return;  // the previous compaction is still running
+  }
 
-  // Write cookie to file.
-  ofstream fout(filename_);
-  fout << *this;
+  // If the previous compaction failed, its log is still there and holds
+  // updates which are older than the log's, so the log is appended to it
+  // rather than renamed over it.
+  if (has_compacting_log_) {
+    ifstream log(log_filename_, std::ios::binary);
+    if (log.peek() != ifstream::traits_type::eof()) {
+      ofstream fout(compacting_filename_, std::ios::app | std::ios::binary);
+      fout << log.rdbuf();
+      fout.flush();
+      if (!fout) {
+        WM_LOG(ERROR, "Failed to write " << compacting_filename_);
+        return;
+      }
+    }
+    unlink(log_filename_.c_str());
+  } else if (rename(log_filename_.c_str(), compacting_filename_.c_str()) == -1) {
+    WM_LOG_WITH_ERRNO("Failed to rename cookie log", errno);
+    return;
+  }
+  has_compacting_log_ = true;
+
+  compaction_pid_ = fork();
+  if (compaction_pid_ == -1) {
+    WM_LOG_WITH_ERRNO("Failed to fork cookie compaction", errno);
+    return;
+  } else if (compaction_pid_ == 0) {
+    string tmp_filename = filename_ + ".tmp";
+    {
+      ofstream fout(tmp_filename);
+      fout << *this;
+      fout.flush();
+      if (!fout) {
+        _exit(EXIT_FAILURE);
+      }
+    }
+
+    if (rename(tmp_filename.c_str(), filename_.c_str()) == -1) {
+      _exit(EXIT_FAILURE);
+    }
+    unlink(compacting_filename_.c_str());
+    _exit(EXIT_SUCCESS);
+  }
+
+  log_size_ = 0;
+}
+
+// Called by WindowManager::OnSigchld() for every child it reaps. The old log
+// is only gone if the compaction succeeded, otherwise the next compaction
+// picks it up again.
+void Cookie::OnChildExit(pid_t pid, int status) {
+  if (pid != compaction_pid_) {
+    return;
+  }
+
+  compaction_pid_ = -1;
+  if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+    has_compacting_log_ = false;
+  } else {
+    WM_LOG(ERROR, "Cookie compaction failed, " << compacting_filename_ << " is kept");
+  }
 }
 
 string Cookie::GetCookieKey(Window window) const {
@@ -76,6 +216,7 @@ ifstream& operator>>(ifstream& ifs, Cookie& cookie) {
 
       // The rest will be res_class, res_name and _NET_WM_NAME.
       cookie.client_area_map_[tokens[4]] = area;
+      cookie.log_size_++;
     }
   }
   return ifs;
@@ -4,25 +4,35 @@
 
 extern "C" {
 #include <X11/Xutil.h>
+#include <sys/types.h>
 }
 #include <fstream>
 #include <string>
 #include <unordered_map>
 
 #include "client.h"
+#include "event_loop.h"
 
 namespace wmderland {
 
 class Properties;
 
 // Cookie holds the user-prefered positions and sizes of windows.
+//
+// The cookie file is a compacted base, and the updates since then are
+// appended to a log next to it, whose later lines override the earlier
+// ones. Put() only buffers an update, and the buffered updates are appended
+// once there have been none for COOKIE_FLUSH_DELAY ms. Once the log has
+// outgrown the base, a child process writes a new base, see Compact().
 class Cookie {
  public:
   Cookie(Display* dpy, Properties* prop, const std::string filename);
-  virtual ~Cookie() = default;
+  virtual ~Cookie();
 
   Client::Area Get(Window window) const;
   void Put(Window window, const Client::Area& area);
+  void Flush();
+  void OnChildExit(pid_t pid, int status);
 
   friend std::ofstream& operator<<(std::ofstream& os, const Cookie& cookie);
   friend std::ifstream& operator>>(std::ifstream& is, Cookie& cookie);
@@ -30,11 +40,20 @@ class Cookie {
  private:
   static const char kDelimiter_;
   std::string GetCookieKey(Window window) const;
+  void Compact();
 
   Display* dpy_;
   Properties* prop_;
   std::string filename_;
+  std::string log_filename_;
+  std::string compacting_filename_;  // the log which is being compacted
   std::unordered_map<std::string, Client::Area> client_area_map_;
+
+  std::string pending_;  // the lines to be appended by Flush()
+  size_t log_size_;      // lines in the log(s) since the base was written
+  EventLoop::TimerId flush_timer_;
+  pid_t compaction_pid_;
+  bool has_compacting_log_;  // left behind by a compaction which didn't finish
 };
 
 }  // namespace wmderland
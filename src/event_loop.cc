@@ -0,0 +1,211 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#include "event_loop.h"
+
+extern "C" {
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+}
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include "config.h"
+
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+namespace wmderland {
+
+const EventLoop::TimerId EventLoop::kNoTimer_ = 0;
+
+EventLoop::EventLoop()
+    : timer_fd_(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+      signal_fd_(-1),
+      signal_mask_(),
+      fd_callbacks_(),
+      signal_callbacks_(),
+      timers_(),
+      expired_timers_(),
+      next_timer_id_(kNoTimer_ + 1),
+      pollfds_(),
+      are_pollfds_dirty_(true) {
+  sigemptyset(&signal_mask_);
+
+  if (timer_fd_ == -1) {
+    WM_LOG_WITH_ERRNO("timerfd_create() failed", errno);
+  }
+}
+
+EventLoop::~EventLoop() {
+  if (timer_fd_ != -1) {
+    close(timer_fd_);
+  }
+  if (signal_fd_ != -1) {
+    close(signal_fd_);
+  }
+}
+
+void EventLoop::AddFd(int fd, Callback callback) {
+  fd_callbacks_[fd] = std::move(callback);
+  are_pollfds_dirty_ = true;
+}
+
+void EventLoop::RemoveFd(int fd) {
+  fd_callbacks_.erase(fd);
+  are_pollfds_dirty_ = true;
+}
+
+void EventLoop::AddSignal(int signo, Callback callback) {
+  signal_callbacks_[signo] = std::move(callback);
+
+  // The signal has to be blocked, so that it will be delivered to us via
+  // signal_fd_ instead of interrupting us asynchronously.
+  sigaddset(&signal_mask_, signo);
+  sigprocmask(SIG_BLOCK, &signal_mask_, nullptr);
+
+  signal_fd_ = signalfd(signal_fd_, &signal_mask_, SFD_NONBLOCK | SFD_CLOEXEC);
+  are_pollfds_dirty_ = true;
+  if (signal_fd_ == -1) {
+    WM_LOG_WITH_ERRNO("signalfd() failed", errno);
+  }
+}
+
+EventLoop::TimerId EventLoop::AddTimer(milliseconds delay, Callback callback, bool repeat) {
+  TimerId id = next_timer_id_++;
+  timers_[id] = {steady_clock::now() + delay, delay, std::move(callback), repeat};
+  ArmTimerFd();
+  return id;
+}
+
+void EventLoop::CancelTimer(TimerId id) {
+  if (timers_.erase(id)) {
+    ArmTimerFd();
+  }
+}
+
+void EventLoop::Poll() {
+  // The callbacks may add or remove fds, so pollfds_ is only updated here,
+  // and never while we're iterating over it.
+  if (are_pollfds_dirty_) {
+    UpdatePollFds();
+  }
+
+  if (poll(pollfds_.data(), pollfds_.size(), -1) == -1) {
+    if (errno != EINTR) {
+      WM_LOG_WITH_ERRNO("poll() failed", errno);
+    }
+    return;
+  }
+
+  for (const auto& pfd : pollfds_) {
+    if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+      continue;
+    }
+
+    if (pfd.fd == timer_fd_) {
+      OnTimerFdReadable();
+    } else if (pfd.fd == signal_fd_) {
+      OnSignalFdReadable();
+    } else {
+      // The callback may have been removed by a previous callback.
+      auto it = fd_callbacks_.find(pfd.fd);
+      if (it != fd_callbacks_.end()) {
+        Callback callback = it->second;
+        callback();
+      }
+    }
+  }
+}
+
+void EventLoop::UpdatePollFds() {
+  pollfds_.clear();
+  if (timer_fd_ != -1) {
+    pollfds_.push_back({timer_fd_, POLLIN, 0});
+  }
+  if (signal_fd_ != -1) {
+    pollfds_.push_back({signal_fd_, POLLIN, 0});
+  }
+  for (const auto& fd_callback : fd_callbacks_) {
+    pollfds_.push_back({fd_callback.first, POLLIN, 0});
+  }
+  are_pollfds_dirty_ = false;
+}
+
+// Arms timer_fd_ with the earliest deadline of all timers,
+// or disarms it if there are no timers left.
+void EventLoop::ArmTimerFd() {
+  if (timer_fd_ == -1) {
+    return;
+  }
+
+  itimerspec spec = itimerspec();
+
+  if (!timers_.empty()) {
+    steady_clock::time_point deadline = timers_.begin()->second.deadline;
+    for (const auto& id_timer : timers_) {
+      deadline = std::min(deadline, id_timer.second.deadline);
+    }
+
+    // steady_clock is CLOCK_MONOTONIC on Linux. An all-zero it_value would
+    // disarm the timer, so use 1ns for deadlines which have already passed.
+    nanoseconds::rep ns = std::chrono::duration_cast<nanoseconds>(deadline.time_since_epoch())
+                              .count();
+    spec.it_value.tv_sec = ns / 1000000000;
+    spec.it_value.tv_nsec = ns % 1000000000;
+    if (spec.it_value.tv_sec <= 0 && spec.it_value.tv_nsec <= 0) {
+      spec.it_value.tv_nsec = 1;
+    }
+  }
+
+  if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+    WM_LOG_WITH_ERRNO("timerfd_settime() failed", errno);
+  }
+}
+
+void EventLoop::OnTimerFdReadable() {
+  uint64_t expirations;
+  while (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {
+  }
+
+  // Collect the expired timers first, since the callbacks
+  // may add or cancel timers.
+  steady_clock::time_point now = steady_clock::now();
+  expired_timers_.clear();
+  for (const auto& id_timer : timers_) {
+    if (id_timer.second.deadline <= now) {
+      expired_timers_.push_back(id_timer.first);
+    }
+  }
+
+  for (const auto id : expired_timers_) {
+    auto it = timers_.find(id);
+    if (it == timers_.end()) {
+      continue;
+    }
+
+    Callback callback = it->second.callback;
+    if (it->second.repeat) {
+      it->second.deadline = now + it->second.interval;
+    } else {
+      timers_.erase(it);
+    }
+    callback();
+  }
+
+  ArmTimerFd();
+}
+
+void EventLoop::OnSignalFdReadable() {
+  signalfd_siginfo info;
+  while (read(signal_fd_, &info, sizeof(info)) == sizeof(info)) {
+    auto it = signal_callbacks_.find(info.ssi_signo);
+    if (it != signal_callbacks_.end()) {
+      it->second();
+    }
+  }
+}
+
+}  // namespace wmderland
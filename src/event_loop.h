@@ -0,0 +1,70 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#ifndef WMDERLAND_EVENT_LOOP_H_
+#define WMDERLAND_EVENT_LOOP_H_
+
+extern "C" {
+#include <poll.h>
+#include <signal.h>
+}
+#include <chrono>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace wmderland {
+
+// EventLoop multiplexes the X connection with timers (timerfd), signals
+// (signalfd) and any other file descriptors using poll(), so that the WM
+// can perform deferred work, react to signals and serve sockets without
+// busy-waiting or extra threads.
+class EventLoop {
+ public:
+  using Callback = std::function<void()>;
+  using TimerId = unsigned long;
+
+  EventLoop();
+  virtual ~EventLoop();
+
+  void AddFd(int fd, Callback callback);
+  void RemoveFd(int fd);
+  void AddSignal(int signo, Callback callback);
+  TimerId AddTimer(std::chrono::milliseconds delay, Callback callback, bool repeat = false);
+  void CancelTimer(TimerId id);
+
+  // Blocks until a file descriptor becomes readable, a timer expires or a
+  // signal arrives, and then runs the corresponding callbacks.
+  void Poll();
+
+  static const TimerId kNoTimer_;
+
+ private:
+  struct Timer {
+    std::chrono::steady_clock::time_point deadline;
+    std::chrono::milliseconds interval;
+    Callback callback;
+    bool repeat;
+  };
+
+  void UpdatePollFds();
+  void ArmTimerFd();
+  void OnTimerFdReadable();
+  void OnSignalFdReadable();
+
+  int timer_fd_;
+  int signal_fd_;
+  sigset_t signal_mask_;
+
+  std::map<int, Callback> fd_callbacks_;
+  std::map<int, Callback> signal_callbacks_;
+  std::map<TimerId, Timer> timers_;
+  std::vector<TimerId> expired_timers_;  // reused by OnTimerFdReadable()
+  TimerId next_timer_id_;
+
+  // What Poll() waits for, which is only rebuilt once the fds have changed.
+  std::vector<pollfd> pollfds_;
+  bool are_pollfds_dirty_;
+};
+
+}  // namespace wmderland
+
+#endif  // WMDERLAND_EVENT_LOOP_H_
@@ -0,0 +1,546 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#include "journal.h"
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <map>
+
+#include "client.h"
+#include "window_manager.h"
+#include "workspace.h"
+
+using std::string;
+using std::vector;
+
+namespace wmderland {
+
+namespace {
+
+template <typename T>
+void Put(string& data, const T& value) {
+  data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+uint64_t RoundUpToPage(uint64_t size) {
+  uint64_t page_size = sysconf(_SC_PAGESIZE);
+  return (size + page_size - 1) / page_size * page_size;
+}
+
+}  // namespace
+
+const char Journal::kMagic_[8] = {'W', 'M', 'D', 'J', 'R', 'N', 'L', '\0'};
+const uint32_t Journal::kVersion_ = 1;
+
+Journal::Journal()
+    : fd_(-1),
+      data_(),
+      capacity_(),
+      journaled_(),
+      journaled_current_(-1),
+      dirty_workspaces_(),
+      are_roles_dirty_(),
+      scratch_(),
+      nodes_(),
+      compaction_timer_(EventLoop::kNoTimer_),
+      last_append_(),
+      counters_() {}
+
+Journal::~Journal() {
+  Unmap();
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+void Journal::Open() {
+  if (fd_ == -1) {
+    Compact();
+  }
+}
+
+void Journal::Restore(int fd) {
+  WindowManager* wm = WindowManager::GetInstance();
+
+  // From now on, the inherited memfd is our journal.
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  fd_ = fd;
+
+  try {
+    if (!Map()) {
+      throw Snapshot::SnapshotLoadError();
+    }
+
+    // If the restored state keeps crashing the WM, give up, like
+    // Snapshot::Load() does. The count is reset once the WM is idle.
+    if (header().restore_count >= 3) {
+      throw Snapshot::SnapshotLoadError();
+    }
+    header().restore_count++;
+
+    string snapshot = Replay();
+    wm->snapshot_.Restore(snapshot.data(), snapshot.size());
+  } catch (const Snapshot::SnapshotLoadError&) {
+    // The snapshot file has nothing to do with it, so the error is the
+    // journal's own, and the caller may still fall back to the snapshot.
+    Unmap();
+    close(fd_);
+    fd_ = -1;
+    throw JournalLoadError();
+  }
+
+  Compact();
+  ScheduleCompaction();
+}
+
+void Journal::MarkDirty(int workspace_id) {
+  if (std::find(dirty_workspaces_.begin(), dirty_workspaces_.end(), workspace_id) ==
+      dirty_workspaces_.end()) {
+    dirty_workspaces_.push_back(workspace_id);
+  }
+}
+
+void Journal::MarkRolesDirty() {
+  are_roles_dirty_ = true;
+}
+
+// Appends an entry for everything which differs from what the journal says,
+// and commits them all at once, so the journal never has half of a batch.
+void Journal::Flush() {
+  if (!data_) {
+    return;
+  }
+
+  WindowManager* wm = WindowManager::GetInstance();
+  scratch_.clear();
+
+  // 1. The workspaces which have been changed or created.
+  for (const auto id : dirty_workspaces_) {
+    auto it = wm->workspaces_.find(id);
+    if (it != wm->workspaces_.end()) {
+      AppendWorkspace(it->second.get());
+    }
+  }
+  for (const auto& workspace : wm->workspaces_) {
+    if (!journaled_.count(workspace.first)) {
+      AppendWorkspace(workspace.second.get());
+    }
+  }
+
+  // 2. The workspaces which have been reclaimed, and the focused client of
+  // the others.
+  for (auto it = journaled_.begin(); it != journaled_.end();) {
+    auto workspace = wm->workspaces_.find(it->first);
+    if (workspace == wm->workspaces_.end()) {
+      Put(scratch_, Entry{REMOVE_WORKSPACE, sizeof(Entry) + 8});
+      Put(scratch_, static_cast<int32_t>(it->first));
+      Put(scratch_, static_cast<uint32_t>(0));
+      it = journaled_.erase(it);
+      counters_.entries++;
+      continue;
+    }
+
+    Client* focused_client = workspace->second->GetFocusedClient();
+    Window window = (focused_client) ? focused_client->window() : None;
+    if (window != it->second) {
+      Put(scratch_, Entry{FOCUS, sizeof(Entry) + 16});
+      Put(scratch_, static_cast<int32_t>(it->first));
+      Put(scratch_, static_cast<uint32_t>(0));
+      Put(scratch_, static_cast<uint64_t>(window));
+      it->second = window;
+      counters_.entries++;
+    }
+    ++it;
+  }
+
+  // 3. The current workspace, docks and notifications.
+  if (are_roles_dirty_ || wm->current_ != journaled_current_) {
+    AppendRoles();
+  }
+
+  dirty_workspaces_.clear();
+  are_roles_dirty_ = false;
+
+  if (!scratch_.empty()) {
+    Commit();
+    ScheduleCompaction();
+  }
+}
+
+// Replaces the journal with a new one whose base is the current state and
+// whose log is empty. The new memfd takes over the file descriptor number
+// of the old one in a single dup3(2), so whichever of the two a crash
+// leaves behind is complete.
+void Journal::Compact() {
+  WindowManager* wm = WindowManager::GetInstance();
+  string base = wm->snapshot_.Serialize(0);
+
+  int fd = memfd_create("wmderland-journal", MFD_CLOEXEC);
+  if (fd == -1) {
+    WM_LOG_WITH_ERRNO("Failed to create journal", errno);
+    return;
+  }
+
+  uint64_t capacity = RoundUpToPage(sizeof(Header) + base.size() * 2);
+  void* data = MAP_FAILED;
+  if (ftruncate(fd, capacity) == 0) {
+    data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (data == MAP_FAILED) {
+    WM_LOG_WITH_ERRNO("Failed to allocate journal", errno);
+    close(fd);
+    return;
+  }
+
+  Header header = {};
+  memcpy(header.magic, kMagic_, sizeof(kMagic_));
+  header.version = kVersion_;
+  header.restore_count = (data_) ? this->header().restore_count : 0;
+  header.base_size = base.size();
+  header.log_size = 0;
+  memcpy(static_cast<char*>(data) + sizeof(Header), base.data(), base.size());
+  memcpy(data, &header, sizeof(header));
+
+  if (fd_ == -1) {
+    fd_ = fd;
+  } else if (dup3(fd, fd_, O_CLOEXEC) == -1) {
+    WM_LOG_WITH_ERRNO("Failed to replace journal", errno);
+    munmap(data, capacity);
+    close(fd);
+    return;
+  } else {
+    close(fd);
+  }
+
+  Unmap();
+  data_ = static_cast<char*>(data);
+  capacity_ = capacity;
+
+  // The journal now says exactly what the WM has.
+  journaled_.clear();
+  for (const auto& workspace : wm->workspaces_) {
+    Client* focused_client = workspace.second->GetFocusedClient();
+    journaled_[workspace.first] = (focused_client) ? focused_client->window() : None;
+  }
+  journaled_current_ = wm->current_;
+  dirty_workspaces_.clear();
+  are_roles_dirty_ = false;
+  counters_.compactions++;
+}
+
+int Journal::Release() {
+  if (fd_ == -1) {
+    return -1;
+  }
+
+  fcntl(fd_, F_SETFD, 0);
+  int fd = fd_;
+  Unmap();
+  fd_ = -1;
+  return fd;
+}
+
+int Journal::fd() const {
+  return fd_;
+}
+
+const Journal::Counters& Journal::counters() const {
+  return counters_;
+}
+
+Journal::Header& Journal::header() const {
+  return *reinterpret_cast<Header*>(data_);
+}
+
+bool Journal::Map() {
+  struct stat st;
+  if (fstat(fd_, &st) == -1 || static_cast<uint64_t>(st.st_size) < sizeof(Header)) {
+    return false;
+  }
+
+  void* data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  data_ = static_cast<char*>(data);
+  capacity_ = st.st_size;
+
+  const Header& h = header();
+  if (memcmp(h.magic, kMagic_, sizeof(kMagic_)) || h.version != kVersion_ ||
+      h.base_size > capacity_ || h.log_size > capacity_ ||
+      sizeof(Header) + h.base_size + h.log_size > capacity_) {
+    Unmap();
+    return false;
+  }
+  return true;
+}
+
+void Journal::Unmap() {
+  if (data_) {
+    munmap(data_, capacity_);
+    data_ = nullptr;
+    capacity_ = 0;
+  }
+}
+
+// Grows the memfd (by at least twice) if there's no room for `size` more
+// bytes of log. What has been committed is kept as is.
+bool Journal::Reserve(uint64_t size) {
+  uint64_t end = sizeof(Header) + header().base_size + header().log_size + size;
+  if (end <= capacity_) {
+    return true;
+  }
+
+  uint64_t capacity = RoundUpToPage(std::max(end, capacity_ * 2));
+  if (ftruncate(fd_, capacity) == -1) {
+    return false;
+  }
+
+  void* data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  Unmap();
+  data_ = static_cast<char*>(data);
+  capacity_ = capacity;
+  return true;
+}
+
+// The entries are copied first, and then committed by bumping log_size.
+void Journal::Commit() {
+  if (!Reserve(scratch_.size())) {
+    // Forget what has been journaled, so that the next Flush() (or
+    // Compact()) writes everything again.
+    WM_LOG_WITH_ERRNO("Failed to grow journal", errno);
+    journaled_.clear();
+    journaled_current_ = -1;
+    are_roles_dirty_ = true;
+    return;
+  }
+
+  Header& h = header();
+  memcpy(data_ + sizeof(Header) + h.base_size + h.log_size, scratch_.data(), scratch_.size());
+  std::atomic_signal_fence(std::memory_order_release);
+  h.log_size += scratch_.size();
+  counters_.bytes += scratch_.size();
+}
+
+void Journal::AppendWorkspace(const Workspace* workspace) {
+  nodes_.clear();
+  workspace->Serialize(nodes_);
+  ArenaVector<Client*> clients = workspace->GetClients();
+
+  Snapshot::WorkspaceRecord record = Snapshot::MakeWorkspaceRecord(workspace, nodes_.size());
+  Put(scratch_, Entry{WORKSPACE, static_cast<uint32_t>(
+                                     sizeof(Entry) + sizeof(record) + 8 +
+                                     clients.size() * sizeof(Snapshot::ClientRecord) +
+                                     nodes_.size() * sizeof(Tree::Record))});
+  Put(scratch_, record);
+  Put(scratch_, static_cast<uint32_t>(clients.size()));
+  Put(scratch_, static_cast<uint32_t>(0));
+  for (const auto c : clients) {
+    Put(scratch_, Snapshot::MakeClientRecord(c));
+  }
+  scratch_.append(reinterpret_cast<const char*>(nodes_.data()),
+                  nodes_.size() * sizeof(Tree::Record));
+
+  journaled_[workspace->id()] = static_cast<Window>(record.current_window);
+  counters_.entries++;
+}
+
+void Journal::AppendRoles() {
+  WindowManager* wm = WindowManager::GetInstance();
+  size_t dock_count = wm->registry_->count(WindowRegistry::DOCK);
+  size_t notification_count = wm->registry_->count(WindowRegistry::NOTIFICATION);
+
+  Put(scratch_, Entry{ROLES, static_cast<uint32_t>(sizeof(Entry) + 16 +
+                                                   (dock_count + notification_count) * 8)});
+  Put(scratch_, static_cast<int32_t>(wm->current_));
+  Put(scratch_, static_cast<uint32_t>(dock_count));
+  Put(scratch_, static_cast<uint32_t>(notification_count));
+  Put(scratch_, static_cast<uint32_t>(0));
+  for (const auto role : {WindowRegistry::DOCK, WindowRegistry::NOTIFICATION}) {
+    wm->registry_->ForEach(role, [this](const WindowRegistry::Entry& e) {
+      Put(scratch_, static_cast<uint64_t>(e.window));
+    });
+  }
+
+  journaled_current_ = wm->current_;
+  counters_.entries++;
+}
+
+// Compacts the journal once nothing has been appended for a while, which
+// is also when the restored state is considered to be good.
+void Journal::ScheduleCompaction() {
+  last_append_ = std::chrono::steady_clock::now();
+  if (compaction_timer_ != EventLoop::kNoTimer_) {
+    return;
+  }
+
+  std::chrono::milliseconds delay(JOURNAL_COMPACTION_DELAY);
+  compaction_timer_ = WindowManager::GetInstance()->event_loop_.AddTimer(delay, [this]() {
+    compaction_timer_ = EventLoop::kNoTimer_;
+
+    auto idle = std::chrono::steady_clock::now() - last_append_;
+    if (idle < std::chrono::milliseconds(JOURNAL_COMPACTION_DELAY)) {
+      last_append_ -= idle;  // keep the original deadline
+      ScheduleCompaction();
+      return;
+    }
+
+    if (data_) {
+      header().restore_count = 0;
+      Compact();
+    }
+  });
+}
+
+// Applies the log to the base, and returns the result as a snapshot, see
+// Snapshot::Restore().
+string Journal::Replay() const {
+  struct WorkspaceState {
+    Snapshot::WorkspaceRecord record;
+    vector<Snapshot::ClientRecord> clients;
+    vector<Tree::Record> nodes;
+  };
+
+  const Header& h = header();
+  Snapshot::Contents base;
+  if (!Snapshot::Parse(data_ + sizeof(Header), h.base_size, &base)) {
+    throw Snapshot::SnapshotLoadError();
+  }
+
+  // 1. The base.
+  std::map<int, WorkspaceState> workspaces;
+  const Tree::Record* nodes = base.nodes;
+  for (uint32_t i = 0; i < base.header->workspace_count; i++) {
+    WorkspaceState& workspace = workspaces[base.workspaces[i].id];
+    workspace.record = base.workspaces[i];
+    workspace.nodes.assign(nodes, nodes + workspace.record.node_count);
+    nodes += workspace.record.node_count;
+  }
+  for (uint32_t i = 0; i < base.header->client_count; i++) {
+    auto it = workspaces.find(base.clients[i].workspace_id);
+    if (it == workspaces.end()) {
+      throw Snapshot::SnapshotLoadError();
+    }
+    it->second.clients.push_back(base.clients[i]);
+  }
+
+  int current = base.header->current_workspace;
+  vector<uint64_t> docks(base.docks, base.docks + base.header->dock_count);
+  vector<uint64_t> notifications(base.notifications,
+                                 base.notifications + base.header->notification_count);
+
+  // 2. The log, each entry replacing a part of the above.
+  const char* p = data_ + sizeof(Header) + h.base_size;
+  const char* end = p + h.log_size;
+
+  while (p < end) {
+    const Entry* entry = reinterpret_cast<const Entry*>(p);
+    if (static_cast<size_t>(end - p) < sizeof(Entry) || entry->size < sizeof(Entry) ||
+        entry->size % 8 || entry->size > end - p) {
+      throw Snapshot::SnapshotLoadError();
+    }
+    const char* payload = p + sizeof(Entry);
+    size_t payload_size = entry->size - sizeof(Entry);
+    p += entry->size;
+
+    switch (entry->type) {
+      case WORKSPACE: {
+        if (payload_size < sizeof(Snapshot::WorkspaceRecord) + 8) {
+          throw Snapshot::SnapshotLoadError();
+        }
+        const auto* record = reinterpret_cast<const Snapshot::WorkspaceRecord*>(payload);
+        uint32_t client_count = 0;
+        memcpy(&client_count, payload + sizeof(*record), sizeof(client_count));
+        const auto* clients = reinterpret_cast<const Snapshot::ClientRecord*>(
+            payload + sizeof(*record) + 8);
+        const auto* tree = reinterpret_cast<const Tree::Record*>(clients + client_count);
+
+        if (payload_size != sizeof(*record) + 8 + client_count * sizeof(*clients) +
+                                record->node_count * sizeof(*tree) ||
+            record->id < 0 || record->id >= MAX_WORKSPACE_COUNT) {
+          throw Snapshot::SnapshotLoadError();
+        }
+
+        WorkspaceState& workspace = workspaces[record->id];
+        workspace.record = *record;
+        workspace.clients.assign(clients, clients + client_count);
+        workspace.nodes.assign(tree, tree + record->node_count);
+        break;
+      }
+      case REMOVE_WORKSPACE: {
+        if (payload_size != 8) {
+          throw Snapshot::SnapshotLoadError();
+        }
+        int32_t id = 0;
+        memcpy(&id, payload, sizeof(id));
+        workspaces.erase(id);
+        break;
+      }
+      case FOCUS: {
+        if (payload_size != 16) {
+          throw Snapshot::SnapshotLoadError();
+        }
+        int32_t id = 0;
+        uint64_t window = None;
+        memcpy(&id, payload, sizeof(id));
+        memcpy(&window, payload + 8, sizeof(window));
+        auto it = workspaces.find(id);
+        if (it != workspaces.end()) {
+          it->second.record.current_window = window;
+        }
+        break;
+      }
+      case ROLES: {
+        if (payload_size < 16) {
+          throw Snapshot::SnapshotLoadError();
+        }
+        uint32_t counts[2] = {};
+        memcpy(&current, payload, sizeof(current));
+        memcpy(counts, payload + 4, sizeof(counts));
+        const uint64_t* windows = reinterpret_cast<const uint64_t*>(payload + 16);
+        if (payload_size != 16 + (static_cast<uint64_t>(counts[0]) + counts[1]) * 8) {
+          throw Snapshot::SnapshotLoadError();
+        }
+        docks.assign(windows, windows + counts[0]);
+        notifications.assign(windows + counts[0], windows + counts[0] + counts[1]);
+        break;
+      }
+      default:
+        throw Snapshot::SnapshotLoadError();
+    }
+  }
+
+  // 3. The result as a snapshot.
+  vector<Snapshot::ClientRecord> clients;
+  vector<Snapshot::WorkspaceRecord> records;
+  vector<Tree::Record> tree;
+  for (const auto& workspace : workspaces) {
+    clients.insert(clients.end(), workspace.second.clients.begin(),
+                   workspace.second.clients.end());
+    records.push_back(workspace.second.record);
+    tree.insert(tree.end(), workspace.second.nodes.begin(), workspace.second.nodes.end());
+  }
+  vector<uint64_t> windows(docks);
+  windows.insert(windows.end(), notifications.begin(), notifications.end());
+
+  Snapshot::Header header = {};
+  header.client_count = clients.size();
+  header.workspace_count = records.size();
+  header.node_count = tree.size();
+  header.dock_count = docks.size();
+  header.notification_count = notifications.size();
+  header.current_workspace = current;
+  return Snapshot::Encode(header, clients.data(), records.data(), tree.data(), windows.data());
+}
+
+}  // namespace wmderland
@@ -0,0 +1,129 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#ifndef WMDERLAND_JOURNAL_H_
+#define WMDERLAND_JOURNAL_H_
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "event_loop.h"
+#include "snapshot.h"
+#include "tree.h"
+#include "workspace.h"
+
+namespace wmderland {
+
+// The Journal keeps the state of the WM in a memfd which survives execve(2),
+// so that the process which takes over after a crash (even a SIGSEGV) can
+// restore the layout without the dying process having to save anything from
+// state which may already be corrupt.
+//
+// The memfd holds a snapshot (the base, see Snapshot::Serialize()) followed
+// by a log of entries, each of which replaces a part of the state: a
+// workspace with its clients and client tree, the focused client of a
+// workspace, or the current workspace with the docks and notifications. The
+// event handlers only mark what they've changed, and Flush(), which is called
+// once per batch of events, appends the entries. Once the WM has been idle
+// for a while, the log is folded into a new base, see Compact().
+class Journal {
+ public:
+  class JournalLoadError : public std::exception {
+   public:
+    virtual ~JournalLoadError() = default;
+    virtual const char* what() const throw() {
+      return "Failed to restore from the journal (possibly corrupted). Discarding it...";
+    }
+  };
+
+  // The number of entries (and bytes) appended, and compactions.
+  struct Counters {
+    unsigned long entries;
+    unsigned long bytes;
+    unsigned long compactions;
+  };
+
+  Journal();
+  virtual ~Journal();
+
+  // Creates the memfd with the current state as its base, unless a journal
+  // has already been adopted by Restore().
+  void Open();
+  // Adopts the journal inherited from the previous process, and restores the
+  // WM from it. Throws JournalLoadError if it cannot be restored, in which
+  // case the journal is closed, and Open() will create a new one.
+  void Restore(int fd);
+
+  void MarkDirty(int workspace_id);  // its clients or its client tree
+  void MarkRolesDirty();             // the docks or notifications
+  void Flush();
+  void Compact();
+
+  // Hands the memfd over to the next process (it's kept open across exec),
+  // and returns it, or -1 if there's no journal.
+  int Release();
+
+  int fd() const;
+  const Counters& counters() const;
+
+ private:
+  enum EntryType : uint32_t {
+    WORKSPACE,         // WorkspaceRecord, client count, ClientRecords, Tree::Records
+    REMOVE_WORKSPACE,  // workspace id
+    FOCUS,             // workspace id, window
+    ROLES,             // current workspace, dock and notification count, windows
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t restore_count;  // restores since the WM was last idle
+    uint64_t base_size;
+    uint64_t log_size;  // only the entries up to here have been committed
+  };
+
+  struct Entry {
+    uint32_t type;  // EntryType
+    uint32_t size;  // including this header, always a multiple of 8
+  };
+
+  Header& header() const;
+  bool Map();
+  void Unmap();
+  bool Reserve(uint64_t size);
+  void Commit();
+  void AppendWorkspace(const Workspace* workspace);
+  void AppendRoles();
+  void ScheduleCompaction();
+  std::string Replay() const;
+
+  static const char kMagic_[8];
+  static const uint32_t kVersion_;
+
+  int fd_;
+  char* data_;  // the mapped memfd
+  uint64_t capacity_;
+
+  // What the journal says about each workspace (its focused window), and
+  // about the current workspace, as of the last Flush().
+  std::unordered_map<int, Window> journaled_;
+  int journaled_current_;
+
+  std::vector<int> dirty_workspaces_;
+  bool are_roles_dirty_;
+  std::string scratch_;  // the entries of the current Flush()
+  std::vector<Tree::Record> nodes_;
+
+  EventLoop::TimerId compaction_timer_;
+  std::chrono::steady_clock::time_point last_append_;
+  Counters counters_;
+};
+
+}  // namespace wmderland
+
+#endif  // WMDERLAND_JOURNAL_H_
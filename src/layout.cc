@@ -0,0 +1,272 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#include "layout.h"
+
+#include <cctype>
+#include <cmath>
+
+using std::string;
+using std::unique_ptr;
+
+namespace wmderland {
+
+unique_ptr<Layout> Layout::Create(Layout::Type type) {
+  switch (type) {
+    case Layout::Type::MASTER_STACK:
+      return std::make_unique<MasterStackLayout>();
+    case Layout::Type::MONOCLE:
+      return std::make_unique<MonocleLayout>();
+    case Layout::Type::GRID:
+      return std::make_unique<GridLayout>();
+    case Layout::Type::SPIRAL:
+      return std::make_unique<SpiralLayout>();
+    case Layout::Type::SPLIT:
+    default:
+      return std::make_unique<SplitLayout>();
+  }
+}
+
+// A layout may also be given by its index (e.g., "2" for monocle), since
+// the arguments sent by wmderlandc are numbers.
+Layout::Type Layout::StrToType(const string& s) {
+  if (s == "split") {
+    return Layout::Type::SPLIT;
+  } else if (s == "master_stack") {
+    return Layout::Type::MASTER_STACK;
+  } else if (s == "monocle") {
+    return Layout::Type::MONOCLE;
+  } else if (s == "grid") {
+    return Layout::Type::GRID;
+  } else if (s == "spiral") {
+    return Layout::Type::SPIRAL;
+  } else if (s.size() == 1 && std::isdigit(s.front()) &&
+             s.front() - '0' < static_cast<int>(Layout::Type::UNDEFINED)) {
+    return static_cast<Layout::Type>(s.front() - '0');
+  } else {
+    return Layout::Type::UNDEFINED;
+  }
+}
+
+const char* Layout::TypeToStr(Layout::Type type) {
+  switch (type) {
+    case Layout::Type::SPLIT:
+      return "split";
+    case Layout::Type::MASTER_STACK:
+      return "master_stack";
+    case Layout::Type::MONOCLE:
+      return "monocle";
+    case Layout::Type::GRID:
+      return "grid";
+    case Layout::Type::SPIRAL:
+      return "spiral";
+    default:
+      return "undefined";
+  }
+}
+
+void Layout::Place(Plan& plan, Tree::NodeId node, int x, int y, int w, int h, int border_width,
+                   int gap_width) {
+  plan.push_back({node, Client::Area(x + gap_width / 2, y + gap_width / 2,
+                                     w - border_width * 2 - gap_width,
+                                     h - border_width * 2 - gap_width)});
+}
+
+// Returns the leaves with a tiling client from left to right.
+ArenaVector<Tree::NodeId> Layout::GetTilingLeaves(const Tree& tree) {
+  ArenaVector<Tree::NodeId> leaves;
+  leaves.reserve(tree.tiling_count(tree.root_node()));
+
+  for (const auto leaf : tree.leaves()) {
+    Client* c = tree.client(leaf);
+    if (c && !c->is_floating()) {
+      leaves.push_back(leaf);
+    }
+  }
+  return leaves;
+}
+
+Layout::Plan SplitLayout::Compute(const Tree& tree, const Client::Area& area, int border_width,
+                                  int gap_width) const {
+  Plan plan;
+  plan.reserve(tree.tiling_count(tree.root_node()));
+  DfsHelper(tree, tree.root_node(), area.x, area.y, area.w, area.h, border_width, gap_width,
+            plan);
+  return plan;
+}
+
+Layout::Type SplitLayout::type() const {
+  return Layout::Type::SPLIT;
+}
+
+void SplitLayout::DfsHelper(const Tree& tree, Tree::NodeId node, int x, int y, int w, int h,
+                            int border_width, int gap_width, Plan& plan) const {
+  // We don't care about two kinds of nodes
+  // 1. an internal node with no tiling clients in its subtree
+  // 2. a leaf but it has a floating client
+  // Tree::HasTilingClientsInSubtree() can check 1 and 2 at the same time,
+  // in O(1) since each node keeps count of the clients in its subtree.
+  size_t tiling_children_count = 0;
+  for (const auto child : tree.children(node)) {
+    if (tree.HasTilingClientsInSubtree(child)) {
+      tiling_children_count++;
+    }
+  }
+
+  if (!tiling_children_count) {
+    return;
+  }
+
+  // Calculate each child's x, y, width and height based on node's tiling
+  // direction.
+  TilingDirection dir = tree.tiling_direction(node);
+  int child_x = x;
+  int child_y = y;
+  int child_width = (dir == TilingDirection::HORIZONTAL) ? w / tiling_children_count : w;
+  int child_height = (dir == TilingDirection::VERTICAL) ? h / tiling_children_count : h;
+  size_t i = 0;
+
+  for (const auto child : tree.children(node)) {
+    if (!tree.HasTilingClientsInSubtree(child)) {
+      continue;
+    }
+    if (dir == TilingDirection::HORIZONTAL) child_x = x + child_width * i;
+    if (dir == TilingDirection::VERTICAL) child_y = y + child_height * i;
+    i++;
+
+    if (tree.leaf(child)) {
+      Place(plan, child, child_x, child_y, child_width, child_height, border_width, gap_width);
+      continue;
+    }
+
+    // A subtree which hasn't changed since it was given the same area last
+    // time is already where it should be.
+    Client::Area child_area(child_x, child_y, child_width, child_height);
+    if (!tree.dirty(child) && tree.tile_area(child) == child_area) {
+      continue;
+    }
+    plan.push_back({child, child_area});
+    DfsHelper(tree, child, child_x, child_y, child_width, child_height, border_width,
+              gap_width, plan);
+  }
+}
+
+Layout::Plan MasterStackLayout::Compute(const Tree& tree, const Client::Area& area,
+                                        int border_width, int gap_width) const {
+  ArenaVector<Tree::NodeId> leaves = GetTilingLeaves(tree);
+  Plan plan;
+  plan.reserve(leaves.size());
+
+  if (leaves.empty()) {
+    return plan;
+  } else if (leaves.size() == 1) {
+    Place(plan, leaves.front(), area.x, area.y, area.w, area.h, border_width, gap_width);
+    return plan;
+  }
+
+  int master_width = area.w / 2;
+  int stack_height = area.h / static_cast<int>(leaves.size() - 1);
+  Place(plan, leaves.front(), area.x, area.y, master_width, area.h, border_width, gap_width);
+
+  for (size_t i = 1; i < leaves.size(); i++) {
+    Place(plan, leaves[i], area.x + master_width, area.y + stack_height * (i - 1),
+          area.w - master_width, stack_height, border_width, gap_width);
+  }
+  return plan;
+}
+
+Layout::Type MasterStackLayout::type() const {
+  return Layout::Type::MASTER_STACK;
+}
+
+Layout::Plan MonocleLayout::Compute(const Tree& tree, const Client::Area& area,
+                                    int border_width, int gap_width) const {
+  ArenaVector<Tree::NodeId> leaves = GetTilingLeaves(tree);
+  Plan plan;
+  plan.reserve(leaves.size());
+
+  for (const auto leaf : leaves) {
+    Place(plan, leaf, area.x, area.y, area.w, area.h, border_width, gap_width);
+  }
+  return plan;
+}
+
+Layout::Type MonocleLayout::type() const {
+  return Layout::Type::MONOCLE;
+}
+
+Layout::Plan GridLayout::Compute(const Tree& tree, const Client::Area& area, int border_width,
+                                 int gap_width) const {
+  ArenaVector<Tree::NodeId> leaves = GetTilingLeaves(tree);
+  Plan plan;
+  plan.reserve(leaves.size());
+
+  if (leaves.empty()) {
+    return plan;
+  }
+
+  int n = leaves.size();
+  int cols = static_cast<int>(std::ceil(std::sqrt(n)));
+  int rows = (n + cols - 1) / cols;
+  int cell_height = area.h / rows;
+
+  // The last row may have fewer clients, which are then widened to fill it.
+  for (int i = 0; i < n; i++) {
+    int row = i / cols;
+    int cols_in_row = (row == rows - 1) ? n - row * cols : cols;
+    int cell_width = area.w / cols_in_row;
+    Place(plan, leaves[i], area.x + cell_width * (i % cols), area.y + cell_height * row,
+          cell_width, cell_height, border_width, gap_width);
+  }
+  return plan;
+}
+
+Layout::Type GridLayout::type() const {
+  return Layout::Type::GRID;
+}
+
+Layout::Plan SpiralLayout::Compute(const Tree& tree, const Client::Area& area,
+                                   int border_width, int gap_width) const {
+  ArenaVector<Tree::NodeId> leaves = GetTilingLeaves(tree);
+  Plan plan;
+  plan.reserve(leaves.size());
+
+  // The area which hasn't been taken yet.
+  int x = area.x;
+  int y = area.y;
+  int w = area.w;
+  int h = area.h;
+
+  for (size_t i = 0; i < leaves.size(); i++) {
+    if (i == leaves.size() - 1) {
+      Place(plan, leaves[i], x, y, w, h, border_width, gap_width);
+      break;
+    }
+
+    switch (i % 4) {
+      case 0:  // left
+        Place(plan, leaves[i], x, y, w / 2, h, border_width, gap_width);
+        x += w / 2;
+        w -= w / 2;
+        break;
+      case 1:  // top
+        Place(plan, leaves[i], x, y, w, h / 2, border_width, gap_width);
+        y += h / 2;
+        h -= h / 2;
+        break;
+      case 2:  // right
+        Place(plan, leaves[i], x + w - w / 2, y, w / 2, h, border_width, gap_width);
+        w -= w / 2;
+        break;
+      default:  // bottom
+        Place(plan, leaves[i], x, y + h - h / 2, w, h / 2, border_width, gap_width);
+        h -= h / 2;
+        break;
+    }
+  }
+  return plan;
+}
+
+Layout::Type SpiralLayout::type() const {
+  return Layout::Type::SPIRAL;
+}
+
+}  // namespace wmderland
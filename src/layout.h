@@ -0,0 +1,110 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#ifndef WMDERLAND_LAYOUT_H_
+#define WMDERLAND_LAYOUT_H_
+
+#include <memory>
+#include <string>
+
+#include "arena.h"
+#include "client.h"
+#include "tree.h"
+
+namespace wmderland {
+
+// A Layout decides where the tiling clients of a workspace should be placed.
+// It only computes the geometry of each client and never talks to the X
+// server, so Workspace::Tile() can compare the result against what the
+// clients already have, and only move/resize the ones which differ.
+class Layout {
+ public:
+  enum class Type {
+    SPLIT,
+    MASTER_STACK,
+    MONOCLE,
+    GRID,
+    SPIRAL,
+    UNDEFINED,
+  };
+
+  // The geometry of the client at a leaf, i.e., the arguments to
+  // Client::MoveResize(). A layout may also place an internal node, which
+  // records the area given to its subtree, see Tree::MarkClean().
+  struct Placement {
+    Tree::NodeId node;
+    Client::Area area;
+  };
+
+  // A plan only lives as long as the current event, see Arena::per_event().
+  using Plan = ArenaVector<Placement>;
+
+  static std::unique_ptr<Layout> Create(Layout::Type type);
+  static Layout::Type StrToType(const std::string& s);
+  static const char* TypeToStr(Layout::Type type);
+
+  virtual ~Layout() = default;
+
+  // `area` is the tiling area which has already been shrunk by half a gap
+  // on each side.
+  virtual Plan Compute(const Tree& tree, const Client::Area& area, int border_width,
+                       int gap_width) const = 0;
+  virtual Layout::Type type() const = 0;
+
+ protected:
+  // Places the client at `node` in the given cell, leaving room for its
+  // border and half a gap on each side.
+  static void Place(Plan& plan, Tree::NodeId node, int x, int y, int w, int h,
+                    int border_width, int gap_width);
+  static ArenaVector<Tree::NodeId> GetTilingLeaves(const Tree& tree);
+};
+
+// The classic Wmderland layout: each internal node of the client tree splits
+// its area evenly among its children, either horizontally or vertically.
+// It's incremental: a subtree which is clean and given the same area as
+// last time is skipped, so re-tiling costs as much as what has changed.
+class SplitLayout : public Layout {
+ public:
+  Plan Compute(const Tree& tree, const Client::Area& area, int border_width,
+               int gap_width) const override;
+  Layout::Type type() const override;
+
+ private:
+  void DfsHelper(const Tree& tree, Tree::NodeId node, int x, int y, int w, int h,
+                 int border_width, int gap_width, Plan& plan) const;
+};
+
+// The first client takes the left half, and the others are stacked on the right.
+class MasterStackLayout : public Layout {
+ public:
+  Plan Compute(const Tree& tree, const Client::Area& area, int border_width,
+               int gap_width) const override;
+  Layout::Type type() const override;
+};
+
+// Every client takes the entire area, and only the focused one is visible.
+class MonocleLayout : public Layout {
+ public:
+  Plan Compute(const Tree& tree, const Client::Area& area, int border_width,
+               int gap_width) const override;
+  Layout::Type type() const override;
+};
+
+// The clients are arranged in rows of ceil(sqrt(n)) columns.
+class GridLayout : public Layout {
+ public:
+  Plan Compute(const Tree& tree, const Client::Area& area, int border_width,
+               int gap_width) const override;
+  Layout::Type type() const override;
+};
+
+// Each client takes half of the area left by the previous ones, turning
+// clockwise (the Fibonacci spiral).
+class SpiralLayout : public Layout {
+ public:
+  Plan Compute(const Tree& tree, const Client::Area& area, int border_width,
+               int gap_width) const override;
+  Layout::Type type() const override;
+};
+
+}  // namespace wmderland
+
+#endif  // WMDERLAND_LAYOUT_H_
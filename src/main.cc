@@ -1,7 +1,12 @@
 // Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
 extern "C" {
+#include <fcntl.h>
 #include <unistd.h>
 }
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <memory>
@@ -26,6 +31,24 @@ const char* version() {
       "warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE";
 }
 
+// Executes a new WM which takes over from this one, handing the journal over
+// to it (see `restart_args` in main()), or the snapshot if there's no
+// journal. Only returns if exec fails.
+void Reexecute(std::unique_ptr<wmderland::WindowManager> wm, char* const* restart_args) {
+  int fd = wm->journal().Release();
+  if (fd == -1) {
+    wm->snapshot().Save();
+  }
+  wm.reset();
+
+  if (fd != -1) {
+    execv(restart_args[0], restart_args);
+  } else {
+    execl(restart_args[0], restart_args[0], nullptr);
+  }
+  WM_LOG_WITH_ERRNO("exec() failed", errno);
+}
+
 }  // namespace
 
 int main(int argc, char* args[]) {
@@ -34,6 +57,24 @@ int main(int argc, char* args[]) {
     return EXIT_SUCCESS;
   }
 
+  // The journal left by the previous process, which has crashed.
+  // See journal.h. Anything but an open fd is ignored.
+  int journal_fd = -1;
+  if (argc > 2 && !std::strcmp(args[1], "--journal")) {
+    char* end = nullptr;
+    errno = 0;
+    long fd = std::strtol(args[2], &end, 10);
+    if (end != args[2] && !*end && errno != ERANGE && fd >= 0 && fd <= INT_MAX &&
+        fcntl(static_cast<int>(fd), F_GETFD) != -1) {
+      journal_fd = static_cast<int>(fd);
+    }
+  }
+
+  // The command line which hands our journal over to the next process.
+  static char journal_fd_arg[16];
+  static char* restart_args[] = {args[0], const_cast<char*>("--journal"), journal_fd_arg,
+                                 nullptr};
+
   // Install segv handler which writes stacktrace to a log upon segfault.
   // See stacktrace.cc
   wmderland::segv::InstallHandler(&wmderland::segv::Handle);
@@ -55,13 +96,47 @@ int main(int argc, char* args[]) {
   }
 
   try {
-    // Try to perform error recovery from the snapshot if necessary and
-    // possible.
-    if (wm->snapshot().FileExists()) {
-      wm->snapshot().Load();
+    // Take over from the previous process if there's one, or try to
+    // perform error recovery from the snapshot if necessary and possible.
+    // A journal which cannot be restored is dropped, and the snapshot (if
+    // any) is the fallback, but the clients are still running, so they
+    // aren't autostarted again.
+    bool is_restored = false;
+    if (journal_fd != -1) {
+      try {
+        wm->journal().Restore(journal_fd);
+        is_restored = true;
+      } catch (const wmderland::Journal::JournalLoadError& ex) {
+        WM_LOG(ERROR, ex.what());
+      }
+    }
+    if (!is_restored) {
+      if (wm->snapshot().FileExists()) {
+        wm->snapshot().Load();
+      }
+      if (journal_fd == -1) {
+        wm->Autostart();
+      }
     }
+
+    // From now on, the state is kept in the journal, and a crash (even a
+    // segfault) re-executes the WM which then takes over the journal.
+    wm->journal().Open();
+    if (wm->journal().fd() != -1) {
+      std::snprintf(journal_fd_arg, sizeof(journal_fd_arg), "%d", wm->journal().fd());
+      wmderland::segv::SetRestart(restart_args, wm->journal().fd());
+    }
+
     wm->Run();  // enter main event loop
 
+    // The restart action hands the whole state over to the new process in
+    // a freshly compacted journal, so it can skip replaying the log.
+    if (wm->is_restarting()) {
+      wm->journal().Compact();
+      ::Reexecute(std::move(wm), restart_args);
+      return EXIT_FAILURE;
+    }
+
   } catch (const std::bad_alloc& ex) {
     static_cast<void>(fputs("Out of memory\n", stderr));
     return EXIT_FAILURE;
@@ -83,18 +158,15 @@ int main(int argc, char* args[]) {
     return EXIT_FAILURE;
 
   } catch (const std::exception& ex) {
-    // Try to exec itself and recover from errors using the snapshot.
-    // If snapshot fails to load, it will throw an SnapshotLoadError.
-    // See the previous catch block.
+    // Try to exec itself and recover from errors using the journal, which
+    // already has the state as of the last batch of events, so nothing has
+    // to be saved from the current (possibly corrupt) state. Without a
+    // journal, fall back to the snapshot. If either fails to load, it will
+    // throw an SnapshotLoadError. See the previous catch block.
     WM_LOG(ERROR, ex.what());
     wmderland::sys_utils::NotifySend("An error occurred. Recovering...", NOTIFY_SEND_CRITICAL);
-    wm->snapshot().Save();
-    wm.reset();
-
-    if (execl(args[0], args[0], nullptr) == -1) {
-      WM_LOG_WITH_ERRNO("execl() failed", errno);
-      return EXIT_FAILURE;
-    }
+    ::Reexecute(std::move(wm), restart_args);
+    return EXIT_FAILURE;
 
   } catch (...) {
     WM_LOG(ERROR, "Unknown exception caught!");
@@ -0,0 +1,105 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#include "navigation_index.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+using std::make_pair;
+
+namespace wmderland {
+
+NavigationIndex::NavigationIndex() : areas_(), by_x_(), by_y_() {}
+
+void NavigationIndex::Update(Window window, const Client::Area& area) {
+  auto it = areas_.find(window);
+  if (it != areas_.end()) {
+    if (it->second == area) {
+      return;
+    }
+    by_x_.erase(make_pair(CenterX(it->second), window));
+    by_y_.erase(make_pair(CenterY(it->second), window));
+  }
+
+  areas_[window] = area;
+  by_x_.insert(make_pair(CenterX(area), window));
+  by_y_.insert(make_pair(CenterY(area), window));
+}
+
+void NavigationIndex::Remove(Window window) {
+  auto it = areas_.find(window);
+  if (it == areas_.end()) {
+    return;
+  }
+
+  by_x_.erase(make_pair(CenterX(it->second), window));
+  by_y_.erase(make_pair(CenterY(it->second), window));
+  areas_.erase(it);
+}
+
+void NavigationIndex::Clear() {
+  areas_.clear();
+  by_x_.clear();
+  by_y_.clear();
+}
+
+// A candidate is scored by its distance from the given window along the axis
+// of the direction, plus twice the gap between the two windows on the other
+// axis (which is zero if they overlap on that axis), and the lowest score
+// wins. Since the score is never less than the distance along the axis, the
+// search stops as soon as that distance alone reaches the best score.
+Window NavigationIndex::FindNearest(Window window, Direction direction) const {
+  auto it = areas_.find(window);
+  if (it == areas_.end()) {
+    return None;
+  }
+
+  const Client::Area& from = it->second;
+  bool horizontal = direction == Direction::LEFT || direction == Direction::RIGHT;
+  int center = (horizontal) ? CenterX(from) : CenterY(from);
+
+  Window nearest = None;
+  long best_score = LONG_MAX;
+
+  // Returns false when no further candidate can beat the best one.
+  auto consider = [&](const std::pair<int, Window>& candidate) {
+    long distance = std::labs(static_cast<long>(candidate.first) - center);
+    if (distance >= best_score) {
+      return false;
+    }
+
+    const Client::Area& to = areas_.at(candidate.second);
+    long gap = (horizontal) ? std::max(from.y, to.y) - std::min(from.y + from.h, to.y + to.h)
+                            : std::max(from.x, to.x) - std::min(from.x + from.w, to.x + to.w);
+    long score = distance + 4 * std::max(gap, 0L);  // twice the gap, doubled like the centers
+    if (score < best_score) {
+      best_score = score;
+      nearest = candidate.second;
+    }
+    return true;
+  };
+
+  const AxisIndex& index = (horizontal) ? by_x_ : by_y_;
+
+  if (direction == Direction::LEFT || direction == Direction::UP) {
+    for (auto rit = AxisIndex::const_reverse_iterator(index.lower_bound(make_pair(center, 0)));
+         rit != index.rend() && consider(*rit); ++rit) {
+    }
+  } else {
+    for (auto fit = index.upper_bound(make_pair(center, ~0UL));
+         fit != index.end() && consider(*fit); ++fit) {
+    }
+  }
+
+  return nearest;
+}
+
+int NavigationIndex::CenterX(const Client::Area& area) {
+  return 2 * area.x + area.w;
+}
+
+int NavigationIndex::CenterY(const Client::Area& area) {
+  return 2 * area.y + area.h;
+}
+
+}  // namespace wmderland
@@ -0,0 +1,56 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#ifndef WMDERLAND_NAVIGATION_INDEX_H_
+#define WMDERLAND_NAVIGATION_INDEX_H_
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+#include "client.h"
+
+namespace wmderland {
+
+// A spatial index of the on-screen geometry of the clients in a workspace,
+// which answers "which window is the nearest one to the left of / right of /
+// above / below this window?" for directional navigation.
+//
+// The windows are kept sorted by the x and y coordinates of their centers,
+// so a query starts with a binary search and then only looks at the windows
+// which are closer along the axis than the best candidate found so far.
+class NavigationIndex {
+ public:
+  enum class Direction {
+    LEFT,
+    RIGHT,
+    UP,
+    DOWN,
+  };
+
+  NavigationIndex();
+  virtual ~NavigationIndex() = default;
+
+  void Update(Window window, const Client::Area& area);
+  void Remove(Window window);
+  void Clear();
+
+  // Returns None if there's no window in that direction.
+  Window FindNearest(Window window, Direction direction) const;
+
+ private:
+  // The centers are stored doubled (e.g., 2 * x + w), so they are integers.
+  using AxisIndex = std::set<std::pair<int, Window>>;
+
+  static int CenterX(const Client::Area& area);
+  static int CenterY(const Client::Area& area);
+
+  std::unordered_map<Window, Client::Area> areas_;
+  AxisIndex by_x_;
+  AxisIndex by_y_;
+};
+
+}  // namespace wmderland
+
+#endif  // WMDERLAND_NAVIGATION_INDEX_H_
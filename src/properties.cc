@@ -21,6 +21,7 @@ Properties::Properties(Display* dpy) : utf8string(XInternAtom(dpy, "UTF8_STRING"
   net[atom::NET_WM_NAME] = XInternAtom(dpy, "_NET_WM_NAME", false);
   net[atom::NET_WM_STATE] = XInternAtom(dpy, "_NET_WM_STATE", false);
   net[atom::NET_WM_STATE_FULLSCREEN] = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN", false);
+  net[atom::NET_WM_STATE_HIDDEN] = XInternAtom(dpy, "_NET_WM_STATE_HIDDEN", false);
   net[atom::NET_WM_WINDOW_TYPE] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", false);
   net[atom::NET_WM_WINDOW_TYPE_DOCK] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DOCK", false);
   net[atom::NET_WM_WINDOW_TYPE_DIALOG] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", false);
@@ -30,6 +31,7 @@ Properties::Properties(Display* dpy) : utf8string(XInternAtom(dpy, "UTF8_STRING"
   net[atom::NET_WM_WINDOW_TYPE_NOTIFICATION] =
       XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_NOTIFICATION", false);
   net[atom::NET_CLIENT_LIST] = XInternAtom(dpy, "_NET_CLIENT_LIST", false);
+  net[atom::NET_CLIENT_LIST_STACKING] = XInternAtom(dpy, "_NET_CLIENT_LIST_STACKING", false);
 };
 
 }  // namespace wmderland
@@ -32,6 +32,7 @@ enum {
   NET_WM_NAME,
   NET_WM_STATE,
   NET_WM_STATE_FULLSCREEN,
+  NET_WM_STATE_HIDDEN,
   NET_WM_WINDOW_TYPE,
   NET_WM_WINDOW_TYPE_DOCK,
   NET_WM_WINDOW_TYPE_DIALOG,
@@ -39,6 +40,7 @@ enum {
   NET_WM_WINDOW_TYPE_UTILITY,
   NET_WM_WINDOW_TYPE_NOTIFICATION,
   NET_CLIENT_LIST,
+  NET_CLIENT_LIST_STACKING,
   NET_ATOM_SIZE,
 };
 
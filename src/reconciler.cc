@@ -0,0 +1,360 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#include "reconciler.h"
+
+#include <algorithm>
+
+#include "util.h"
+#include "window_registry.h"
+
+namespace wmderland {
+
+Reconciler::Reconciler(Display* dpy)
+    : dpy_(dpy),
+      windows_(),
+      pending_(),
+      stacking_(),
+      sent_stacking_(),
+      client_list_stacking_(),
+      sorted_stacking_(),
+      scratch_(),
+      has_stacking_declaration_(),
+      is_stacking_valid_(),
+      focus_(None),
+      sent_focus_(None),
+      active_window_(None),
+      sent_active_window_(None),
+      has_active_window_declaration_(),
+      is_active_window_known_(),
+      counters_() {}
+
+void Reconciler::Map(Window window) {
+  WindowState& state = Declare(window);
+  state.desired.mapped = true;
+  state.desired.fields |= MAPPED;
+}
+
+void Reconciler::Unmap(Window window) {
+  WindowState& state = Declare(window);
+  state.desired.mapped = false;
+  state.desired.fields |= MAPPED;
+}
+
+void Reconciler::MoveResize(Window window, const Client::Area& geometry) {
+  WindowState& state = Declare(window);
+  state.desired.geometry = geometry;
+  state.desired.fields |= GEOMETRY;
+}
+
+// A parked window is kept mapped, but placed just off the left edge of the
+// screen, so it doesn't have to repaint from scratch when it comes back.
+// `geometry` is where it is (or will be) when it's not parked.
+void Reconciler::Park(Window window, const Client::Area& geometry, bool parked) {
+  WindowState& state = Declare(window);
+  state.desired.geometry = geometry;
+  state.desired.parked = parked;
+  state.desired.fields |= GEOMETRY | PARKED;
+}
+
+void Reconciler::SetBorderWidth(Window window, unsigned int width) {
+  WindowState& state = Declare(window);
+  state.desired.border_width = width;
+  state.desired.fields |= BORDER_WIDTH;
+}
+
+void Reconciler::SetBorderColor(Window window, unsigned long color) {
+  WindowState& state = Declare(window);
+  state.desired.border_color = color;
+  state.desired.fields |= BORDER_COLOR;
+}
+
+void Reconciler::Restack(const Window* windows, size_t count) {
+  stacking_.assign(windows, windows + count);
+  has_stacking_declaration_ = true;
+}
+
+void Reconciler::SetInputFocus(Window window) {
+  focus_ = window;
+}
+
+void Reconciler::SetActiveWindow(Window window) {
+  active_window_ = window;
+  has_active_window_declaration_ = true;
+}
+
+// A newly mapped window is on the top of the stack, and may have taken
+// the input focus. It only breaks the stacking order we've applied if it's
+// one of the windows in it, though. Tooltips, menus and other
+// override-redirect windows come and go on top without affecting it.
+void Reconciler::OnMapNotify(Window window, bool override_redirect) {
+  WindowState& state = windows_[window];
+  state.sent.mapped = true;
+  state.sent.fields |= MAPPED;
+  sent_focus_ = None;
+
+  auto end = sent_stacking_.end();
+  if (!override_redirect && std::find(sent_stacking_.begin(), end, window) != end) {
+    is_stacking_valid_ = false;
+  }
+}
+
+void Reconciler::OnUnmapNotify(Window window) {
+  WindowState& state = windows_[window];
+  state.sent.mapped = false;
+  state.sent.fields |= MAPPED;
+
+  if (window == sent_focus_) {
+    sent_focus_ = None;
+  }
+}
+
+void Reconciler::OnConfigureNotify(Window window, const Client::Area& geometry,
+                                   unsigned int border_width) {
+  WindowState& state = windows_[window];
+  state.sent.geometry = geometry;
+  state.sent.border_width = border_width;
+  state.sent.fields |= GEOMETRY | BORDER_WIDTH;
+}
+
+// The request has been forwarded to the X server as is, so we no longer
+// know the window's geometry, and it might have been restacked.
+void Reconciler::OnConfigureRequest(Window window) {
+  auto it = windows_.find(window);
+  if (it != windows_.end()) {
+    it->second.sent.fields &= ~(GEOMETRY | BORDER_WIDTH);
+  }
+  is_stacking_valid_ = false;
+}
+
+// Whatever has been declared for a destroyed window is dropped.
+void Reconciler::OnDestroyNotify(Window window) {
+  auto it = windows_.find(window);
+  if (it != windows_.end()) {
+    if (it->second.pending) {
+      pending_.erase(std::find(pending_.begin(), pending_.end(), window));
+    }
+    windows_.erase(it);
+  }
+
+  if (window == sent_focus_) {
+    sent_focus_ = None;
+  }
+  is_stacking_valid_ = false;
+}
+
+// The requests are sent in this order: unmaps, configures, maps, restacks
+// and then input focus, so that a window is never shown at its old position,
+// and the focus is never given to a window which isn't viewable (yet).
+void Reconciler::Commit() {
+  for (const auto window : pending_) {
+    CommitUnmap(window, windows_[window]);
+  }
+  for (const auto window : pending_) {
+    CommitConfigure(window, windows_[window]);
+  }
+  for (const auto window : pending_) {
+    CommitMap(window, windows_[window]);
+  }
+
+  CommitStacking();
+  CommitFocus();
+
+  for (const auto window : pending_) {
+    WindowState& state = windows_[window];
+    state.desired.fields = 0;
+    state.pending = false;
+  }
+  pending_.clear();
+}
+
+const Reconciler::Counters& Reconciler::counters() const {
+  return counters_;
+}
+
+Reconciler::WindowState& Reconciler::Declare(Window window) {
+  WindowState& state = windows_[window];
+  if (!state.pending) {
+    state.pending = true;
+    pending_.push_back(window);
+  }
+  return state;
+}
+
+void Reconciler::CommitUnmap(Window window, WindowState& state) {
+  State& desired = state.desired;
+  State& sent = state.sent;
+  if (!(desired.fields & MAPPED) || desired.mapped) {
+    return;
+  }
+
+  if ((sent.fields & MAPPED) && !sent.mapped) {
+    counters_.skipped++;
+  } else {
+    // The UnmapNotify of this request must not be mistaken for the client
+    // withdrawing its window, see WindowManager::OnUnmapNotify().
+    Client* c = WindowRegistry::GetInstance()->GetClient(window);
+    if (c) {
+      c->set_has_unmap_req_from_wm(true);
+    }
+    XUnmapWindow(dpy_, window);
+    counters_.unmaps++;
+    counters_.requests++;
+  }
+  sent.mapped = false;
+  sent.fields |= MAPPED;
+}
+
+void Reconciler::CommitConfigure(Window window, WindowState& state) {
+  State& desired = state.desired;
+  State& sent = state.sent;
+
+  if (desired.fields & PARKED) {
+    state.parked = desired.parked;
+  }
+
+  if (desired.fields & GEOMETRY) {
+    Client::Area geometry = desired.geometry;
+    if (state.parked) {
+      unsigned int border_width = (desired.fields & BORDER_WIDTH) ? desired.border_width
+                                  : (sent.fields & BORDER_WIDTH) ? sent.border_width : 0;
+      geometry.x = -(geometry.w + 2 * static_cast<int>(border_width));
+    }
+
+    if ((sent.fields & GEOMETRY) && sent.geometry == geometry) {
+      counters_.skipped++;
+    } else {
+      XMoveResizeWindow(dpy_, window, geometry.x, geometry.y, geometry.w, geometry.h);
+      counters_.configures++;
+      counters_.requests++;
+    }
+    sent.geometry = geometry;
+    sent.fields |= GEOMETRY;
+  }
+
+  if (desired.fields & BORDER_WIDTH) {
+    if ((sent.fields & BORDER_WIDTH) && sent.border_width == desired.border_width) {
+      counters_.skipped++;
+    } else {
+      XSetWindowBorderWidth(dpy_, window, desired.border_width);
+      counters_.borders++;
+      counters_.requests++;
+    }
+    sent.border_width = desired.border_width;
+    sent.fields |= BORDER_WIDTH;
+  }
+
+  if (desired.fields & BORDER_COLOR) {
+    if ((sent.fields & BORDER_COLOR) && sent.border_color == desired.border_color) {
+      counters_.skipped++;
+    } else {
+      XSetWindowBorder(dpy_, window, desired.border_color);
+      counters_.borders++;
+      counters_.requests++;
+    }
+    sent.border_color = desired.border_color;
+    sent.fields |= BORDER_COLOR;
+  }
+}
+
+void Reconciler::CommitMap(Window window, WindowState& state) {
+  State& desired = state.desired;
+  State& sent = state.sent;
+  if (!(desired.fields & MAPPED) || !desired.mapped) {
+    return;
+  }
+
+  if ((sent.fields & MAPPED) && sent.mapped) {
+    counters_.skipped++;
+  } else {
+    XMapWindow(dpy_, window);
+    counters_.maps++;
+    counters_.requests++;
+  }
+  sent.mapped = true;
+  sent.fields |= MAPPED;
+}
+
+// The stacking order is applied by raising its topmost window, and then
+// restacking the others below it, one configure request per window. So
+// it's skipped if the order is the same as last time, as long as nothing
+// else has been mapped or restacked since. _NET_CLIENT_LIST_STACKING is
+// the same order with only the clients in it, above the clients which
+// aren't in it.
+void Reconciler::CommitStacking() {
+  if (!has_stacking_declaration_) {
+    return;
+  }
+  has_stacking_declaration_ = false;
+
+  if (is_stacking_valid_ && stacking_ == sent_stacking_) {
+    counters_.skipped++;
+  } else {
+    if (!stacking_.empty()) {
+      scratch_.assign(stacking_.rbegin(), stacking_.rend());  // top-to-bottom
+      XRaiseWindow(dpy_, scratch_.front());
+      XRestackWindows(dpy_, scratch_.data(), scratch_.size());
+      counters_.restacks += scratch_.size();
+      counters_.requests += scratch_.size();
+    }
+    sent_stacking_ = stacking_;
+    is_stacking_valid_ = true;
+  }
+
+  // The stacking order only has the clients on the screen, but every client
+  // belongs in _NET_CLIENT_LIST_STACKING, so the others go at the bottom.
+  WindowRegistry* registry = WindowRegistry::GetInstance();
+  sorted_stacking_.assign(stacking_.begin(), stacking_.end());
+  std::sort(sorted_stacking_.begin(), sorted_stacking_.end());
+  scratch_.clear();
+  registry->ForEach(WindowRegistry::CLIENT, [this](const WindowRegistry::Entry& e) {
+    if (!std::binary_search(sorted_stacking_.begin(), sorted_stacking_.end(), e.window)) {
+      scratch_.push_back(e.window);
+    }
+  });
+  for (const auto window : stacking_) {
+    if (registry->HasRole(window, WindowRegistry::CLIENT)) {
+      scratch_.push_back(window);
+    }
+  }
+
+  if (scratch_ != client_list_stacking_) {
+    wm_utils::SetNetClientListStacking(scratch_.data(), scratch_.size());
+    client_list_stacking_.swap(scratch_);
+    counters_.properties++;
+    counters_.requests++;
+  }
+}
+
+void Reconciler::CommitFocus() {
+  if (focus_ != None) {
+    if (focus_ == sent_focus_) {
+      counters_.skipped++;
+    } else {
+      XSetInputFocus(dpy_, focus_, RevertToParent, CurrentTime);
+      sent_focus_ = focus_;
+      counters_.focuses++;
+      counters_.requests++;
+    }
+    focus_ = None;
+  }
+
+  if (has_active_window_declaration_) {
+    if (is_active_window_known_ && active_window_ == sent_active_window_) {
+      counters_.skipped++;
+    } else {
+      if (active_window_ != None) {
+        wm_utils::SetNetActiveWindow(active_window_);
+      } else {
+        wm_utils::ClearNetActiveWindow();
+      }
+      sent_active_window_ = active_window_;
+      is_active_window_known_ = true;
+      counters_.properties++;
+      counters_.requests++;
+    }
+    has_active_window_declaration_ = false;
+  }
+}
+
+Reconciler::WindowState::WindowState() : sent(), desired(), parked(), pending() {}
+
+}  // namespace wmderland
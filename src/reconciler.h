@@ -0,0 +1,130 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#ifndef WMDERLAND_RECONCILER_H_
+#define WMDERLAND_RECONCILER_H_
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+#include <unordered_map>
+#include <vector>
+
+#include "client.h"
+
+namespace wmderland {
+
+// The Reconciler sits between the WM and the X server. The event handlers
+// only declare how the windows ought to be (mapped or not, parked or not,
+// geometry, border, stacking order, input focus), and Reconciler::Commit(), which is called
+// once per batch of events, sends the requests needed to get there from
+// what the X server already has, i.e., what we've sent last time, or what
+// we've learned from the events of that window.
+//
+// A declaration may be overridden by a later one before it is committed,
+// e.g., unmapping all clients and then mapping the fullscreen one sends a
+// single request (or none at all).
+class Reconciler {
+ public:
+  // The number of X requests sent by Commit(), and the number of
+  // declarations which turned out to need no request at all.
+  struct Counters {
+    unsigned long requests;
+    unsigned long configures;
+    unsigned long borders;
+    unsigned long maps;
+    unsigned long unmaps;
+    unsigned long restacks;
+    unsigned long focuses;
+    unsigned long properties;
+    unsigned long skipped;
+  };
+
+  explicit Reconciler(Display* dpy);
+  virtual ~Reconciler() = default;
+
+  // Declarations
+  void Map(Window window);
+  void Unmap(Window window);
+  void MoveResize(Window window, const Client::Area& geometry);
+  void Park(Window window, const Client::Area& geometry, bool parked);
+  void SetBorderWidth(Window window, unsigned int width);
+  void SetBorderColor(Window window, unsigned long color);
+  void Restack(const Window* windows, size_t count);  // bottom-to-top
+  void SetInputFocus(Window window);
+  void SetActiveWindow(Window window);  // _NET_ACTIVE_WINDOW, None to clear it
+
+  // Observations, i.e., what the X server has told us.
+  void OnMapNotify(Window window, bool override_redirect = false);
+  void OnUnmapNotify(Window window);
+  void OnConfigureNotify(Window window, const Client::Area& geometry,
+                         unsigned int border_width);
+  void OnConfigureRequest(Window window);
+  void OnDestroyNotify(Window window);
+
+  void Commit();
+
+  const Counters& counters() const;
+
+ private:
+  enum Field : unsigned {
+    MAPPED = 1 << 0,
+    GEOMETRY = 1 << 1,
+    BORDER_WIDTH = 1 << 2,
+    BORDER_COLOR = 1 << 3,
+    PARKED = 1 << 4,
+  };
+
+  struct State {
+    bool mapped;
+    Client::Area geometry;
+    unsigned int border_width;
+    unsigned long border_color;
+    bool parked;
+    unsigned fields;  // which of the fields above are valid
+  };
+
+  struct WindowState {
+    WindowState();
+
+    State sent;     // what the X server has
+    State desired;  // what has been declared since the last commit
+    bool parked;    // moved off-screen, see Park()
+    bool pending;   // whether it's in pending_
+  };
+
+  WindowState& Declare(Window window);
+  void CommitUnmap(Window window, WindowState& state);
+  void CommitConfigure(Window window, WindowState& state);
+  void CommitMap(Window window, WindowState& state);
+  void CommitStacking();
+  void CommitFocus();
+
+  Display* dpy_;
+
+  std::unordered_map<Window, WindowState> windows_;
+  std::vector<Window> pending_;  // the windows with declarations to commit
+
+  // The stacking order (bottom-to-top) of the windows we care about, as
+  // declared and as last applied. The latter is still on the top of the
+  // stack unless someone else has mapped or restacked a window since.
+  std::vector<Window> stacking_;
+  std::vector<Window> sent_stacking_;
+  std::vector<Window> client_list_stacking_;  // _NET_CLIENT_LIST_STACKING
+  std::vector<Window> sorted_stacking_;       // to look windows up in stacking_
+  std::vector<Window> scratch_;
+  bool has_stacking_declaration_;
+  bool is_stacking_valid_;
+
+  // None means we don't know, or haven't declared.
+  Window focus_;
+  Window sent_focus_;
+  Window active_window_;
+  Window sent_active_window_;
+  bool has_active_window_declaration_;
+  bool is_active_window_known_;
+
+  Counters counters_;
+};
+
+}  // namespace wmderland
+
+#endif  // WMDERLAND_RECONCILER_H_
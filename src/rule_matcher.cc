@@ -0,0 +1,140 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#include "rule_matcher.h"
+
+#include "config.h"
+
+using std::string;
+
+namespace wmderland {
+
+WindowRules::WindowRules()
+    : spawn_workspace_id(UNSPECIFIED_WORKSPACE),
+      should_float(),
+      should_fullscreen(),
+      should_prohibit() {}
+
+RuleMatcher::RuleMatcher() : ids_(), entries_() {}
+
+void RuleMatcher::Clear() {
+  ids_.clear();
+  entries_.clear();
+}
+
+// If the same identifier is given the same type of rule more than once,
+// the last one wins.
+void RuleMatcher::Add(const string& window_identifier, RuleType type, int value) {
+  string::size_type first_comma = window_identifier.find(',');
+  uint32_t res_class = Intern(window_identifier.substr(0, first_comma));
+  if (!res_class) {
+    return;
+  }
+
+  if (first_comma == string::npos) {
+    Set(MakeKey(SINGLE, res_class, 0, 0), type, value);
+    return;
+  }
+
+  // The rest of the identifier may be a res_name or a net_wm_name, and since
+  // a net_wm_name may contain commas, it may also be a res_name followed by
+  // a net_wm_name at any of the remaining commas.
+  string rest = window_identifier.substr(first_comma + 1);
+  uint32_t id = Intern(rest);
+  if (id) {
+    Set(MakeKey(PAIR, res_class, id, 0), type, value);
+  }
+
+  for (string::size_type i = rest.find(','); i != string::npos; i = rest.find(',', i + 1)) {
+    uint32_t res_name = Intern(rest.substr(0, i));
+    uint32_t net_wm_name = Intern(rest.substr(i + 1));
+    if (res_name && net_wm_name) {
+      Set(MakeKey(TRIPLE, res_class, res_name, net_wm_name), type, value);
+    }
+  }
+}
+
+// For each type of rule, the most specific identifier wins, i.e.,
+// res_class,res_name,net_wm_name > res_class,res_name > res_class,net_wm_name
+// > res_class.
+WindowRules RuleMatcher::Match(const string& res_class, const string& res_name,
+                               const string& net_wm_name) const {
+  WindowRules rules;
+
+  // If this res_class isn't mentioned by any rule, nothing will match.
+  uint32_t class_id = Lookup(res_class);
+  if (!class_id) {
+    return rules;
+  }
+
+  uint32_t name_id = Lookup(res_name);
+  uint32_t title_id = Lookup(net_wm_name);
+  uint64_t keys[] = {
+      MakeKey(TRIPLE, class_id, name_id, title_id),
+      MakeKey(PAIR, class_id, name_id, 0),
+      MakeKey(PAIR, class_id, title_id, 0),
+      MakeKey(SINGLE, class_id, 0, 0),
+  };
+
+  Entry merged = Entry();
+  for (const auto key : keys) {
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+      continue;
+    }
+
+    for (int i = 0; i < 4; i++) {
+      if ((it->second.defined & (1 << i)) && !(merged.defined & (1 << i))) {
+        merged.defined |= 1 << i;
+        merged.values[i] = it->second.values[i];
+      }
+    }
+  }
+
+  auto get = [&merged](RuleType type, int default_value) {
+    int i = static_cast<int>(type);
+    return (merged.defined & (1 << i)) ? merged.values[i] : default_value;
+  };
+
+  rules.spawn_workspace_id = get(RuleType::SPAWN, UNSPECIFIED_WORKSPACE);
+  rules.should_float = get(RuleType::FLOAT, false);
+  rules.should_fullscreen = get(RuleType::FULLSCREEN, false);
+  rules.should_prohibit = get(RuleType::PROHIBIT, false);
+  return rules;
+}
+
+uint64_t RuleMatcher::MakeKey(Form form, uint32_t id1, uint32_t id2, uint32_t id3) {
+  return (static_cast<uint64_t>(form) << (kIdBits_ * 3)) |
+      (static_cast<uint64_t>(id1) << (kIdBits_ * 2)) |
+      (static_cast<uint64_t>(id2) << kIdBits_) | id3;
+}
+
+// Returns the id of the given string, assigning a new id if needed,
+// or 0 if we've run out of ids.
+uint32_t RuleMatcher::Intern(const string& s) {
+  auto it = ids_.find(s);
+  if (it != ids_.end()) {
+    return it->second;
+  }
+
+  if (ids_.size() >= kMaxId_) {
+    WM_LOG(ERROR, "config: too many distinct window identifiers, ignoring: " << s);
+    return 0;
+  }
+
+  uint32_t id = ids_.size() + 1;
+  ids_[s] = id;
+  return id;
+}
+
+uint32_t RuleMatcher::Lookup(const string& s) const {
+  auto it = ids_.find(s);
+  return (it != ids_.end()) ? it->second : 0;
+}
+
+void RuleMatcher::Set(uint64_t key, RuleType type, int value) {
+  int i = static_cast<int>(type);
+  Entry& entry = entries_[key];
+  entry.defined |= 1 << i;
+  entry.values[i] = value;
+}
+
+}  // namespace wmderland
@@ -0,0 +1,75 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#ifndef WMDERLAND_RULE_MATCHER_H_
+#define WMDERLAND_RULE_MATCHER_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace wmderland {
+
+// The combined verdict of all the window rules (assign, floating, fullscreen
+// and prohibit) which match a window.
+struct WindowRules {
+  WindowRules();
+
+  int spawn_workspace_id;  // UNSPECIFIED_WORKSPACE if there's no such rule
+  bool should_float;
+  bool should_fullscreen;
+  bool should_prohibit;
+};
+
+// RuleMatcher compiles the window rules of every kind into a single hash
+// table, so that all the rules which match a window can be found with at
+// most four lookups, no matter how many rules there are.
+//
+// A window identifier in the config is one of the following forms:
+//   res_class,res_name,net_wm_name
+//   res_class,res_name   (or res_class,net_wm_name)
+//   res_class
+// Every string is interned as a 20-bit id, and each identifier is packed
+// into a 64-bit key along with its form.
+class RuleMatcher {
+ public:
+  enum class RuleType {
+    SPAWN,
+    FLOAT,
+    FULLSCREEN,
+    PROHIBIT,
+  };
+
+  RuleMatcher();
+  virtual ~RuleMatcher() = default;
+
+  void Clear();
+  void Add(const std::string& window_identifier, RuleType type, int value);
+  WindowRules Match(const std::string& res_class, const std::string& res_name,
+                    const std::string& net_wm_name) const;
+
+ private:
+  enum Form : uint64_t {
+    TRIPLE = 1,
+    PAIR = 2,
+    SINGLE = 3,
+  };
+
+  struct Entry {
+    unsigned int defined;  // bit i is set if values[i] is defined
+    int values[4];         // indexed by RuleType
+  };
+
+  static uint64_t MakeKey(Form form, uint32_t id1, uint32_t id2, uint32_t id3);
+  uint32_t Intern(const std::string& s);
+  uint32_t Lookup(const std::string& s) const;
+  void Set(uint64_t key, RuleType type, int value);
+
+  static const int kIdBits_ = 20;
+  static const uint32_t kMaxId_ = (1 << kIdBits_) - 1;
+
+  std::unordered_map<std::string, uint32_t> ids_;  // 0 is never used as an id
+  std::unordered_map<uint64_t, Entry> entries_;
+};
+
+}  // namespace wmderland
+
+#endif  // WMDERLAND_RULE_MATCHER_H_
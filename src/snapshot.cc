@@ -2,27 +2,75 @@
 #include "snapshot.h"
 
 extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 }
-#include <fstream>
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <vector>
 
 #include "client.h"
 #include "util.h"
 #include "window_manager.h"
+#include "window_registry.h"
 
-using std::array;
-using std::endl;
-using std::ifstream;
-using std::ofstream;
 using std::string;
+using std::vector;
 
 namespace wmderland {
 
-const string Snapshot::kNone_ = "none";
-const string Snapshot::kBacktrack_ = "b";
-const char Snapshot::kLeafPrefix_ = 'w';
-const char Snapshot::kInternalPrefix_ = 'i';
-const char Snapshot::kDelimiter_ = ' ';
+namespace {
+
+// A read-only mapping of a whole file, unmapped when it goes out of scope.
+class MappedFile {
+ public:
+  explicit MappedFile(const string& filename) : data_(), size_() {
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        data_ = static_cast<const char*>(data);
+        size_ = st.st_size;
+      }
+    }
+    close(fd);
+  }
+
+  ~MappedFile() {
+    if (data_) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  const char* data_;
+  size_t size_;
+};
+
+}  // namespace
+
+const char Snapshot::kMagic_[8] = {'W', 'M', 'D', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t Snapshot::kVersion_ = 1;
 
 Snapshot::Snapshot(const string& filename)
     : filename_(sys_utils::ToAbsPath(filename)), failed_count_() {}
@@ -32,138 +80,353 @@ bool Snapshot::FileExists() const {
 }
 
 void Snapshot::Load() {
-  WindowManager* wm = WindowManager::GetInstance();
-  ifstream fin(filename_);
+  MappedFile file(filename_);
+  if (!file.data()) {
+    throw SnapshotLoadError();
+  }
 
-  // 1. Load failed count.
   // If the same error occurs constantly, throw this exception
   // to immediately halt the window manager.
-  fin >> failed_count_;
+  Contents contents;
+  if (Parse(file.data(), file.size(), &contents)) {
+    failed_count_ = contents.header->failed_count;
+  }
   if (failed_count_ >= 3) {
     throw SnapshotLoadError();
   }
 
-  // 2. Client deserailization.
-  int client_count = 0;
-  fin >> client_count;
+  Restore(file.data(), file.size());
 
-  for (int i = 0; i < client_count; i++) {
-    Window window = None;
-    int workspace_id = 0;
-    bool is_mapped = false;
-    bool is_floating = false;
-    bool is_fullscreen = false;
-    bool has_unmap_req_from_wm = false;
+  // Rename snapshot file so that we know we have successfully load it.
+  // If the file cannot be renamed and cannot be remove, then throw
+  // SnapshotLoadError and the WM will return EXIT_FAILURE.
+  if (rename(filename_.c_str(), (filename_ + ".old").c_str()) == -1 &&
+      remove(filename_.c_str())) {  // remove() returns non-zero on failure
+    throw SnapshotLoadError();
+  }
+}
 
-    fin >> window >> workspace_id >> is_mapped >> is_floating >> is_fullscreen >>
-        has_unmap_req_from_wm;
+// The snapshot is written to a temporary file which then replaces the old
+// one, so the file is either the complete old snapshot or the complete new
+// one, even if we die halfway through.
+void Snapshot::Save() {
+  string data = Serialize(++failed_count_);
+  string tmp_filename = filename_ + ".tmp";
 
-    // The ownership of these client objects will be claimed during
-    // client tree deserialization!!! See Tree::Deserialize() in tree.cc
-    Client* client = new Client(wm->dpy_, window, wm->workspaces_[workspace_id].get());
-    client->set_mapped(is_mapped);
-    client->set_floating(is_floating);
-    client->set_fullscreen(is_fullscreen);
-    client->set_has_unmap_req_from_wm(has_unmap_req_from_wm);
+  int fd = open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    WM_LOG_WITH_ERRNO("Failed to create snapshot", errno);
+    return;
+  }
+
+  bool ok = WriteAll(fd, data.data(), data.size()) && fsync(fd) == 0;
+  ok = (close(fd) == 0) && ok;
+
+  if (!ok || rename(tmp_filename.c_str(), filename_.c_str()) == -1) {
+    WM_LOG_WITH_ERRNO("Failed to write snapshot", errno);
+    unlink(tmp_filename.c_str());
   }
+}
+
+string Snapshot::Serialize(uint32_t failed_count) const {
+  WindowManager* wm = WindowManager::GetInstance();
+
+  // 1. Clients serialization.
+  vector<ClientRecord> clients;
+  clients.reserve(wm->registry_->count(WindowRegistry::CLIENT));
+
+  wm->registry_->ForEach(WindowRegistry::CLIENT, [&clients](const WindowRegistry::Entry& e) {
+    clients.push_back(MakeClientRecord(e.client));
+  });
+
+  // 2. Client Tree serialization.
+  vector<WorkspaceRecord> workspaces;
+  vector<Tree::Record> nodes;
+  workspaces.reserve(wm->workspaces_.size());
+  nodes.reserve(clients.size() * 2 + wm->workspaces_.size());
 
-  // 3. Client Tree deserialization will call Client::mapper_[window],
-  // so we have to restore all clients before doing this. See step 1.
   for (const auto& workspace : wm->workspaces_) {
-    string data;
-    fin >> data;
-    workspace->Deserialize(data);
+    size_t node_count = nodes.size();
+    workspace.second->Serialize(nodes);
+    node_count = nodes.size() - node_count;
+    workspaces.push_back(MakeWorkspaceRecord(workspace.second.get(), node_count));
   }
 
-  // 4. Current workspace deserialization.
-  int current_workspace = 0;
-  fin >> current_workspace;
-  wm->GotoWorkspace(current_workspace);
+  // 3. Docks/notifications serialization.
+  vector<uint64_t> windows;
+  for (const auto role : {WindowRegistry::DOCK, WindowRegistry::NOTIFICATION}) {
+    wm->registry_->ForEach(role, [&windows](const WindowRegistry::Entry& e) {
+      windows.push_back(e.window);
+    });
+  }
 
-  // 5. Docks/Notifications deserialization.
-  string line;
+  Header header = {};
+  header.failed_count = failed_count;
+  header.client_count = clients.size();
+  header.workspace_count = workspaces.size();
+  header.node_count = nodes.size();
+  header.dock_count = wm->registry_->count(WindowRegistry::DOCK);
+  header.notification_count = windows.size() - header.dock_count;
+  header.current_workspace = wm->current_;
+  return Encode(header, clients.data(), workspaces.data(), nodes.data(), windows.data());
+}
+
+void Snapshot::Restore(const char* data, size_t size) const {
+  WindowManager* wm = WindowManager::GetInstance();
+
+  // 1. Make sure the snapshot is complete and has been written by this
+  // version, before anything is restored from it.
+  Contents contents;
+  if (!Parse(data, size, &contents)) {
+    throw SnapshotLoadError();
+  }
+  const Header* header = contents.header;
+
+  // 2. Client deserailization. All the windows are queried at once,
+  // see wm_utils::Prefetch().
+  vector<Window> windows;
+  windows.reserve(header->client_count + header->dock_count);
+  for (uint32_t i = 0; i < header->client_count; i++) {
+    windows.push_back(static_cast<Window>(contents.clients[i].window));
+  }
+  windows.insert(windows.end(), contents.docks, contents.docks + header->dock_count);
+  wm_utils::Prefetch(windows);
+
+  for (uint32_t i = 0; i < header->client_count; i++) {
+    const ClientRecord& record = contents.clients[i];
+    Window window = static_cast<Window>(record.window);
 
-  std::getline(fin, line);
-  if (line != Snapshot::kNone_) {
-    for (const auto& token : string_utils::Split(line, ',')) {
-      wm->docks_.insert(static_cast<Window>(std::stoul(token)));
+    // The ownership of these client objects will be claimed during
+    // client tree deserialization!!! See Tree::Deserialize() in tree.cc
+    Client* client = new Client(wm->dpy_, window, wm->GetWorkspace(record.workspace_id));
+    client->set_mapped(record.flags & MAPPED);
+    client->set_floating(record.flags & FLOATING);
+    client->set_fullscreen(record.flags & FULLSCREEN);
+    client->set_parked(record.flags & PARKED);
+    client->set_has_unmap_req_from_wm(record.flags & HAS_UNMAP_REQ_FROM_WM);
+
+    // The windows are still where the previous process has left them, so
+    // the reconciler only has to send what differs (if anything).
+    XWindowAttributes attr = wm_utils::GetXWindowAttributes(window);
+    if (attr.map_state == IsUnmapped) {
+      wm->reconciler_.OnUnmapNotify(window);
+    } else {
+      wm->reconciler_.OnMapNotify(window);
     }
+    wm->reconciler_.OnConfigureNotify(window, {attr.x, attr.y, attr.width, attr.height},
+                                      attr.border_width);
   }
 
-  std::getline(fin, line);
-  if (line != Snapshot::kNone_) {
-    for (const auto& token : string_utils::Split(line, ',')) {
-      wm->notifications_.insert(static_cast<Window>(std::stoul(token)));
+  // 3. Client Tree deserialization will look up the registered clients,
+  // so we have to restore all clients before doing this. See step 2.
+  const Tree::Record* nodes = contents.nodes;
+  for (uint32_t i = 0; i < header->workspace_count; i++) {
+    const WorkspaceRecord& record = contents.workspaces[i];
+
+    Workspace* workspace = wm->GetWorkspace(record.id);
+    workspace->set_name(string(record.name, strnlen(record.name, kNameSize_)));
+    if (record.layout >= 0 && record.layout < static_cast<int>(Layout::Type::UNDEFINED)) {
+      workspace->set_layout(static_cast<Layout::Type>(record.layout));
     }
+
+    if (!workspace->Deserialize(nodes, record.node_count,
+                                static_cast<Window>(record.current_window))) {
+      throw SnapshotLoadError();
+    }
+    nodes += record.node_count;
   }
 
-  // 5. Rename snapshot file so that we know we have successfully load it.
-  // If the file cannot be renamed and cannot be remove, then throw
-  // SnapshotLoadError and the WM will return EXIT_FAILURE.
-  if (rename(filename_.c_str(), (filename_ + ".old").c_str()) == -1 &&
-      remove(filename_.c_str())) {  // remove() returns non-zero on failure
-    throw SnapshotLoadError();
+  // A client which no tree has claimed would stay registered without being
+  // in any tree, so it's left unmanaged instead.
+  for (uint32_t i = 0; i < header->client_count; i++) {
+    const WindowRegistry::Entry* entry =
+        wm->registry_->Find(static_cast<Window>(contents.clients[i].window));
+    if (entry && entry->client && entry->node == Tree::kNull_) {
+      delete entry->client;
+    }
   }
 
+  // 4. Current workspace deserialization.
+  wm->GotoWorkspace(header->current_workspace);
+
+  // 5. Docks/Notifications deserialization.
+  for (uint32_t i = 0; i < header->dock_count; i++) {
+    Window window = static_cast<Window>(contents.docks[i]);
+    XWindowAttributes attr = wm_utils::GetXWindowAttributes(window);
+    wm->registry_->AddRole(window, WindowRegistry::DOCK).area = {attr.x, attr.y, attr.width,
+                                                                 attr.height};
+  }
+
+  for (uint32_t i = 0; i < header->notification_count; i++) {
+    wm->registry_->AddRole(static_cast<Window>(contents.notifications[i]),
+                           WindowRegistry::NOTIFICATION);
+  }
+
+  wm_utils::ReleasePrefetched();
   wm->ArrangeWindows();
 }
 
-void Snapshot::Save() {
-  WindowManager* wm = WindowManager::GetInstance();
-  ofstream fout(filename_);
+const string& Snapshot::filename() const {
+  return filename_;
+}
+
+Snapshot::ClientRecord Snapshot::MakeClientRecord(const Client* client) {
+  uint32_t flags = (client->is_mapped() ? MAPPED : 0) |
+                   (client->is_floating() ? FLOATING : 0) |
+                   (client->is_fullscreen() ? FULLSCREEN : 0) |
+                   (client->is_parked() ? PARKED : 0) |
+                   (client->has_unmap_req_from_wm() ? HAS_UNMAP_REQ_FROM_WM : 0);
+  return {client->window(), client->workspace()->id(), flags};
+}
+
+Snapshot::WorkspaceRecord Snapshot::MakeWorkspaceRecord(const Workspace* workspace,
+                                                        uint32_t node_count) {
+  Client* focused_client = workspace->GetFocusedClient();
+  WorkspaceRecord record = {};
+  record.current_window = (focused_client) ? focused_client->window() : None;
+  record.id = workspace->id();
+  record.layout = static_cast<int32_t>(workspace->layout());
+  record.node_count = node_count;
+  strncpy(record.name, workspace->name(), kNameSize_);
+  return record;
+}
 
-  // 1. Write failed count.
-  fout << ++failed_count_ << endl;
+string Snapshot::Encode(Header header, const ClientRecord* clients,
+                        const WorkspaceRecord* workspaces, const Tree::Record* nodes,
+                        const uint64_t* windows) {
+  memcpy(header.magic, kMagic_, sizeof(kMagic_));
+  header.version = kVersion_;
+  header.payload_size = PayloadSize(header);
+  header.crc = 0;
+  header.reserved = 0;
 
-  // 2. Client::mapper_ serialization.
-  fout << Client::mapper_.size() << endl;
+  string data;
+  data.reserve(sizeof(header) + header.payload_size);
+  data.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  data.append(reinterpret_cast<const char*>(clients), header.client_count * sizeof(*clients));
+  data.append(reinterpret_cast<const char*>(workspaces),
+              header.workspace_count * sizeof(*workspaces));
+  data.append(reinterpret_cast<const char*>(nodes), header.node_count * sizeof(*nodes));
+  data.append(reinterpret_cast<const char*>(windows),
+              (header.dock_count + header.notification_count) * sizeof(*windows));
 
-  for (const auto& win_client_pair : Client::mapper_) {
-    Window window = win_client_pair.first;
-    Client* client = win_client_pair.second;
+  // The CRC covers everything but itself.
+  uint32_t crc = Crc32(0, data.data(), offsetof(Header, crc));
+  crc = Crc32(crc, data.data() + sizeof(header), header.payload_size);
+  memcpy(&data[offsetof(Header, crc)], &crc, sizeof(crc));
+  return data;
+}
 
-    fout << window << Snapshot::kDelimiter_ << client->workspace()->id()
-         << Snapshot::kDelimiter_ << client->is_mapped() << Snapshot::kDelimiter_
-         << client->is_floating() << Snapshot::kDelimiter_ << client->is_fullscreen()
-         << Snapshot::kDelimiter_ << client->has_unmap_req_from_wm() << endl;
+// Checks everything which can be checked without touching the WM: the
+// size and checksum of the snapshot, that every id in the records is one
+// we can restore, and that no window is restored as two clients.
+bool Snapshot::Parse(const char* data, size_t size, Contents* contents) {
+  if (size < sizeof(Header)) {
+    return false;
   }
 
-  // 3. Client Tree serialization.
-  for (const auto& workspace : wm->workspaces_) {
-    fout << workspace->Serialize() << endl;
+  const Header* header = reinterpret_cast<const Header*>(data);
+  if (memcmp(header->magic, kMagic_, sizeof(kMagic_)) || header->version != kVersion_ ||
+      header->payload_size != PayloadSize(*header) ||
+      size != sizeof(Header) + header->payload_size) {
+    return false;
   }
 
-  // 4. Curernt Workspace serialization.
-  fout << wm->current_ << endl;
+  uint32_t crc = Crc32(0, header, offsetof(Header, crc));
+  if (Crc32(crc, header + 1, header->payload_size) != header->crc) {
+    return false;
+  }
 
-  // 5. Docks/notifications serialization.
-  if (wm->docks_.empty()) {
-    fout << Snapshot::kNone_;
-  } else {
-    size_t i = 0;
-    for (const auto window : wm->docks_) {
-      fout << window;
-      fout << ((i < wm->docks_.size() - 1) ? "," : "");
-      i++;
+  if (header->current_workspace < 0 || header->current_workspace >= MAX_WORKSPACE_COUNT) {
+    return false;
+  }
+
+  contents->header = header;
+  contents->clients = reinterpret_cast<const ClientRecord*>(header + 1);
+  contents->workspaces =
+      reinterpret_cast<const WorkspaceRecord*>(contents->clients + header->client_count);
+  contents->nodes =
+      reinterpret_cast<const Tree::Record*>(contents->workspaces + header->workspace_count);
+  contents->docks = reinterpret_cast<const uint64_t*>(contents->nodes + header->node_count);
+  contents->notifications = contents->docks + header->dock_count;
+
+  for (uint32_t i = 0; i < header->client_count; i++) {
+    const ClientRecord& record = contents->clients[i];
+    if (record.window == None || record.workspace_id < 0 ||
+        record.workspace_id >= MAX_WORKSPACE_COUNT) {
+      return false;
     }
   }
-  fout << endl;
 
-  if (wm->notifications_.empty()) {
-    fout << Snapshot::kNone_;
-  } else {
-    size_t i = 0;
-    for (const auto window : wm->notifications_) {
-      fout << window;
-      fout << ((i < wm->notifications_.size() - 1) ? "," : "");
-      i++;
+  // A window can only be one client.
+  vector<uint64_t> windows(header->client_count);
+  for (uint32_t i = 0; i < header->client_count; i++) {
+    windows[i] = contents->clients[i].window;
+  }
+  std::sort(windows.begin(), windows.end());
+  if (std::adjacent_find(windows.begin(), windows.end()) != windows.end()) {
+    return false;
+  }
+
+  vector<bool> has_workspace(MAX_WORKSPACE_COUNT);
+  uint64_t node_count = 0;
+  for (uint32_t i = 0; i < header->workspace_count; i++) {
+    int id = contents->workspaces[i].id;
+    if (id < 0 || id >= MAX_WORKSPACE_COUNT || has_workspace[id]) {
+      return false;
     }
+    has_workspace[id] = true;
+    node_count += contents->workspaces[i].node_count;
   }
-  fout << endl;
+  return node_count == header->node_count;
 }
 
-const string& Snapshot::filename() const {
-  return filename_;
+uint64_t Snapshot::PayloadSize(const Header& header) {
+  return header.client_count * static_cast<uint64_t>(sizeof(ClientRecord)) +
+         header.workspace_count * static_cast<uint64_t>(sizeof(WorkspaceRecord)) +
+         header.node_count * static_cast<uint64_t>(sizeof(Tree::Record)) +
+         (header.dock_count + static_cast<uint64_t>(header.notification_count)) *
+             sizeof(uint64_t);
+}
+
+// CRC-32 (IEEE 802.3), the same one used by zlib and gzip.
+uint32_t Snapshot::Crc32(uint32_t crc, const void* data, size_t size) {
+  static uint32_t table[256];
+  static bool is_table_ready = false;
+
+  if (!is_table_ready) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      }
+      table[i] = c;
+    }
+    is_table_ready = true;
+  }
+
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+bool Snapshot::WriteAll(int fd, const void* data, size_t size) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
 }
 
 }  // namespace wmderland
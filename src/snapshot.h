@@ -5,7 +5,7 @@
 extern "C" {
 #include <X11/Xlib.h>
 }
-#include <array>
+#include <cstdint>
 #include <exception>
 #include <string>
 
@@ -14,6 +14,11 @@ extern "C" {
 
 namespace wmderland {
 
+// A snapshot is the state of the WM written by the process which is about
+// to die, so that the process which takes over can adopt the same windows
+// in the same layout. It's a binary file which is only ever read by the same
+// build on the same machine: a header, followed by fixed-size records which
+// are used in place after mmap(2), see Load().
 class Snapshot {
  public:
   class SnapshotLoadError : public std::exception {
@@ -31,18 +36,88 @@ class Snapshot {
   void Load();
   void Save();
 
-  const std::string& filename() const;
+  // The whole state of the WM, in the same format as the file.
+  std::string Serialize(uint32_t failed_count) const;
+  // Restores the WM from Serialize()'s output, throws SnapshotLoadError if
+  // it's invalid.
+  void Restore(const char* data, size_t size) const;
 
-  static const std::string kNone_;
-  static const std::string kBacktrack_;
-  static const char kLeafPrefix_;
-  static const char kInternalPrefix_;
+  const std::string& filename() const;
 
  private:
-  static const char kDelimiter_;
+  static const char kMagic_[8];
+  static const uint32_t kVersion_;
+  static const size_t kNameSize_ = 40;
+
+  // The payload which follows the header is, in this order:
+  // client_count ClientRecords, workspace_count WorkspaceRecords,
+  // node_count Tree::Records (the trees of all workspaces, one after
+  // another), and then dock_count + notification_count windows.
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t failed_count;
+    uint32_t client_count;
+    uint32_t workspace_count;
+    uint32_t node_count;
+    uint32_t dock_count;
+    uint32_t notification_count;
+    int32_t current_workspace;
+    uint64_t payload_size;
+    uint32_t crc;  // CRC-32 of the header up to this field and the payload
+    uint32_t reserved;
+  };
+
+  enum ClientFlag : uint32_t {
+    MAPPED = 1 << 0,
+    FLOATING = 1 << 1,
+    FULLSCREEN = 1 << 2,
+    PARKED = 1 << 3,
+    HAS_UNMAP_REQ_FROM_WM = 1 << 4,
+  };
+
+  struct ClientRecord {
+    uint64_t window;
+    int32_t workspace_id;
+    uint32_t flags;  // ClientFlag
+  };
+
+  struct WorkspaceRecord {
+    uint64_t current_window;
+    int32_t id;
+    int32_t layout;
+    uint32_t node_count;
+    uint32_t reserved;
+    char name[kNameSize_];  // truncated, and not null-terminated if it fills the field
+  };
+
+  // The records of a snapshot, pointing into the snapshot itself.
+  struct Contents {
+    const Header* header;
+    const ClientRecord* clients;
+    const WorkspaceRecord* workspaces;
+    const Tree::Record* nodes;
+    const uint64_t* docks;
+    const uint64_t* notifications;
+  };
+
+  static ClientRecord MakeClientRecord(const Client* client);
+  static WorkspaceRecord MakeWorkspaceRecord(const Workspace* workspace, uint32_t node_count);
+
+  // `header` only needs the counts, the failed count and the current
+  // workspace, and `windows` are the docks followed by the notifications.
+  static std::string Encode(Header header, const ClientRecord* clients,
+                            const WorkspaceRecord* workspaces, const Tree::Record* nodes,
+                            const uint64_t* windows);
+  static bool Parse(const char* data, size_t size, Contents* contents);
+  static uint64_t PayloadSize(const Header& header);
+  static uint32_t Crc32(uint32_t crc, const void* data, size_t size);
+  static bool WriteAll(int fd, const void* data, size_t size);
 
   const std::string filename_;
-  int failed_count_;
+  uint32_t failed_count_;
+
+  friend class Journal;
 };
 
 }  // namespace wmderland
@@ -8,8 +8,26 @@ namespace wmderland {
 
 namespace segv {
 
+namespace {
+
+char* const* restart_args = nullptr;
+int restart_fd = -1;
+
+}  // namespace
+
 void InstallHandler(void (*Handler)(int)) {
   signal(SIGSEGV, Handler);
+
+  // If we've been re-executed by Handle(), SIGSEGV is still blocked.
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGSEGV);
+  sigprocmask(SIG_UNBLOCK, &mask, nullptr);
+}
+
+void SetRestart(char* const* args, int inherited_fd) {
+  restart_args = args;
+  restart_fd = inherited_fd;
 }
 
 void Handle(int) {
@@ -20,6 +38,11 @@ void Handle(int) {
   backtrace_symbols_fd(array + 2, size - 2, fd);
   close(fd);
 
+  // Only async-signal-safe calls from here on.
+  if (restart_args) {
+    fcntl(restart_fd, F_SETFD, 0);
+    execv(restart_args[0], restart_args);
+  }
   exit(EXIT_FAILURE);
 }
 
@@ -7,7 +7,7 @@ extern "C" {
 #include <fcntl.h>     // open
 #include <signal.h>    // signal
 #include <stdlib.h>    // exit
-#include <unistd.h>    // close
+#include <unistd.h>    // close, execv
 }
 
 namespace wmderland {
@@ -15,6 +15,9 @@ namespace wmderland {
 namespace segv {
 
 void InstallHandler(void (*Handler)(int));
+// Instead of exiting, Handle() will re-execute `args` (args[0] is the path),
+// leaving `inherited_fd` open for the new process.
+void SetRestart(char* const* args, int inherited_fd);
 void Handle(int);
 
 }  // namespace segv
@@ -0,0 +1,254 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#include "stats.h"
+
+extern "C" {
+#include <stdio.h>
+}
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "config.h"
+#include "util.h"
+
+using std::endl;
+using std::ofstream;
+using std::ostream;
+using std::string;
+using std::stringstream;
+using std::chrono::nanoseconds;
+
+namespace {
+
+// Percentiles included in the report and in the textfile.
+const double kQuantiles[] = {0.5, 0.9, 0.99};
+const char* kQuantileNames[] = {"p50", "p90", "p99"};
+
+double ToSeconds(uint64_t ns) {
+  return ns / 1e9;
+}
+
+double ToMilliseconds(uint64_t ns) {
+  return ns / 1e6;
+}
+
+}  // namespace
+
+namespace wmderland {
+
+Histogram::Histogram() : buckets_(), count_(), sum_(), max_() {}
+
+void Histogram::Record(uint64_t ns) {
+  int bucket = (ns) ? 64 - __builtin_clzll(ns) : 0;
+  buckets_[(bucket < kBucketCount_) ? bucket : kBucketCount_ - 1]++;
+  count_++;
+  sum_ += ns;
+  max_ = (ns > max_) ? ns : max_;
+}
+
+// Returns the upper bound of the bucket containing the p-th percentile,
+// which is at most twice the exact value (and never more than max()).
+uint64_t Histogram::Percentile(double p) const {
+  if (!count_) {
+    return 0;
+  }
+
+  uint64_t rank = static_cast<uint64_t>(p * count_ + 0.5);
+  rank = (rank < 1) ? 1 : rank;
+  uint64_t seen = 0;
+
+  for (int i = 0; i < kBucketCount_; i++) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      uint64_t upper_bound = (i) ? (uint64_t{1} << i) - 1 : 0;
+      return (upper_bound < max_) ? upper_bound : max_;
+    }
+  }
+  return max_;
+}
+
+uint64_t Histogram::count() const {
+  return count_;
+}
+
+uint64_t Histogram::sum() const {
+  return sum_;
+}
+
+uint64_t Histogram::max() const {
+  return max_;
+}
+
+Stats::Stats(const string& report_filename, const string& textfile_filename)
+    : event_latencies_(),
+      action_latencies_(),
+      latencies_(),
+      counters_(),
+      report_filename_(sys_utils::ToAbsPath(report_filename)),
+      textfile_filename_(sys_utils::ToAbsPath(textfile_filename)) {}
+
+void Stats::RecordEvent(int event_type, Clock::duration elapsed) {
+  if (event_type >= 0 && event_type < LASTEvent) {
+    uint64_t ns = std::chrono::duration_cast<nanoseconds>(elapsed).count();
+    event_latencies_[event_type].Record(ns);
+  }
+}
+
+void Stats::RecordAction(Action::Type action_type, Clock::duration elapsed) {
+  size_t i = static_cast<size_t>(action_type);
+  if (i < action_latencies_.size()) {
+    uint64_t ns = std::chrono::duration_cast<nanoseconds>(elapsed).count();
+    action_latencies_[i].Record(ns);
+  }
+}
+
+// Records the latency of something other than an event or an action,
+// e.g., a workspace switch from start to finish.
+void Stats::RecordLatency(const string& name, Clock::duration elapsed) {
+  uint64_t ns = std::chrono::duration_cast<nanoseconds>(elapsed).count();
+  latencies_[name].Record(ns);
+}
+
+// Registers a counter owned by another component. The counter will be
+// read each time the stats are dumped, so it must outlive this object.
+void Stats::RegisterCounter(const string& name, const unsigned long* value) {
+  counters_.push_back({name, value});
+}
+
+void Stats::WriteReport(ostream& os) const {
+  auto write_row = [&os](const char* name, const Histogram& h) {
+    os << std::left << std::setw(24) << name << std::right << std::setw(10) << h.count();
+    for (const auto q : kQuantiles) {
+      os << std::setw(12) << ToMilliseconds(h.Percentile(q));
+    }
+    os << std::setw(12) << ToMilliseconds(h.max()) << endl;
+  };
+
+  os << std::fixed << std::setprecision(3);
+  os << std::left << std::setw(24) << "handler (ms)" << std::right << std::setw(10) << "count";
+  for (const auto name : kQuantileNames) {
+    os << std::setw(12) << name;
+  }
+  os << std::setw(12) << "max" << endl;
+
+  for (int i = 0; i < LASTEvent; i++) {
+    if (event_latencies_[i].count()) {
+      write_row(EventTypeToStr(i), event_latencies_[i]);
+    }
+  }
+  for (size_t i = 0; i < action_latencies_.size(); i++) {
+    if (action_latencies_[i].count()) {
+      write_row(Action::TypeToStr(static_cast<Action::Type>(i)), action_latencies_[i]);
+    }
+  }
+  for (const auto& latency : latencies_) {
+    write_row(latency.first.c_str(), latency.second);
+  }
+
+  for (const auto& counter : counters_) {
+    os << std::left << std::setw(24) << counter.first << std::right << std::setw(10)
+       << *counter.second << endl;
+  }
+}
+
+void Stats::WriteTextfile(ostream& os) const {
+  auto write_summary = [&os](const char* metric, const char* help, const char* label,
+                             const char* label_value, const Histogram& h) {
+    if (help) {
+      os << "# HELP " << metric << ' ' << help << endl;
+      os << "# TYPE " << metric << " summary" << endl;
+    }
+    for (const auto q : kQuantiles) {
+      os << metric << '{' << label << "=\"" << label_value << "\",quantile=\"" << q << "\"} "
+         << ToSeconds(h.Percentile(q)) << endl;
+    }
+    os << metric << "_sum{" << label << "=\"" << label_value << "\"} " << ToSeconds(h.sum())
+       << endl;
+    os << metric << "_count{" << label << "=\"" << label_value << "\"} " << h.count() << endl;
+  };
+
+  os.unsetf(std::ios::floatfield);
+  os << std::setprecision(9);
+
+  const char* help = "Time spent handling X events.";
+  for (int i = 0; i < LASTEvent; i++) {
+    if (event_latencies_[i].count()) {
+      write_summary("wmderland_event_latency_seconds", help, "event", EventTypeToStr(i),
+                    event_latencies_[i]);
+      help = nullptr;
+    }
+  }
+
+  help = "Time spent handling actions.";
+  for (size_t i = 0; i < action_latencies_.size(); i++) {
+    if (action_latencies_[i].count()) {
+      write_summary("wmderland_action_latency_seconds", help, "action",
+                    Action::TypeToStr(static_cast<Action::Type>(i)), action_latencies_[i]);
+      help = nullptr;
+    }
+  }
+
+  help = "Time spent on other things, e.g., workspace switches.";
+  for (const auto& latency : latencies_) {
+    write_summary("wmderland_latency_seconds", help, "name", latency.first.c_str(),
+                  latency.second);
+    help = nullptr;
+  }
+
+  for (const auto& counter : counters_) {
+    os << "# TYPE wmderland_" << counter.first << "_total counter" << endl;
+    os << "wmderland_" << counter.first << "_total " << *counter.second << endl;
+  }
+}
+
+// Writes a human-readable report (which is also logged) and the textfile.
+bool Stats::Dump() const {
+  stringstream ss;
+  WriteReport(ss);
+  WM_LOG(INFO, "stats:" << endl << ss.str());
+  return SaveAtomically(report_filename_, ss.str()) && SaveTextfile();
+}
+
+bool Stats::SaveTextfile() const {
+  stringstream ss;
+  WriteTextfile(ss);
+  return SaveAtomically(textfile_filename_, ss.str());
+}
+
+const char* Stats::EventTypeToStr(int event_type) {
+  static const char* names[LASTEvent] = {
+      "Error",         "Reply",          "KeyPress",        "KeyRelease",
+      "ButtonPress",   "ButtonRelease",  "MotionNotify",    "EnterNotify",
+      "LeaveNotify",   "FocusIn",        "FocusOut",        "KeymapNotify",
+      "Expose",        "GraphicsExpose", "NoExpose",        "VisibilityNotify",
+      "CreateNotify",  "DestroyNotify",  "UnmapNotify",     "MapNotify",
+      "MapRequest",    "ReparentNotify", "ConfigureNotify", "ConfigureRequest",
+      "GravityNotify", "ResizeRequest",  "CirculateNotify", "CirculateRequest",
+      "PropertyNotify", "SelectionClear", "SelectionRequest", "SelectionNotify",
+      "ColormapNotify", "ClientMessage", "MappingNotify",   "GenericEvent",
+  };
+  return names[event_type];
+}
+
+// Readers (e.g., node_exporter) must never see a partially written file,
+// so write it to a temporary file first and then rename it.
+bool Stats::SaveAtomically(const string& filename, const string& content) {
+  string tmp_filename = filename + ".tmp";
+  {
+    ofstream fout(tmp_filename);
+    fout << content;
+    if (!fout) {
+      WM_LOG(ERROR, "Failed to write " << tmp_filename);
+      return false;
+    }
+  }
+
+  if (rename(tmp_filename.c_str(), filename.c_str()) == -1) {
+    WM_LOG_WITH_ERRNO("Failed to rename stats file", errno);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace wmderland
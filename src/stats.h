@@ -0,0 +1,84 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#ifndef WMDERLAND_STATS_H_
+#define WMDERLAND_STATS_H_
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "action.h"
+
+namespace wmderland {
+
+// A latency histogram with logarithmic (power of two) buckets. Recording a
+// sample is a handful of integer operations, so it can be done on every
+// event without measurable overhead.
+class Histogram {
+ public:
+  Histogram();
+  virtual ~Histogram() = default;
+
+  void Record(uint64_t ns);
+  uint64_t Percentile(double p) const;
+
+  uint64_t count() const;
+  uint64_t sum() const;
+  uint64_t max() const;
+
+ private:
+  static const int kBucketCount_ = 64;
+
+  // buckets_[i] counts the samples whose bit length is i,
+  // i.e., the samples in [2^(i-1), 2^i).
+  std::array<uint64_t, kBucketCount_> buckets_;
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t max_;
+};
+
+// Stats keeps the latency histograms of every XEvent type and every
+// Action::Type handled by the WM, plus any latencies recorded by name and
+// any counters registered by other components. They can be dumped as a
+// human-readable report, or as a node_exporter textfile (Prometheus text
+// format).
+class Stats {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  Stats(const std::string& report_filename, const std::string& textfile_filename);
+  virtual ~Stats() = default;
+
+  void RecordEvent(int event_type, Clock::duration elapsed);
+  void RecordAction(Action::Type action_type, Clock::duration elapsed);
+  void RecordLatency(const std::string& name, Clock::duration elapsed);
+  void RegisterCounter(const std::string& name, const unsigned long* value);
+
+  void WriteReport(std::ostream& os) const;
+  void WriteTextfile(std::ostream& os) const;
+  bool Dump() const;
+  bool SaveTextfile() const;
+
+ private:
+  static const char* EventTypeToStr(int event_type);
+  static bool SaveAtomically(const std::string& filename, const std::string& content);
+
+  std::array<Histogram, LASTEvent> event_latencies_;
+  std::array<Histogram, static_cast<int>(Action::Type::UNDEFINED) + 1> action_latencies_;
+  std::map<std::string, Histogram> latencies_;  // anything else worth measuring
+  std::vector<std::pair<std::string, const unsigned long*>> counters_;
+
+  const std::string report_filename_;
+  const std::string textfile_filename_;
+};
+
+}  // namespace wmderland
+
+#endif  // WMDERLAND_STATS_H_
@@ -2,305 +2,893 @@
 #include "tree.h"
 
 #include <algorithm>
-#include <queue>
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <limits>
 #include <stack>
+#include <utility>
 
+#include "arena.h"
 #include "client.h"
-#include "snapshot.h"
-#include "util.h"
+#include "window_registry.h"
 
-using std::queue;
 using std::stack;
 using std::string;
 using std::unique_ptr;
-using std::unordered_map;
-using std::vector;
 
 namespace wmderland {
 
-unordered_map<Client*, Tree::Node*> Tree::Node::mapper_;
+const Tree::NodeId Tree::kNull_ = UINT32_MAX;
+const char Tree::kNone_[] = "none";
+const char Tree::kBacktrack_ = 'b';
+const char Tree::kLeafPrefix_ = 'w';
+const char Tree::kInternalPrefix_ = 'i';
 
-Tree::Tree() : root_node_(std::make_unique<Tree::Node>(nullptr)), current_node_() {
+Tree::Tree() : nodes_(), free_list_(kNull_), root_node_(), current_node_(kNull_) {
   // NOTE: In Wmderland, the root node will always exist in a client tree
   // at any given time.
 
-  // Initialize a Tree::Node with no client associated with it,
+  // Initialize a node with no client associated with it,
   // and set its tiling direction to HORIZONTAL by default.
-  root_node_->set_tiling_direction(TilingDirection::HORIZONTAL);
+  root_node_ = CreateNode(nullptr);
+  set_tiling_direction(root_node_, TilingDirection::HORIZONTAL);
 }
 
-Tree::Node* Tree::GetTreeNode(Client* client) const {
-  auto it = Tree::Node::mapper_.find(client);
-  if (it == Tree::Node::mapper_.end()) {
-    return nullptr;
+Tree::NodeId Tree::CreateNode(unique_ptr<Client> client) {
+  NodeId node = free_list_;
+  if (node != kNull_) {
+    free_list_ = nodes_[node].next_sibling;
+    nodes_[node] = Tree::Node();
+  } else {
+    node = nodes_.size();
+    nodes_.emplace_back();
   }
-  return it->second;
+
+  set_client(node, std::move(client));
+  return node;
 }
 
-vector<Tree::Node*> Tree::GetLeaves() const {
-  return root_node_->GetLeaves();
+void Tree::AddChild(NodeId parent, NodeId child) {
+  SpliceLeaves(parent, child, nodes_[parent].last_child);
+
+  Node& p = nodes_[parent];
+  Node& c = nodes_[child];
+  c.parent = parent;
+  c.prev_sibling = p.last_child;
+  c.next_sibling = kNull_;
+
+  if (p.last_child != kNull_) {
+    nodes_[p.last_child].next_sibling = child;
+  } else {
+    p.first_child = child;
+  }
+  p.last_child = child;
+  p.child_count++;
+  AddClientCounts(parent, c.tiling_count, c.floating_count);
+  MarkDirty(parent);
 }
 
-Tree::Node* Tree::root_node() const {
-  return root_node_.get();
+void Tree::RemoveChild(NodeId parent, NodeId child) {
+  if (nodes_[child].parent != parent) {
+    return;
+  }
+  Unlink(child);
+  FreeSubtree(child);
 }
 
-Tree::Node* Tree::current_node() const {
-  return current_node_;
+void Tree::InsertChildAfter(NodeId parent, NodeId child, NodeId ref) {
+  if (ref == kNull_ || ref == nodes_[parent].last_child) {
+    AddChild(parent, child);
+    return;
+  }
+
+  SpliceLeaves(parent, child, ref);
+
+  Node& c = nodes_[child];
+  NodeId next = nodes_[ref].next_sibling;
+  c.parent = parent;
+  c.prev_sibling = ref;
+  c.next_sibling = next;
+  nodes_[ref].next_sibling = child;
+  nodes_[next].prev_sibling = child;
+  nodes_[parent].child_count++;
+  AddClientCounts(parent, c.tiling_count, c.floating_count);
+  MarkDirty(parent);
 }
 
-void Tree::set_current_node(Tree::Node* node) {
-  current_node_ = node;
+Tree::NodeId Tree::GetLeftSibling(NodeId node) const {
+  return nodes_[node].prev_sibling;
 }
 
-void Tree::Deserialize(string data) {
-  // Extract current window id at the beginning (before '|'),
-  // and then erase it including the '|' character.
-  size_t delim_pos = data.find('|');
-  string current_window = data.substr(0, delim_pos);
-  data.erase(0, delim_pos + 1);
+Tree::NodeId Tree::GetRightSibling(NodeId node) const {
+  return nodes_[node].next_sibling;
+}
 
-  // Split nodes into a queue.
-  // A token can be a leaf or an internal node.
-  queue<string> val_queue;
-  for (const auto& token : string_utils::Split(data, ',')) {
-    val_queue.push(token);
+Tree::NodeId Tree::GetFirstLeaf(NodeId node) const {
+  while (nodes_[node].first_child != kNull_) {
+    node = nodes_[node].first_child;
   }
+  return node;
+}
 
-  // Construct root_node_.
-  string root_val = val_queue.front();
-  val_queue.pop();
-  root_val.erase(0, 1);
-  root_node_->set_tiling_direction(static_cast<TilingDirection>(std::stoi(root_val)));
+Tree::NodeId Tree::GetLastLeaf(NodeId node) const {
+  while (nodes_[node].last_child != kNull_) {
+    node = nodes_[node].last_child;
+  }
+  return node;
+}
 
-  // Push the root node onto the stack and perform iterative DFS.
-  stack<Tree::Node*> st;
-  st.push(root_node_.get());
-  current_node_ = st.top();
+bool Tree::HasTilingClientsInSubtree(NodeId node) const {
+  return nodes_[node].tiling_count > 0;
+}
 
-  while (!val_queue.empty()) {
-    string val = val_queue.front();
-    val_queue.pop();
+// The node of each client is kept in the WindowRegistry. Since it's the
+// node in the client's own tree, make sure that it is in this tree.
+Tree::NodeId Tree::GetTreeNode(Client* client) const {
+  const WindowRegistry::Entry* entry = WindowRegistry::GetInstance()->Find(client->window());
+  if (!entry || entry->node >= nodes_.size() || nodes_[entry->node].client.get() != client) {
+    return kNull_;
+  }
+  return entry->node;
+}
 
-    // Backtrack
-    if (val == Snapshot::kBacktrack_) {
-      st.pop();
-      current_node_ = st.top();
-      continue;
-    }
+size_t Tree::tiling_count(NodeId node) const {
+  return nodes_[node].tiling_count;
+}
 
-    // Deserialize
-    unique_ptr<Tree::Node> new_node = std::make_unique<Tree::Node>(nullptr);
-    if (val.front() == Snapshot::kLeafPrefix_) {
-      val.erase(0, 1);
-      unique_ptr<Client> client(Client::mapper_[static_cast<Window>(std::stoul(val))]);
-      new_node->set_client(std::move(client));
-    } else {  // val.front() == Snapshot::kInternalPrefix_
-      val.erase(0, 1);
-      new_node->set_tiling_direction(static_cast<TilingDirection>(std::stoi(val)));
-    }
+size_t Tree::floating_count(NodeId node) const {
+  return nodes_[node].floating_count;
+}
+
+size_t Tree::client_count(NodeId node) const {
+  return nodes_[node].tiling_count + nodes_[node].floating_count;
+}
 
-    current_node_->AddChild(std::move(new_node));
-    current_node_->children().back();
-    st.push(new_node.get());
+// Recounts a leaf from its client (if any), and propagates the difference
+// to its ancestors. The counts of an internal node are the sums of its
+// children's, which are maintained by AddChild(), RemoveChild(), etc.
+void Tree::UpdateClientCounts(NodeId node) {
+  const Node& n = nodes_[node];
+  if (n.first_child != kNull_) {
+    return;
   }
 
-  // Restore current_node_.
-  if (current_window == Snapshot::kNone_) {
-    current_node_ = nullptr;
-  } else {
-    Window window = static_cast<Window>(std::stoul(current_window));
-    Client* client = Client::mapper_.at(window);
-    current_node_ = Tree::Node::mapper_.at(client);
+  int tiling = (n.client && !n.client->is_floating()) ? 1 : 0;
+  int floating = (n.client && n.client->is_floating()) ? 1 : 0;
+  int tiling_delta = tiling - static_cast<int>(n.tiling_count);
+  int floating_delta = floating - static_cast<int>(n.floating_count);
+  if (tiling_delta || floating_delta) {
+    AddClientCounts(node, tiling_delta, floating_delta);
+    MarkDirty(node);
   }
 }
 
-string Tree::Serialize() const {
-  string data;
+Tree::Children Tree::children(NodeId node) const {
+  return Children(this, node);
+}
 
-  // The current_node_ is serialized and stored at the beginning of data.
-  if (current_node_) {
-    data += std::to_string(current_node_->client()->window());
-  } else {
-    data += Snapshot::kNone_;
+Tree::Leaves Tree::leaves(NodeId node) const {
+  return Leaves(this, GetFirstLeaf(node), nodes_[GetLastLeaf(node)].next_leaf);
+}
+
+Tree::Leaves Tree::leaves() const {
+  return leaves(root_node_);
+}
+
+Tree::NodeId Tree::prev_leaf(NodeId node) const {
+  return nodes_[node].prev_leaf;
+}
+
+Tree::NodeId Tree::next_leaf(NodeId node) const {
+  return nodes_[node].next_leaf;
+}
+
+Tree::NodeId Tree::first_child(NodeId node) const {
+  return nodes_[node].first_child;
+}
+
+Tree::NodeId Tree::last_child(NodeId node) const {
+  return nodes_[node].last_child;
+}
+
+size_t Tree::child_count(NodeId node) const {
+  return nodes_[node].child_count;
+}
+
+Tree::NodeId Tree::parent(NodeId node) const {
+  return nodes_[node].parent;
+}
+
+// Get the client associated with this node.
+Client* Tree::client(NodeId node) const {
+  return nodes_[node].client.get();
+}
+
+TilingDirection Tree::tiling_direction(NodeId node) const {
+  return nodes_[node].tiling_direction;
+}
+
+bool Tree::leaf(NodeId node) const {
+  return nodes_[node].first_child == kNull_;
+}
+
+void Tree::set_client(NodeId node, unique_ptr<Client> client) {
+  Node& n = nodes_[node];
+  if (n.client) {
+    SetRegisteredNode(n.client.get(), kNull_);
   }
-  data += '|';
+  if (client) {
+    SetRegisteredNode(client.get(), node);
+  }
+  n.client = std::move(client);
+  UpdateClientCounts(node);
+  MarkDirty(node);
+}
 
-  // Serialize the entire tree.
-  if (root_node_->leaf()) {
-    return data + Snapshot::kInternalPrefix_ +
-        std::to_string(static_cast<int>(root_node_->tiling_direction()));
-  } else {
-    DfsSerializeHelper(root_node_.get(), data);
-    // There will be extra ',' + "b,"
-    return data.erase(data.rfind("," + Snapshot::kBacktrack_ + ","));
+Client* Tree::release_client(NodeId node) {
+  Client* client = nodes_[node].client.release();
+  if (client) {
+    SetRegisteredNode(client, kNull_);
+    UpdateClientCounts(node);
   }
+  return client;
+}
+
+void Tree::set_tiling_direction(NodeId node, TilingDirection tiling_direction) {
+  nodes_[node].tiling_direction = tiling_direction;
+  MarkDirty(node);
 }
 
-void Tree::DfsSerializeHelper(Tree::Node* node, string& data) const {
-  if (!node) {
+// Marks this node and all its ancestors as dirty, so that this subtree
+// will be visited during the next tiling. The ancestors of a dirty node
+// are already dirty, so we can stop there.
+void Tree::MarkDirty(NodeId node) {
+  for (NodeId n = node; n != kNull_ && !nodes_[n].dirty; n = nodes_[n].parent) {
+    nodes_[n].dirty = true;
+  }
+}
+
+// Makes the next tiling visit every node, e.g., once the layout has changed.
+void Tree::MarkAllDirty() {
+  for (auto& n : nodes_) {
+    n.dirty = true;
+  }
+}
+
+void Tree::MarkClean(NodeId node, const Client::Area& tile_area) {
+  nodes_[node].dirty = false;
+  nodes_[node].tile_area = tile_area;
+}
+
+// Cleans the dirty nodes of a subtree which the tiling hasn't visited
+// (e.g., those without tiling clients), keeping their tile_area. Only
+// dirty nodes are descended into, since a clean node has no dirty
+// descendants.
+void Tree::MarkSubtreeClean(NodeId node) {
+  if (!nodes_[node].dirty) {
     return;
   }
 
-  // Serialize current node, format:
-  // 1. If node is a leaf: w<Window>
-  // 2. If node is internal: i<TilingDirection>
-  //
-  // Exception: when there are no windows at all, the root node will become a
-  // leaf, but we don't want this to happen! (It will segfault)
-  //
-  // Solution: when the root node is a leaf, we don't have to serialize
-  // anything.
-  if (node->leaf()) {
-    data += Snapshot::kLeafPrefix_ + std::to_string(node->client()->window());
+  nodes_[node].dirty = false;
+  for (NodeId child = nodes_[node].first_child; child != kNull_;
+       child = nodes_[child].next_sibling) {
+    MarkSubtreeClean(child);
+  }
+}
+
+bool Tree::dirty(NodeId node) const {
+  return nodes_[node].dirty;
+}
+
+const Client::Area& Tree::tile_area(NodeId node) const {
+  return nodes_[node].tile_area;
+}
+
+Tree::NodeId Tree::root_node() const {
+  return root_node_;
+}
+
+Tree::NodeId Tree::current_node() const {
+  return current_node_;
+}
+
+void Tree::set_current_node(NodeId node) {
+  current_node_ = node;
+}
+
+// Detaches a node from its parent and siblings. The leaves of its subtree
+// are cut out of the leaf list (but remain linked with each other), and if
+// the parent has no children left, the parent rejoins the list as a leaf.
+void Tree::Unlink(NodeId node) {
+  Node& n = nodes_[node];
+  if (n.parent == kNull_) {
+    return;
+  }
+
+  NodeId first_leaf = GetFirstLeaf(node);
+  NodeId last_leaf = GetLastLeaf(node);
+  NodeId prev_leaf = nodes_[first_leaf].prev_leaf;
+  NodeId next_leaf = nodes_[last_leaf].next_leaf;
+  nodes_[first_leaf].prev_leaf = kNull_;
+  nodes_[last_leaf].next_leaf = kNull_;
+
+  MarkDirty(n.parent);
+  AddClientCounts(n.parent, -static_cast<int>(n.tiling_count),
+                  -static_cast<int>(n.floating_count));
+  Node& p = nodes_[n.parent];
+
+  if (n.prev_sibling != kNull_) {
+    nodes_[n.prev_sibling].next_sibling = n.next_sibling;
+  } else {
+    p.first_child = n.next_sibling;
+  }
+  if (n.next_sibling != kNull_) {
+    nodes_[n.next_sibling].prev_sibling = n.prev_sibling;
   } else {
-    data += Snapshot::kInternalPrefix_ +
-        std::to_string(static_cast<int>(node->tiling_direction()));
+    p.last_child = n.prev_sibling;
   }
-  data += ',';
+  p.child_count--;
 
-  for (const auto child : node->children()) {
-    DfsSerializeHelper(child, data);
+  if (p.first_child == kNull_) {
+    LinkLeaves(prev_leaf, n.parent);
+    LinkLeaves(n.parent, next_leaf);
+  } else {
+    LinkLeaves(prev_leaf, next_leaf);
   }
 
-  // Add 'b' which indicates when to backtrack
-  // during deserialization.
-  data += Snapshot::kBacktrack_ + ',';
+  n.parent = kNull_;
+  n.prev_sibling = kNull_;
+  n.next_sibling = kNull_;
 }
 
-Tree::Node::Node(unique_ptr<Client> client)
-    : client_(std::move(client)), tiling_direction_(TilingDirection::UNSPECIFIED) {
-  if (client_) {
-    Tree::Node::mapper_[client_.get()] = this;
+void Tree::SetRegisteredNode(Client* client, NodeId node) {
+  WindowRegistry::Entry* entry = WindowRegistry::GetInstance()->Find(client->window());
+  if (entry) {
+    entry->node = node;
   }
 }
 
-Tree::Node::~Node() {
-  Tree::Node::mapper_.erase(client_.get());
+// Adds the given differences to the client counts of a node and all its
+// ancestors.
+void Tree::AddClientCounts(NodeId node, int tiling_delta, int floating_delta) {
+  for (NodeId n = node; n != kNull_; n = nodes_[n].parent) {
+    nodes_[n].tiling_count += tiling_delta;
+    nodes_[n].floating_count += floating_delta;
+  }
 }
 
-void Tree::Node::AddChild(unique_ptr<Tree::Node> child) {
-  child->set_parent(this);
-  children_.push_back(std::move(child));
+void Tree::LinkLeaves(NodeId left, NodeId right) {
+  if (left != kNull_) {
+    nodes_[left].next_leaf = right;
+  }
+  if (right != kNull_) {
+    nodes_[right].prev_leaf = left;
+  }
 }
 
-void Tree::Node::RemoveChild(Tree::Node* child) {
-  child->set_parent(nullptr);
-  children_.erase(
-      std::remove_if(children_.begin(), children_.end(),
-                     [&](unique_ptr<Tree::Node>& node) { return node.get() == child; }),
-      children_.end());
+// Splices the leaves of a detached subtree (rooted at `child`) into the leaf
+// list right after the leaves of `ref`, which is about to become its left
+// sibling. If `ref` is kNull_, then `parent` has been a leaf so far, and is
+// replaced in the list by the leaves of `child`.
+void Tree::SpliceLeaves(NodeId parent, NodeId child, NodeId ref) {
+  NodeId prev_leaf;
+  NodeId next_leaf;
+
+  if (ref == kNull_) {
+    prev_leaf = nodes_[parent].prev_leaf;
+    next_leaf = nodes_[parent].next_leaf;
+    nodes_[parent].prev_leaf = kNull_;
+    nodes_[parent].next_leaf = kNull_;
+  } else {
+    prev_leaf = GetLastLeaf(ref);
+    next_leaf = nodes_[prev_leaf].next_leaf;
+  }
+
+  LinkLeaves(prev_leaf, GetFirstLeaf(child));
+  LinkLeaves(GetLastLeaf(child), next_leaf);
 }
 
-void Tree::Node::InsertChildAfter(unique_ptr<Tree::Node> child, Tree::Node* ref) {
-  child->set_parent(this);
-  ptrdiff_t ref_idx =
-      std::find_if(children_.begin(), children_.end(),
-                   [&](unique_ptr<Tree::Node>& node) { return node.get() == ref; }) -
-      children_.begin();
-  children_.insert(children_.begin() + ref_idx + 1, std::move(child));
+// Destroys the clients of a detached subtree, and returns all of its nodes
+// to the free list. The nodes are freed in post-order by following their own
+// links, so this never allocates, and a leaf (the usual case) is freed right
+// away.
+void Tree::FreeSubtree(NodeId node) {
+  NodeId n = node;
+  while (nodes_[n].first_child != kNull_) {
+    n = nodes_[n].first_child;
+  }
+
+  while (true) {
+    // Read the links before the node is reset. Once the last child of a
+    // node is freed, all of its children are, so the parent is next.
+    NodeId parent = nodes_[n].parent;
+    NodeId next = nodes_[n].next_sibling;
+    bool is_done = (n == node);
+
+    nodes_[n] = Tree::Node();
+    nodes_[n].next_sibling = free_list_;
+    free_list_ = n;
+
+    if (is_done) {
+      return;
+    } else if (next == kNull_) {
+      n = parent;
+      continue;
+    }
+
+    n = next;
+    while (nodes_[n].first_child != kNull_) {
+      n = nodes_[n].first_child;
+    }
+  }
 }
 
-Tree::Node* Tree::Node::GetLeftSibling() const {
-  vector<Tree::Node*> siblings = parent_->children();
+namespace {
+
+// Writes the text form of a tree into a caller-provided buffer, counting
+// (but not writing) whatever doesn't fit.
+class TextWriter {
+ public:
+  TextWriter(char* buf, size_t size) : buf_(buf), size_(size), length_() {}
+
+  void Put(char c) {
+    if (length_ < size_) {
+      buf_[length_] = c;
+    }
+    length_++;
+  }
+
+  void Put(const char* s) {
+    while (*s) {
+      Put(*s++);
+    }
+  }
+
+  void PutNumber(unsigned long value) {
+    char digits[std::numeric_limits<unsigned long>::digits10 + 1];
+    size_t count = 0;
+    do {
+      digits[count++] = '0' + value % 10;
+      value /= 10;
+    } while (value);
+
+    while (count) {
+      Put(digits[--count]);
+    }
+  }
+
+  size_t length() const {
+    return length_;
+  }
+
+ private:
+  char* buf_;
+  size_t size_;
+  size_t length_;
+};
+
+// Reads the text form of a tree, and reports what's wrong with it (and
+// where) via `error`.
+class TextReader {
+ public:
+  TextReader(const char* data, size_t size, Tree::TextError* error)
+      : data_(data), size_(size), position_(), error_(error) {}
+
+  bool Accept(char c) {
+    if (position_ == size_ || data_[position_] != c) {
+      return false;
+    }
+    position_++;
+    return true;
+  }
+
+  bool Accept(const char* s) {
+    size_t length = std::strlen(s);
+    if (size_ - position_ < length || std::memcmp(data_ + position_, s, length)) {
+      return false;
+    }
+    position_ += length;
+    return true;
+  }
+
+  bool Expect(char c, const char* reason) {
+    return Accept(c) || Fail(position_, reason);
+  }
+
+  // Reads a decimal number which is no greater than `max`.
+  bool ReadNumber(unsigned long max, unsigned long* value, const char* reason) {
+    size_t start = position_;
+    unsigned long result = 0;
+
+    for (; position_ < size_ && std::isdigit(static_cast<unsigned char>(data_[position_]));
+         position_++) {
+      unsigned long digit = data_[position_] - '0';
+      if (digit > max || result > (max - digit) / 10) {
+        return Fail(start, reason);
+      }
+      result = result * 10 + digit;
+    }
+
+    if (position_ == start) {
+      return Fail(start, reason);
+    }
+    *value = result;
+    return true;
+  }
 
-  if (this == siblings.front()) {
-    return nullptr;
+  bool Fail(size_t position, const char* reason) {
+    if (error_) {
+      *error_ = {position, reason};
+    }
+    return false;
+  }
+
+  bool at_end() const {
+    return position_ == size_;
+  }
+
+  size_t position() const {
+    return position_;
+  }
+
+ private:
+  const char* data_;
+  size_t size_;
+  size_t position_;
+  Tree::TextError* error_;
+};
+
+const unsigned long kMaxTilingDirection =
+    static_cast<unsigned long>(TilingDirection::VERTICAL);
+
+}  // namespace
+
+size_t Tree::Serialize(char* buf, size_t size) const {
+  TextWriter writer(buf, size);
+
+  // The current_node_ is serialized and stored at the beginning of data.
+  if (current_node_ != kNull_) {
+    writer.PutNumber(client(current_node_)->window());
   } else {
-    ptrdiff_t this_node_idx =
-        std::find(siblings.begin(), siblings.end(), this) - siblings.begin();
-    return siblings[this_node_idx - 1];
+    writer.Put(kNone_);
+  }
+  writer.Put('|');
+
+  // The root node is always written as an internal node, even if it has
+  // no children at all.
+  writer.Put(kInternalPrefix_);
+  writer.PutNumber(static_cast<unsigned long>(tiling_direction(root_node_)));
+
+  // Walk the tree without a stack: go down to the first child if there's
+  // one, otherwise go back up until there's a next sibling.
+  NodeId node = nodes_[root_node_].first_child;
+  while (node != kNull_) {
+    const Node& n = nodes_[node];
+    writer.Put(',');
+    if (n.first_child == kNull_ && n.client) {
+      writer.Put(kLeafPrefix_);
+      writer.PutNumber(n.client->window());
+    } else {
+      writer.Put(kInternalPrefix_);
+      writer.PutNumber(static_cast<unsigned long>(n.tiling_direction));
+    }
+
+    if (n.first_child != kNull_) {
+      node = n.first_child;
+      continue;
+    }
+
+    writer.Put(',');
+    writer.Put(kBacktrack_);
+    while (nodes_[node].next_sibling == kNull_ && nodes_[node].parent != root_node_) {
+      node = nodes_[node].parent;
+      writer.Put(',');
+      writer.Put(kBacktrack_);
+    }
+    node = nodes_[node].next_sibling;
   }
+
+  return writer.length();
 }
 
-Tree::Node* Tree::Node::GetRightSibling() const {
-  vector<Tree::Node*> siblings = parent_->children();
+// Rebuilds a freshly constructed tree from the text form, claiming the
+// registered clients. Returns false without touching the tree if the text
+// is invalid, and tells what's wrong with it via `error`.
+bool Tree::Deserialize(const char* data, size_t size, TextError* error) {
+  return ParseText(data, size, /*build=*/false, error) &&
+         ParseText(data, size, /*build=*/true, nullptr);
+}
 
-  if (this == siblings.back()) {
-    return nullptr;
-  } else {
-    ptrdiff_t this_node_idx =
-        std::find(siblings.begin(), siblings.end(), this) - siblings.begin();
-    return siblings[this_node_idx + 1];
+string Tree::Serialize() const {
+  string data(Serialize(nullptr, 0), '\0');
+  Serialize(&data[0], data.size());
+  return data;
+}
+
+bool Tree::Deserialize(const string& data, TextError* error) {
+  return Deserialize(data.data(), data.size(), error);
+}
+
+// Parses the text form, and also builds the tree if `build` is true. The
+// first pass (without building) checks everything, including that no window
+// appears twice, so the second one cannot fail.
+bool Tree::ParseText(const char* data, size_t size, bool build, TextError* error) {
+  WindowRegistry* registry = WindowRegistry::GetInstance();
+  TextReader reader(data, size, error);
+
+  // Current window
+  unsigned long current_window = None;
+  bool has_current_window = !reader.Accept(kNone_);
+  if ((has_current_window &&
+       !reader.ReadNumber(ULONG_MAX, &current_window, "expected a window or none")) ||
+      !reader.Expect('|', "expected '|'")) {
+    return false;
+  }
+
+  // Root node
+  unsigned long direction = 0;
+  if (!reader.Expect(kInternalPrefix_, "expected the root node") ||
+      !reader.ReadNumber(kMaxTilingDirection, &direction, "invalid tiling direction")) {
+    return false;
+  }
+  if (build) {
+    set_tiling_direction(root_node_, static_cast<TilingDirection>(direction));
   }
+
+  NodeId parent = root_node_;  // of the next node
+  size_t depth = 0;            // of the next node, below the root node
+  bool has_current_node = !has_current_window;
+
+  // The leaves seen by the first pass and where, to find duplicate windows.
+  ArenaVector<std::pair<Window, size_t>> leaves;
+
+  while (!reader.at_end()) {
+    if (!reader.Expect(',', "expected ','")) {
+      return false;
+    }
+    size_t position = reader.position();
+
+    // Backtrack
+    if (reader.Accept(kBacktrack_)) {
+      if (!depth) {
+        return reader.Fail(position, "backtrack from the root node");
+      }
+      depth--;
+      parent = (build) ? nodes_[parent].parent : parent;
+      continue;
+    }
+
+    // Internal node
+    if (reader.Accept(kInternalPrefix_)) {
+      if (!reader.ReadNumber(kMaxTilingDirection, &direction, "invalid tiling direction")) {
+        return false;
+      }
+      depth++;
+      if (build) {
+        NodeId node = CreateNode(nullptr);
+        set_tiling_direction(node, static_cast<TilingDirection>(direction));
+        AddChild(parent, node);
+        parent = node;
+      }
+      continue;
+    }
+
+    // Leaf, which is always followed by a backtrack since it has no children.
+    unsigned long window = None;
+    if (!reader.Expect(kLeafPrefix_, "expected a node or a backtrack") ||
+        !reader.ReadNumber(ULONG_MAX, &window, "invalid window") ||
+        !reader.Expect(',', "expected a backtrack after a leaf") ||
+        !reader.Expect(kBacktrack_, "expected a backtrack after a leaf")) {
+      return false;
+    }
+
+    const WindowRegistry::Entry* entry = registry->Find(window);
+    if (build) {
+      AddChild(parent, CreateNode(unique_ptr<Client>(entry->client)));
+    } else if (!entry || !entry->client) {
+      return reader.Fail(position, "not a client");
+    } else if (entry->node != kNull_) {
+      return reader.Fail(position, "already in a client tree");
+    } else {
+      leaves.emplace_back(window, position);
+    }
+    has_current_node |= (window == current_window);
+  }
+
+  if (depth) {
+    return reader.Fail(size, "expected a backtrack");
+  } else if (!has_current_node) {
+    return reader.Fail(0, "the current window is not in the tree");
+  }
+
+  // Sorted by window and then by position, the repeats of a window follow
+  // its first appearance, and the earliest repeat is the one to report.
+  std::sort(leaves.begin(), leaves.end());
+  size_t duplicate = size;
+  for (size_t i = 1; i < leaves.size(); i++) {
+    if (leaves[i].first == leaves[i - 1].first) {
+      duplicate = std::min(duplicate, leaves[i].second);
+    }
+  }
+  if (duplicate != size) {
+    return reader.Fail(duplicate, "duplicate window");
+  }
+
+  if (build) {
+    Client* client = registry->GetClient(current_window);
+    current_node_ = (client) ? GetTreeNode(client) : kNull_;
+  }
+  return true;
 }
 
-vector<Tree::Node*> Tree::Node::GetLeaves() {
-  vector<Tree::Node*> leaves;
-  stack<Tree::Node*> st;
-  st.push(this);
+void Tree::Serialize(std::vector<Record>& records) const {
+  // The root node is always written as an internal node, even if it has
+  // no children at all.
+  records.push_back({None, static_cast<uint32_t>(child_count(root_node_)),
+                     static_cast<int32_t>(tiling_direction(root_node_))});
+
+  stack<NodeId> st;
+  for (NodeId child = last_child(root_node_); child != kNull_; child = GetLeftSibling(child)) {
+    st.push(child);
+  }
 
   while (!st.empty()) {
-    Tree::Node* node = st.top();
+    NodeId node = st.top();
     st.pop();
 
-    // If this node is a leaf, add it to the leaf vector.
-    if (node->children().empty()) {
-      leaves.push_back(node);
+    if (leaf(node)) {
+      records.push_back({client(node)->window(), 0, 0});
+      continue;
     }
 
-    // Push all children onto the stack in reverse order (if any).
-    for (int i = node->children().size() - 1; i >= 0; i--) {
-      st.push(node->children().at(i));
+    records.push_back({None, static_cast<uint32_t>(child_count(node)),
+                       static_cast<int32_t>(tiling_direction(node))});
+    for (NodeId child = last_child(node); child != kNull_; child = GetLeftSibling(child)) {
+      st.push(child);
     }
   }
-  return leaves;
 }
 
-bool Tree::Node::HasTilingClientsInSubtree() {
-  // Get all leaves from this node's subtree,
-  // and check if it has any tiling client.
-  for (auto leaf : this->GetLeaves()) {
-    if (!leaf->client()->is_floating()) {
-      return true;
+// Rebuilds a freshly constructed tree from the records written by
+// Serialize(std::vector<Record>&), claiming the registered clients like
+// Deserialize(const char*, size_t) does. Returns false without touching the tree
+// if the records don't make up a single tree.
+bool Tree::Deserialize(const Record* records, size_t count, Window current_window) {
+  if (!Validate(records, count)) {
+    return false;
+  }
+
+  WindowRegistry* registry = WindowRegistry::GetInstance();
+  nodes_.reserve(nodes_.size() + count);
+  set_tiling_direction(root_node_, static_cast<TilingDirection>(records[0].tiling_direction));
+
+  // The internal nodes whose children are still to come, and how many.
+  std::vector<std::pair<NodeId, uint32_t>> st;
+  st.emplace_back(root_node_, records[0].child_count);
+
+  for (size_t i = 1; i < count; i++) {
+    while (!st.back().second) {
+      st.pop_back();
+    }
+    NodeId parent = st.back().first;
+    st.back().second--;
+
+    const Record& record = records[i];
+    NodeId node = kNull_;
+
+    if (record.child_count) {
+      node = CreateNode(nullptr);
+      set_tiling_direction(node, static_cast<TilingDirection>(record.tiling_direction));
+      st.emplace_back(node, record.child_count);
+    } else if (record.window != None) {
+      // A window which appears twice is only claimed once.
+      const WindowRegistry::Entry* entry = registry->Find(static_cast<Window>(record.window));
+      if (entry->node != kNull_) {
+        continue;
+      }
+      node = CreateNode(unique_ptr<Client>(entry->client));
+    } else {
+      node = CreateNode(nullptr);
+      set_tiling_direction(node, static_cast<TilingDirection>(record.tiling_direction));
     }
+    AddChild(parent, node);
   }
-  return false;
+
+  Client* client = registry->GetClient(current_window);
+  current_node_ = (client) ? GetTreeNode(client) : kNull_;
+  return true;
 }
 
-vector<Tree::Node*> Tree::Node::children() const {
-  vector<Tree::Node*> children(children_.size());
-  for (size_t i = 0; i < children.size(); i++) {
-    children[i] = children_[i].get();
+// The records must start with the root node, the child counts must add up
+// to exactly `count` nodes, and every leaf must be a registered client.
+bool Tree::Validate(const Record* records, size_t count) const {
+  if (!count || records[0].window != None) {
+    return false;
+  }
+
+  WindowRegistry* registry = WindowRegistry::GetInstance();
+  uint64_t remaining = 1;  // the nodes which are still to come
+
+  for (size_t i = 0; i < count; i++) {
+    if (!remaining) {
+      return false;
+    }
+    remaining = remaining - 1 + records[i].child_count;
+
+    if (records[i].window != None &&
+        (records[i].child_count || !registry->GetClient(records[i].window))) {
+      return false;
+    }
   }
-  return children;
+  return remaining == 0;
 }
 
-Tree::Node* Tree::Node::parent() const {
-  return parent_;
+Tree::Node::Node()
+    : parent(kNull_),
+      first_child(kNull_),
+      last_child(kNull_),
+      prev_sibling(kNull_),
+      next_sibling(kNull_),
+      prev_leaf(kNull_),
+      next_leaf(kNull_),
+      child_count(),
+      tiling_count(),
+      floating_count(),
+      tiling_direction(TilingDirection::UNSPECIFIED),
+      client(),
+      dirty(true),
+      tile_area() {}
+
+Tree::ChildIterator::ChildIterator(const Tree* tree, NodeId node) : tree_(tree), node_(node) {}
+
+Tree::NodeId Tree::ChildIterator::operator*() const {
+  return node_;
 }
 
-void Tree::Node::set_parent(Tree::Node* parent) {
-  parent_ = parent;
+Tree::ChildIterator& Tree::ChildIterator::operator++() {
+  node_ = tree_->nodes_[node_].next_sibling;
+  return *this;
 }
 
-// Get the client associated with this node.
-Client* Tree::Node::client() const {
-  return client_.get();
+bool Tree::ChildIterator::operator!=(const ChildIterator& other) const {
+  return node_ != other.node_;
 }
 
-void Tree::Node::set_client(unique_ptr<Client> client) {
-  Tree::Node::mapper_.erase(client_.get());
-  if (client) {
-    Tree::Node::mapper_[client.get()] = this;
-  }
-  client_ = std::move(client);
+Tree::Children::Children(const Tree* tree, NodeId parent) : tree_(tree), parent_(parent) {}
+
+Tree::ChildIterator Tree::Children::begin() const {
+  return ChildIterator(tree_, tree_->nodes_[parent_].first_child);
 }
 
-Client* Tree::Node::release_client() {
-  return client_.release();
+Tree::ChildIterator Tree::Children::end() const {
+  return ChildIterator(tree_, kNull_);
 }
 
-TilingDirection Tree::Node::tiling_direction() const {
-  return tiling_direction_;
+Tree::LeafIterator::LeafIterator(const Tree* tree, NodeId node) : tree_(tree), node_(node) {}
+
+Tree::NodeId Tree::LeafIterator::operator*() const {
+  return node_;
+}
+
+Tree::LeafIterator& Tree::LeafIterator::operator++() {
+  node_ = tree_->nodes_[node_].next_leaf;
+  return *this;
 }
 
-void Tree::Node::set_tiling_direction(TilingDirection tiling_direction) {
-  tiling_direction_ = tiling_direction;
+bool Tree::LeafIterator::operator!=(const LeafIterator& other) const {
+  return node_ != other.node_;
+}
+
+Tree::Leaves::Leaves(const Tree* tree, NodeId first, NodeId end)
+    : tree_(tree), first_(first), end_(end) {}
+
+Tree::LeafIterator Tree::Leaves::begin() const {
+  return LeafIterator(tree_, first_);
 }
 
-bool Tree::Node::leaf() const {
-  return children_.empty();
+Tree::LeafIterator Tree::Leaves::end() const {
+  return LeafIterator(tree_, end_);
 }
 
 }  // namespace wmderland
@@ -2,13 +2,14 @@
 #ifndef WMDERLAND_TREE_H_
 #define WMDERLAND_TREE_H_
 
+#include <cstdint>
 #include <memory>
-#include <unordered_map>
+#include <string>
 #include <vector>
 
-namespace wmderland {
+#include "client.h"
 
-class Client;
+namespace wmderland {
 
 enum class TilingDirection {
   UNSPECIFIED,
@@ -16,63 +17,197 @@ enum class TilingDirection {
   VERTICAL,
 };
 
+// The client tree of a workspace. All nodes are stored in a contiguous array
+// and refer to each other by 32-bit indices (Tree::NodeId), so walking the
+// tree never chases heap pointers, and iterating over the children of a node
+// never allocates. Removed nodes are recycled via a free list.
+//
+// The leaves are also threaded into a doubly-linked list in DFS order (i.e.,
+// from left to right), so that the leaves of any subtree are a contiguous
+// run of the list which can be walked one O(1) step at a time.
 class Tree {
  public:
-  Tree();
-  virtual ~Tree() = default;
+  using NodeId = uint32_t;
+  static const NodeId kNull_;
 
-  class Node {
+  // Iterates over the children of a node, e.g.,
+  //   for (Tree::NodeId child : tree.children(node)) { ... }
+  class ChildIterator {
    public:
-    Node(std::unique_ptr<Client> client);
-    virtual ~Node();
+    ChildIterator(const Tree* tree, NodeId node);
+    NodeId operator*() const;
+    ChildIterator& operator++();
+    bool operator!=(const ChildIterator& other) const;
 
-    void AddChild(std::unique_ptr<Tree::Node> child);
-    void RemoveChild(Tree::Node* child);
-    void InsertChildAfter(std::unique_ptr<Tree::Node> child, Tree::Node* ref);
+   private:
+    const Tree* tree_;
+    NodeId node_;
+  };
 
-    Tree::Node* GetLeftSibling() const;
-    Tree::Node* GetRightSibling() const;
+  class Children {
+   public:
+    Children(const Tree* tree, NodeId parent);
+    ChildIterator begin() const;
+    ChildIterator end() const;
 
-    std::vector<Tree::Node*> GetLeaves();
-    bool HasTilingClientsInSubtree();
+   private:
+    const Tree* tree_;
+    NodeId parent_;
+  };
 
-    std::vector<Tree::Node*> children() const;
-    Tree::Node* parent() const;
-    Client* client() const;
-    TilingDirection tiling_direction() const;
-    bool leaf() const;
+  // Iterates over the leaves of a subtree from left to right, e.g.,
+  //   for (Tree::NodeId leaf : tree.leaves()) { ... }
+  class LeafIterator {
+   public:
+    LeafIterator(const Tree* tree, NodeId node);
+    NodeId operator*() const;
+    LeafIterator& operator++();
+    bool operator!=(const LeafIterator& other) const;
 
-    void set_parent(Tree::Node* parent);
-    void set_client(std::unique_ptr<Client> client);
-    Client* release_client();
-    void set_tiling_direction(TilingDirection tiling_direction);
+   private:
+    const Tree* tree_;
+    NodeId node_;
+  };
 
-    static std::unordered_map<Client*, Tree::Node*> mapper_;
+  class Leaves {
+   public:
+    Leaves(const Tree* tree, NodeId first, NodeId end);
+    LeafIterator begin() const;
+    LeafIterator end() const;
 
    private:
-    std::vector<std::unique_ptr<Tree::Node>> children_;
-    Tree::Node* parent_;
-
-    std::unique_ptr<Client> client_;
-    TilingDirection tiling_direction_;
+    const Tree* tree_;
+    NodeId first_;
+    NodeId end_;
   };
 
-  Tree::Node* GetTreeNode(Client* client) const;
-  std::vector<Tree::Node*> GetLeaves() const;
+  Tree();
+  virtual ~Tree() = default;
 
-  Tree::Node* root_node() const;
-  Tree::Node* current_node() const;
-  void set_current_node(Tree::Node* node);
+  // Creates a node which is not attached to the tree yet.
+  NodeId CreateNode(std::unique_ptr<Client> client);
+
+  // Removing a child destroys the child's entire subtree (and its clients).
+  void AddChild(NodeId parent, NodeId child);
+  void RemoveChild(NodeId parent, NodeId child);
+  void InsertChildAfter(NodeId parent, NodeId child, NodeId ref);
+
+  NodeId GetLeftSibling(NodeId node) const;
+  NodeId GetRightSibling(NodeId node) const;
+  NodeId GetFirstLeaf(NodeId node) const;
+  NodeId GetLastLeaf(NodeId node) const;
+  bool HasTilingClientsInSubtree(NodeId node) const;
+  NodeId GetTreeNode(Client* client) const;
+
+  // The numbers of clients in the subtree rooted at a node, which are kept
+  // up to date as the tree changes. UpdateClientCounts() must be called
+  // after a client has changed its floating state.
+  size_t tiling_count(NodeId node) const;
+  size_t floating_count(NodeId node) const;
+  size_t client_count(NodeId node) const;
+  void UpdateClientCounts(NodeId node);
+
+  Children children(NodeId node) const;
+  Leaves leaves(NodeId node) const;
+  Leaves leaves() const;
+  NodeId prev_leaf(NodeId node) const;
+  NodeId next_leaf(NodeId node) const;
+  NodeId first_child(NodeId node) const;
+  NodeId last_child(NodeId node) const;
+  size_t child_count(NodeId node) const;
+  NodeId parent(NodeId node) const;
+  Client* client(NodeId node) const;
+  TilingDirection tiling_direction(NodeId node) const;
+  bool leaf(NodeId node) const;
+
+  void set_client(NodeId node, std::unique_ptr<Client> client);
+  Client* release_client(NodeId node);
+  void set_tiling_direction(NodeId node, TilingDirection tiling_direction);
+
+  // Incremental tiling, see Workspace::Tile().
+  void MarkDirty(NodeId node);
+  void MarkAllDirty();
+  void MarkClean(NodeId node, const Client::Area& tile_area);
+  void MarkSubtreeClean(NodeId node);
+  bool dirty(NodeId node) const;
+  const Client::Area& tile_area(NodeId node) const;
+
+  NodeId root_node() const;
+  NodeId current_node() const;
+  void set_current_node(NodeId node);
+
+  // The text form, e.g., "23068675|i1,w23068675,b,i2,w20971523,b,w25165827,b,b",
+  // is the current window (or "none"), followed by the nodes in DFS
+  // pre-order: w<window> for a leaf, i<tiling direction> for an internal
+  // node, and b to go back up to the parent. The root node comes first and
+  // is never gone back up from. It's encoded into and decoded from a
+  // caller-provided buffer, so e.g. the tree dump doesn't allocate.
+  struct TextError {
+    size_t position;  // the offset of the first offending byte
+    const char* reason;
+  };
 
+  // Like snprintf(3), writes as much as fits into `buf` (without a
+  // terminating null byte) and returns the length of the whole text.
+  size_t Serialize(char* buf, size_t size) const;
+  bool Deserialize(const char* data, size_t size, TextError* error = nullptr);
   std::string Serialize() const;
-  void Deserialize(std::string data);
+  bool Deserialize(const std::string& data, TextError* error = nullptr);
+
+  // The binary form used by Snapshot: one fixed-size record per node, in
+  // DFS pre-order, so the shape of the tree follows from the child counts.
+  struct Record {
+    uint64_t window;  // None for an internal node
+    uint32_t child_count;
+    int32_t tiling_direction;
+  };
+
+  void Serialize(std::vector<Record>& records) const;  // appends to `records`
+  bool Deserialize(const Record* records, size_t count, Window current_window);
 
  private:
-  void DfsCleanUpHelper(Tree::Node* node) const;
-  void DfsSerializeHelper(Tree::Node* node, std::string& data) const;
+  struct Node {
+    Node();
+
+    NodeId parent;
+    NodeId first_child;
+    NodeId last_child;
+    NodeId prev_sibling;
+    NodeId next_sibling;  // also links the free list
+    NodeId prev_leaf;     // only valid for a leaf
+    NodeId next_leaf;     // only valid for a leaf
+    uint32_t child_count;
+    uint32_t tiling_count;
+    uint32_t floating_count;
+
+    TilingDirection tiling_direction;
+    std::unique_ptr<Client> client;
+
+    // A node is dirty if its subtree has changed since it was tiled last
+    // time, and tile_area is the area it was given at that time. The
+    // parent of a dirty node is always dirty too.
+    bool dirty;
+    Client::Area tile_area;
+  };
 
-  std::unique_ptr<Tree::Node> root_node_;
-  Tree::Node* current_node_;
+  void SetRegisteredNode(Client* client, NodeId node);
+  void AddClientCounts(NodeId node, int tiling_delta, int floating_delta);
+  void LinkLeaves(NodeId left, NodeId right);
+  void SpliceLeaves(NodeId parent, NodeId child, NodeId ref);
+  void Unlink(NodeId node);
+  void FreeSubtree(NodeId node);
+  bool Validate(const Record* records, size_t count) const;
+  bool ParseText(const char* data, size_t size, bool build, TextError* error);
+
+  static const char kNone_[];
+  static const char kBacktrack_;
+  static const char kLeafPrefix_;
+  static const char kInternalPrefix_;
+
+  std::vector<Tree::Node> nodes_;
+  NodeId free_list_;
+  NodeId root_node_;
+  NodeId current_node_;
 };
 
 }  // namespace wmderland
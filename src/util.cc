@@ -1,19 +1,252 @@
 // Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
 #include "util.h"
 
+extern "C" {
+#include <signal.h>
+#include <unistd.h>
+}
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <sstream>
+#include <unordered_map>
 
 #include "config.h"
+#if XCB_FOUND
+extern "C" {
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
+}
+#endif
 
 using std::pair;
 using std::size_t;
 using std::string;
+using std::unordered_map;
 using std::vector;
 
 namespace {
 Display* dpy;
 wmderland::Properties* prop;
 Window root_window;
+
+// The properties of each window we've asked about are cached here, so that
+// they are fetched from the X server only once. We select PropertyChangeMask
+// on these windows, and the WM invalidates the cached properties on
+// PropertyNotify (see wm_utils::InvalidateProperty()) and forgets the window
+// on DestroyNotify (see wm_utils::ForgetWindow()).
+const unsigned int kSizeHints = 1 << 0;
+const unsigned int kClassHint = 1 << 1;
+const unsigned int kNetWmName = 1 << 2;
+const unsigned int kNetWmWindowType = 1 << 3;
+const unsigned int kNetWmState = 1 << 4;
+const unsigned int kAllProperties = (1 << 5) - 1;
+
+struct WindowInfo {
+  unsigned int cached;  // which of the properties below are valid
+  XSizeHints size_hints;
+  pair<string, string> class_hint;
+  string net_wm_name;
+  vector<Atom> net_wm_window_type;
+  vector<Atom> net_wm_state;
+};
+
+unordered_map<Window, WindowInfo> cache;
+
+// The attributes (geometry, map state, etc) of a window are not properties,
+// so they are only kept until wm_utils::ReleasePrefetched() is called.
+unordered_map<Window, XWindowAttributes> prefetched_attrs;
+
+WindowInfo& GetCacheEntry(Window window) {
+  auto it = cache.find(window);
+  if (it != cache.end()) {
+    return it->second;
+  }
+
+  // This is sent before any query of the window's properties, so that any
+  // change after the query will be notified.
+  XSelectInput(dpy, window, PropertyChangeMask);
+  return cache[window] = WindowInfo();
+}
+
+unsigned int PropertyToCacheBit(Atom property) {
+  if (property == XA_WM_NORMAL_HINTS) {
+    return kSizeHints;
+  } else if (property == XA_WM_CLASS) {
+    return kClassHint;
+  } else if (property == prop->net[wmderland::atom::NET_WM_NAME]) {
+    return kNetWmName;
+  } else if (property == prop->net[wmderland::atom::NET_WM_WINDOW_TYPE]) {
+    return kNetWmWindowType;
+  } else if (property == prop->net[wmderland::atom::NET_WM_STATE]) {
+    return kNetWmState;
+  }
+  return 0;
+}
+
+#if XCB_FOUND
+template <typename T>
+using XcbReply = std::unique_ptr<T, decltype(&std::free)>;
+
+template <typename T>
+XcbReply<T> MakeXcbReply(T* reply, xcb_generic_error_t* error) {
+  std::free(error);  // errors are treated the same as empty replies
+  return XcbReply<T>(reply, &std::free);
+}
+
+struct XcbCookies {
+  xcb_get_window_attributes_cookie_t attr;
+  xcb_get_geometry_cookie_t geometry;
+  xcb_get_property_cookie_t size_hints;
+  xcb_get_property_cookie_t class_hint;
+  xcb_get_property_cookie_t net_wm_name;
+  xcb_get_property_cookie_t net_wm_window_type;
+  xcb_get_property_cookie_t net_wm_state;
+};
+
+// Sends all the queries needed to manage a window without waiting for
+// any reply.
+XcbCookies SendXcbQueries(xcb_connection_t* conn, Window window) {
+  using wmderland::atom::NET_WM_NAME;
+  using wmderland::atom::NET_WM_STATE;
+  using wmderland::atom::NET_WM_WINDOW_TYPE;
+
+  XcbCookies cookies;
+  cookies.attr = xcb_get_window_attributes(conn, window);
+  cookies.geometry = xcb_get_geometry(conn, window);
+  cookies.size_hints = xcb_get_property(conn, 0, window, XCB_ATOM_WM_NORMAL_HINTS,
+                                        XCB_ATOM_WM_SIZE_HINTS, 0, 18);
+  cookies.class_hint =
+      xcb_get_property(conn, 0, window, XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 0, 2048);
+  cookies.net_wm_name = xcb_get_property(conn, 0, window, prop->net[NET_WM_NAME],
+                                         XCB_GET_PROPERTY_TYPE_ANY, 0, 1024);
+  cookies.net_wm_window_type = xcb_get_property(
+      conn, 0, window, prop->net[NET_WM_WINDOW_TYPE], XCB_ATOM_ATOM, 0, sizeof(Atom));
+  cookies.net_wm_state = xcb_get_property(conn, 0, window, prop->net[NET_WM_STATE],
+                                          XCB_ATOM_ATOM, 0, sizeof(Atom));
+  return cookies;
+}
+
+XcbReply<xcb_get_property_reply_t> GetPropertyReply(xcb_connection_t* conn,
+                                                    xcb_get_property_cookie_t cookie) {
+  xcb_generic_error_t* error = nullptr;
+  return MakeXcbReply(xcb_get_property_reply(conn, cookie, &error), error);
+}
+
+vector<Atom> ToAtoms(const xcb_get_property_reply_t* reply) {
+  vector<Atom> atoms;
+  if (reply && reply->format == 32) {
+    const xcb_atom_t* values = static_cast<xcb_atom_t*>(
+        xcb_get_property_value(const_cast<xcb_get_property_reply_t*>(reply)));
+    atoms.assign(values, values + reply->value_len);
+  }
+  return atoms;
+}
+
+// Collects the replies of the queries sent by SendXcbQueries(), and converts
+// them into what the corresponding Xlib functions would have returned.
+void ReceiveXcbReplies(xcb_connection_t* conn, const XcbCookies& cookies,
+                       XWindowAttributes* attr_ret, WindowInfo* info_ret) {
+  XWindowAttributes& a = *attr_ret;
+  WindowInfo& info = *info_ret;
+  a = XWindowAttributes();
+  info = WindowInfo();
+  info.cached = kAllProperties;
+  xcb_generic_error_t* error = nullptr;
+
+  auto attr = MakeXcbReply(xcb_get_window_attributes_reply(conn, cookies.attr, &error), error);
+  error = nullptr;
+  auto geometry = MakeXcbReply(xcb_get_geometry_reply(conn, cookies.geometry, &error), error);
+
+  if (geometry) {
+    a.x = geometry->x;
+    a.y = geometry->y;
+    a.width = geometry->width;
+    a.height = geometry->height;
+    a.border_width = geometry->border_width;
+    a.depth = geometry->depth;
+    a.root = geometry->root;
+  }
+  if (attr) {
+    a.c_class = attr->_class;
+    a.bit_gravity = attr->bit_gravity;
+    a.win_gravity = attr->win_gravity;
+    a.backing_store = attr->backing_store;
+    a.backing_planes = attr->backing_planes;
+    a.backing_pixel = attr->backing_pixel;
+    a.save_under = attr->save_under;
+    a.colormap = attr->colormap;
+    a.map_installed = attr->map_is_installed;
+    a.map_state = attr->map_state;
+    a.all_event_masks = attr->all_event_masks;
+    a.your_event_mask = attr->your_event_mask;
+    a.do_not_propagate_mask = attr->do_not_propagate_mask;
+    a.override_redirect = attr->override_redirect;
+    a.screen = DefaultScreenOfDisplay(dpy);
+  }
+
+  // WM_NORMAL_HINTS is an array of 18 CARD32s (15 in pre-ICCCM clients),
+  // laid out exactly like XSizeHints.
+  auto size_hints = GetPropertyReply(conn, cookies.size_hints);
+  if (size_hints && size_hints->format == 32 && size_hints->value_len >= 15) {
+    const int32_t* v = static_cast<int32_t*>(xcb_get_property_value(size_hints.get()));
+    XSizeHints& hints = info.size_hints;
+    hints.flags = v[0];
+    hints.x = v[1];
+    hints.y = v[2];
+    hints.width = v[3];
+    hints.height = v[4];
+    hints.min_width = v[5];
+    hints.min_height = v[6];
+    hints.max_width = v[7];
+    hints.max_height = v[8];
+    hints.width_inc = v[9];
+    hints.height_inc = v[10];
+    hints.min_aspect.x = v[11];
+    hints.min_aspect.y = v[12];
+    hints.max_aspect.x = v[13];
+    hints.max_aspect.y = v[14];
+    if (size_hints->value_len >= 18) {
+      hints.base_width = v[15];
+      hints.base_height = v[16];
+      hints.win_gravity = v[17];
+    } else {
+      hints.flags &= ~(PBaseSize | PWinGravity);
+    }
+  }
+
+  // WM_CLASS contains two consecutive null-terminated strings:
+  // res_name and res_class.
+  auto class_hint = GetPropertyReply(conn, cookies.class_hint);
+  if (class_hint && class_hint->format == 8) {
+    const char* value = static_cast<char*>(xcb_get_property_value(class_hint.get()));
+    size_t len = xcb_get_property_value_length(class_hint.get());
+    size_t res_name_len = strnlen(value, len);
+
+    // A missing field is "undefined", just like in GetXClassHint().
+    string res_name = (len) ? string(value, res_name_len) : "undefined";
+    string res_class = "undefined";
+    if (res_name_len + 1 < len) {
+      res_class.assign(value + res_name_len + 1, strnlen(value + res_name_len + 1,
+                                                         len - res_name_len - 1));
+    }
+    info.class_hint = std::make_pair(res_class, res_name);
+  } else {
+    info.class_hint = std::make_pair("", "");
+  }
+
+  auto net_wm_name = GetPropertyReply(conn, cookies.net_wm_name);
+  if (net_wm_name && net_wm_name->format == 8) {
+    const char* value = static_cast<char*>(xcb_get_property_value(net_wm_name.get()));
+    size_t len = xcb_get_property_value_length(net_wm_name.get());
+    info.net_wm_name.assign(value, strnlen(value, len));
+  }
+
+  info.net_wm_window_type = ToAtoms(GetPropertyReply(conn, cookies.net_wm_window_type).get());
+  info.net_wm_state = ToAtoms(GetPropertyReply(conn, cookies.net_wm_state).get());
+}
+#endif
 }  // namespace
 
 namespace wmderland {
@@ -26,8 +259,78 @@ void Init(Display* dpy, Properties* prop, Window root_window) {
   ::root_window = root_window;
 }
 
+// Query all the information needed to manage the given windows at once.
+// With XCB, all the requests are sent before waiting for any reply, so that
+// it only costs about one round trip in total. Without XCB, it falls back to
+// the Xlib getters below, one round trip per query.
+void Prefetch(Window window) {
+  Prefetch(vector<Window>{window});
+}
+
+void Prefetch(const vector<Window>& windows) {
+#if XCB_FOUND
+  xcb_connection_t* conn = XGetXCBConnection(dpy);
+  vector<pair<Window, XcbCookies>> cookies;
+  cookies.reserve(windows.size());
+
+  for (const auto window : windows) {
+    if (prefetched_attrs.find(window) == prefetched_attrs.end()) {
+      GetCacheEntry(window);
+      cookies.push_back({window, SendXcbQueries(conn, window)});
+    }
+  }
+  for (const auto& window_cookies : cookies) {
+    Window window = window_cookies.first;
+    ReceiveXcbReplies(conn, window_cookies.second, &prefetched_attrs[window], &cache[window]);
+  }
+#else
+  for (const auto window : windows) {
+    if (prefetched_attrs.find(window) != prefetched_attrs.end()) {
+      continue;
+    }
+
+    // The getters below will fill the cache.
+    XWindowAttributes attr = GetXWindowAttributes(window);
+    GetWmNormalHints(window);
+    GetXClassHint(window);
+    GetNetWmName(window);
+    WindowPropertyHasAtom(window, prop->net[atom::NET_WM_WINDOW_TYPE], None);
+    WindowPropertyHasAtom(window, prop->net[atom::NET_WM_STATE], None);
+    prefetched_attrs[window] = attr;
+  }
+#endif
+}
+
+// Forget the attributes fetched by Prefetch(), since they may be changed
+// later without a PropertyNotify. The cached properties are kept.
+void ReleasePrefetched() {
+  if (!prefetched_attrs.empty()) {
+    prefetched_attrs.clear();
+  }
+}
+
+// Called on PropertyNotify, so that the property will be fetched again
+// the next time it is needed.
+void InvalidateProperty(Window window, Atom property) {
+  auto it = cache.find(window);
+  if (it != cache.end()) {
+    it->second.cached &= ~PropertyToCacheBit(property);
+  }
+}
+
+// Called on DestroyNotify.
+void ForgetWindow(Window window) {
+  cache.erase(window);
+  prefetched_attrs.erase(window);
+}
+
 // Get the XWindowAttributes of a window.
 XWindowAttributes GetXWindowAttributes(Window window) {
+  auto it = prefetched_attrs.find(window);
+  if (it != prefetched_attrs.end()) {
+    return it->second;
+  }
+
   XWindowAttributes ret;
   XGetWindowAttributes(dpy, window, &ret);
   return ret;
@@ -35,14 +338,29 @@ XWindowAttributes GetXWindowAttributes(Window window) {
 
 // Get the XSizeHints of a window.
 XSizeHints GetWmNormalHints(Window window) {
-  XSizeHints hints;
+  WindowInfo& info = GetCacheEntry(window);
+  if (info.cached & kSizeHints) {
+    return info.size_hints;
+  }
+
+  XSizeHints hints = XSizeHints();
   long msize;
   XGetWMNormalHints(dpy, window, &hints, &msize);
+  info.size_hints = hints;
+  info.cached |= kSizeHints;
   return hints;
 }
 
 // Get the XClassHint (which contains res_class and res_name) of a window.
 pair<string, string> GetXClassHint(Window window) {
+  WindowInfo& info = GetCacheEntry(window);
+  if (info.cached & kClassHint) {
+    return info.class_hint;
+  }
+
+  info.class_hint = std::make_pair("", "");
+  info.cached |= kClassHint;
+
   XClassHint hint;
 
   if (XGetClassHint(dpy, window, &hint)) {
@@ -56,21 +374,29 @@ pair<string, string> GetXClassHint(Window window) {
     if (hint.res_name) {
       XFree(hint.res_name);
     }
-    return std::make_pair(res_class, res_name);
+    info.class_hint = std::make_pair(res_class, res_name);
   }
 
-  return std::make_pair("", "");
+  return info.class_hint;
 }
 
 // Get the utf8string in _NET_WM_NAME property.
 string GetNetWmName(Window window) {
+  WindowInfo& info = GetCacheEntry(window);
+  if (info.cached & kNetWmName) {
+    return info.net_wm_name;
+  }
+
+  info.net_wm_name.clear();
+  info.cached |= kNetWmName;
+
   XTextProperty name;
   if (!XGetTextProperty(dpy, window, &name, prop->net[atom::NET_WM_NAME]) || !name.nitems) {
     return "";
   }
-  string ret(reinterpret_cast<char*>(name.value));
+  info.net_wm_name = reinterpret_cast<char*>(name.value);
   XFree(name.value);
-  return ret;
+  return info.net_wm_name;
 }
 
 // Get the WM_NAME (i.e., the window title) of a window.
@@ -107,6 +433,39 @@ void ClearNetActiveWindow() {
   XDeleteProperty(dpy, root_window, prop->net[atom::NET_ACTIVE_WINDOW]);
 }
 
+// Set root window's _NET_CLIENT_LIST_STACKING property (bottom-to-top).
+void SetNetClientListStacking(const Window* windows, size_t count) {
+  XChangeProperty(dpy, root_window, prop->net[atom::NET_CLIENT_LIST_STACKING], XA_WINDOW, 32,
+                  PropModeReplace, reinterpret_cast<const unsigned char*>(windows), count);
+}
+
+// Add `state` to or remove it from window's _NET_WM_STATE property, and keep
+// the other states, whoever has set them. The property is cached, so this
+// is usually not a round trip, and nothing is sent if nothing changes.
+void SetNetWmState(Window window, Atom state, bool enabled) {
+  Atom property = prop->net[atom::NET_WM_STATE];
+  if (WindowPropertyHasAtom(window, property, state) == enabled) {
+    return;
+  }
+
+  vector<Atom>& atoms = GetCacheEntry(window).net_wm_state;
+  if (enabled) {
+    atoms.push_back(state);
+  } else {
+    atoms.erase(std::remove(atoms.begin(), atoms.end(), state), atoms.end());
+  }
+  XChangeProperty(dpy, window, property, XA_ATOM, 32, PropModeReplace,
+                  reinterpret_cast<unsigned char*>(atoms.data()), atoms.size());
+}
+
+void SetNetWmStateFullscreen(Window window, bool fullscreen) {
+  SetNetWmState(window, prop->net[atom::NET_WM_STATE_FULLSCREEN], fullscreen);
+}
+
+void SetNetWmStateHidden(Window window, bool hidden) {
+  SetNetWmState(window, prop->net[atom::NET_WM_STATE_HIDDEN], hidden);
+}
+
 // Get the atoms contained in the property of window w. The number of atoms
 // retrieved will be stored in *atom_len. XFree() should be called manually on
 // the returned Atom ptr.
@@ -125,7 +484,24 @@ Atom* GetWindowProperty(Window window, Atom property, unsigned long* atom_len) {
 }
 
 // Check if the property of window w contains the target atom.
+// _NET_WM_WINDOW_TYPE and _NET_WM_STATE are cached.
 bool WindowPropertyHasAtom(Window window, Atom property, Atom target_atom) {
+  unsigned int bit = PropertyToCacheBit(property);
+  if (bit == kNetWmWindowType || bit == kNetWmState) {
+    WindowInfo& info = GetCacheEntry(window);
+    vector<Atom>& atoms =
+        (bit == kNetWmWindowType) ? info.net_wm_window_type : info.net_wm_state;
+
+    if (!(info.cached & bit)) {
+      unsigned long atom_len = 0;
+      Atom* values = GetWindowProperty(window, property, &atom_len);
+      atoms.assign(values, values + ((values) ? atom_len : 0));
+      XFree(values);
+      info.cached |= bit;
+    }
+    return target_atom && std::find(atoms.begin(), atoms.end(), target_atom) != atoms.end();
+  }
+
   unsigned long atom_len = 0;
   Atom* atoms = GetWindowProperty(window, property, &atom_len);
 
@@ -247,18 +623,29 @@ string ToAbsPath(const string& path) {
   return abs_path;
 }
 
+// Execute a shell command in the background. The child process is reaped
+// by WindowManager::OnSigchld().
 void ExecuteCmd(string cmd) {
   if (cmd.empty()) {
     return;
   }
 
   string_utils::Strip(cmd);
-  if (cmd.back() != '&') {
-    cmd.push_back('&');
-  }
 
-  if (system(cmd.c_str())) {
+  pid_t pid = fork();
+  if (pid == -1) {
     WM_LOG(ERROR, "Failed to execute: " + cmd);
+  } else if (pid == 0) {
+    // The WM blocks several signals in order to receive them via signalfd
+    // (see EventLoop::AddSignal), but the blocked signal mask would be
+    // inherited by the command we're going to execute, so unblock them.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, nullptr);
+    setsid();
+
+    execl("/bin/sh", "sh", "-c", cmd.c_str(), nullptr);
+    _exit(EXIT_FAILURE);
   }
 }
 
@@ -17,6 +17,11 @@ namespace wmderland {
 namespace wm_utils {
 
 void Init(Display* dpy, Properties* prop, Window root_window);
+void Prefetch(Window window);
+void Prefetch(const std::vector<Window>& windows);
+void ReleasePrefetched();
+void InvalidateProperty(Window window, Atom property);
+void ForgetWindow(Window window);
 XWindowAttributes GetXWindowAttributes(Window window);
 XSizeHints GetWmNormalHints(Window window);
 std::pair<std::string, std::string> GetXClassHint(Window window);
@@ -25,6 +30,10 @@ std::string GetWmName(Window window);
 void SetWindowWmState(Window window, unsigned long state);
 void SetNetActiveWindow(Window window);
 void ClearNetActiveWindow();
+void SetNetClientListStacking(const Window* windows, size_t count);
+void SetNetWmState(Window window, Atom state, bool enabled);
+void SetNetWmStateFullscreen(Window window, bool fullscreen);
+void SetNetWmStateHidden(Window window, bool hidden);
 Atom* GetWindowProperty(Window window, Atom property, unsigned long* atom_len);
 bool WindowPropertyHasAtom(Window window, Atom property, Atom target_atom);
 
@@ -5,11 +5,17 @@ extern "C" {
 #include <X11/Xatom.h>
 #include <X11/Xproto.h>
 #include <X11/cursorfont.h>
+#include <sys/wait.h>
 }
 #include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 
+#include "arena.h"
 #include "client.h"
 #include "config.h"
 #include "util.h"
@@ -52,12 +58,21 @@ WindowManager::WindowManager(Display* dpy)
       cookie_(dpy_, prop_.get(), COOKIE_FILE),
       ipc_evmgr_(),
       snapshot_(SNAPSHOT_FILE),
-      docks_(),
-      notifications_(),
-      hidden_windows_(),
+      journal_(),
+      event_loop_(),
+      stats_(STATS_FILE, STATS_TEXTFILE),
+      stats_timer_(EventLoop::kNoTimer_),
+      reconciler_(dpy_),
+      tree_dump_(),
+      registry_(WindowRegistry::GetInstance()),
+      display_resolution_(),
       workspaces_(),
       current_(),
-      btn_pressed_event_() {
+      is_restarting_(),
+      btn_pressed_event_(),
+      drag_(),
+      switch_(),
+      event_stats_() {
   if (HasAnotherWmRunning()) {
     std::cerr << "Another window manager is already running." << std::endl;
     return;
@@ -69,20 +84,25 @@ WindowManager::WindowManager(Display* dpy)
 
   // Initialization.
   wm_utils::Init(dpy_, prop_.get(), root_window_);
+  XWindowAttributes root_window_attr = wm_utils::GetXWindowAttributes(root_window_);
+  display_resolution_ = {root_window_attr.width, root_window_attr.height};
   config_->Load();
   InitWorkspaces();
   InitProperties();
   InitXGrabs();
   InitCursors();
+  InitEventLoop();
+  InitStats();
   XSync(dpy_, false);
-
-  // Run the autostart_cmds defined in user's config.
-  for (const auto& cmd : config_->autostart_cmds()) {
-    sys_utils::ExecuteCmd(cmd);
-  }
 }
 
 WindowManager::~WindowManager() {
+  WM_LOG(INFO, "events: " << event_stats_.events << " in " << event_stats_.batches
+                          << " batches, arrangements: " << event_stats_.arranges << " ("
+                          << event_stats_.arrange_requests - event_stats_.arranges
+                          << " skipped)");
+  WM_LOG(INFO, "x requests: " << reconciler_.counters().requests << " ("
+                              << reconciler_.counters().skipped << " skipped)");
   WM_LOG(INFO, "releasing resources");
   XCloseDisplay(dpy_);
 }
@@ -91,7 +111,9 @@ bool WindowManager::HasAnotherWmRunning() {
   // WindowManager::OnWmDetected is a special error handler which will set
   // WindowManager::is_running_ to false if another WM is already running.
   XSetErrorHandler(&WindowManager::OnWmDetected);
-  XSelectInput(dpy_, root_window_, SubstructureNotifyMask | SubstructureRedirectMask);
+  // StructureNotifyMask lets us know when the screen is resized (e.g., xrandr).
+  XSelectInput(dpy_, root_window_,
+               StructureNotifyMask | SubstructureNotifyMask | SubstructureRedirectMask);
   XSync(dpy_, false);
   XSetErrorHandler(&WindowManager::OnXError);
   return !is_running_;
@@ -141,11 +163,16 @@ void WindowManager::InitProperties() {
                   prop_->utf8string, 8, PropModeReplace,
                   reinterpret_cast<unsigned char*>(win_mgr_name), win_mgr_name_len);
 
+  // The end of a workspace switch is marked by a property change on it,
+  // see FinishWorkspaceSwitch().
+  XSelectInput(dpy_, wmcheckwin_, PropertyChangeMask);
+
   XChangeProperty(dpy_, root_window_, prop_->net[atom::NET_SUPPORTING_WM_CHECK], XA_WINDOW, 32,
                   PropModeReplace, reinterpret_cast<unsigned char*>(&wmcheckwin_), 1);
 
-  // Initialize NET_CLIENT_LIST to empty.
+  // Initialize NET_CLIENT_LIST and NET_CLIENT_LIST_STACKING to empty.
   XDeleteProperty(dpy_, root_window_, prop_->net[atom::NET_CLIENT_LIST]);
+  XDeleteProperty(dpy_, root_window_, prop_->net[atom::NET_CLIENT_LIST_STACKING]);
 
   // Set _NET_SUPPORTED to indicate which atoms are supported by this window
   // manager.
@@ -155,9 +182,7 @@ void WindowManager::InitProperties() {
 
   // Set _NET_NUMBER_OF_DESKTOP, _NET_CURRENT_DESKTOP, _NET_DESKTOP_VIEWPORT and
   // _NET_DESKTOP_NAMES to support polybar's xworkspace module.
-  unsigned long workspace_count = workspaces_.size();
-  XChangeProperty(dpy_, root_window_, prop_->net[atom::NET_NUMBER_OF_DESKTOPS], XA_CARDINAL,
-                  32, PropModeReplace, reinterpret_cast<unsigned char*>(&workspace_count), 1);
+  UpdateDesktops();
 
   XChangeProperty(dpy_, root_window_, prop_->net[atom::NET_CURRENT_DESKTOP], XA_CARDINAL, 32,
                   PropModeReplace, reinterpret_cast<unsigned char*>(&current_), 1);
@@ -167,97 +192,240 @@ void WindowManager::InitProperties() {
                   PropModeReplace, reinterpret_cast<unsigned char*>(desktop_viewport_cord), 2);
 }
 
+// The other workspaces will be created on first use, see GetWorkspace().
 void WindowManager::InitWorkspaces() {
-  char* names[workspaces_.size()];
+  GetWorkspace(current_);
+}
 
-  for (size_t i = 0; i < workspaces_.size(); i++) {
-    // Initialize workspace objects.
-    workspaces_[i] = std::make_unique<Workspace>(dpy_, root_window_, config_.get(), i);
+void WindowManager::InitEventLoop() {
+  // The X events themselves are read in WindowManager::Run(), the event loop
+  // only has to wake us up when the X connection becomes readable.
+  event_loop_.AddFd(ConnectionNumber(dpy_), []() {});
 
-    // Copy workspace name const char* to names[i], which is needed later.
-    // See the XSetTextProperty below.
-    names[i] = const_cast<char*>(workspaces_[i]->name());
-  }
+  event_loop_.AddSignal(SIGCHLD, [this]() { OnSigchld(); });
+  event_loop_.AddSignal(SIGHUP, [this]() { HandleAction(Action(Action::Type::RELOAD)); });
+  event_loop_.AddSignal(SIGTERM, []() { is_running_ = false; });
+  event_loop_.AddSignal(SIGINT, []() { is_running_ = false; });
+  event_loop_.AddSignal(SIGUSR1, [this]() { stats_.Dump(); });
+}
+
+void WindowManager::InitStats() {
+  stats_.RegisterCounter("x_events", &event_stats_.events);
+  stats_.RegisterCounter("x_event_batches", &event_stats_.batches);
+  stats_.RegisterCounter("arrange_requests", &event_stats_.arrange_requests);
+  stats_.RegisterCounter("arrangements", &event_stats_.arranges);
+  stats_.RegisterCounter("arena_allocations", Arena::per_event().allocations());
+  stats_.RegisterCounter("arena_heap_allocations", Arena::per_event().heap_allocations());
+
+  const Reconciler::Counters& counters = reconciler_.counters();
+  stats_.RegisterCounter("x_requests", &counters.requests);
+  stats_.RegisterCounter("x_requests_configure", &counters.configures);
+  stats_.RegisterCounter("x_requests_border", &counters.borders);
+  stats_.RegisterCounter("x_requests_map", &counters.maps);
+  stats_.RegisterCounter("x_requests_unmap", &counters.unmaps);
+  stats_.RegisterCounter("x_requests_restack", &counters.restacks);
+  stats_.RegisterCounter("x_requests_focus", &counters.focuses);
+  stats_.RegisterCounter("x_requests_property", &counters.properties);
+  stats_.RegisterCounter("x_requests_skipped", &counters.skipped);
+
+  const Journal::Counters& journal_counters = journal_.counters();
+  stats_.RegisterCounter("journal_entries", &journal_counters.entries);
+  stats_.RegisterCounter("journal_bytes", &journal_counters.bytes);
+  stats_.RegisterCounter("journal_compactions", &journal_counters.compactions);
+  ScheduleStatsTextfile();
+}
 
-  // Set NET_DESKTOP_NAMES to display workspace names in polybar's xworkspace
-  // module.
-  XTextProperty text_prop;
-  Xutf8TextListToTextProperty(dpy_, names, workspaces_.size(), XUTF8StringStyle, &text_prop);
-  XSetTextProperty(dpy_, root_window_, &text_prop, prop_->net[atom::NET_DESKTOP_NAMES]);
+// (Re)schedules writing the stats textfile every config_->stats_interval()
+// seconds, so that it can be collected by node_exporter.
+void WindowManager::ScheduleStatsTextfile() {
+  event_loop_.CancelTimer(stats_timer_);
+  stats_timer_ = EventLoop::kNoTimer_;
+
+  if (config_->stats_interval() > 0) {
+    std::chrono::seconds interval(config_->stats_interval());
+    stats_timer_ = event_loop_.AddTimer(interval, [this]() { stats_.SaveTextfile(); },
+                                        /*repeat=*/true);
+  }
 }
 
 void WindowManager::Run() {
   XEvent event;
 
   while (is_running_) {
-    // Retrieve and dispatch next X event.
-    XNextEvent(dpy_, &event);
-    switch (event.type) {
-      case ConfigureRequest:
-        OnConfigureRequest(event.xconfigurerequest);
-        break;
-      case MapRequest:
-        OnMapRequest(event.xmaprequest);
-        break;
-      case MapNotify:
-        OnMapNotify(event.xmap);
-        break;
-      case UnmapNotify:
-        OnUnmapNotify(event.xunmap);
-        break;
-      case DestroyNotify:
-        OnDestroyNotify(event.xdestroywindow);
-        break;
-      case KeyPress:
-        OnKeyPress(event.xkey);
-        break;
-      case ButtonPress:
-        OnButtonPress(event.xbutton);
-        break;
-      case ButtonRelease:
-        OnButtonRelease(event.xbutton);
-        break;
-      case MotionNotify:
-        OnMotionNotify(event.xbutton);
-        break;
-      case ClientMessage:
-        OnClientMessage(event.xclient);
-        break;
-      default:
-        // Unhandled X Events are ignored.
-        break;
+    // Drain all the X events which are already pending, so that a burst of
+    // events (e.g., an app closing dozens of windows at once) only results
+    // in one arrangement.
+    if (XPending(dpy_)) {
+      event_stats_.batches++;
+    }
+    while (is_running_ && XPending(dpy_)) {
+      XNextEvent(dpy_, &event);
+      HandleXEvent(event);
+      Arena::per_event().Reset();
+    }
+
+    // Arrange the windows once for this batch of events (if needed), and
+    // send whatever has changed to the X server.
+    FlushArrangeRequests();
+    reconciler_.Commit();
+    if (switch_.is_pending) {
+      FinishWorkspaceSwitch();
+    }
+    journal_.Flush();
+    Arena::per_event().Reset();
+    XFlush(dpy_);
+#if GEOMETRY_CHECK
+    CheckGeometryCache();
+#endif
+
+    // Sleep until the X connection, a timer, a signal or any other
+    // registered file descriptor wakes us up. Xlib may have read events
+    // into its queue while waiting for a reply, and those don't make the
+    // connection readable, so handle them first.
+    if (is_running_ && !QLength(dpy_)) {
+      event_loop_.Poll();
     }
   }
 }
 
+void WindowManager::HandleXEvent(const XEvent& event) {
+  Stats::Clock::time_point start = Stats::Clock::now();
+  event_stats_.events++;
+
+  switch (event.type) {
+    case ConfigureRequest:
+      OnConfigureRequest(event.xconfigurerequest);
+      break;
+    case ConfigureNotify:
+      OnConfigureNotify(event.xconfigure);
+      break;
+    case MapRequest:
+      OnMapRequest(event.xmaprequest);
+      break;
+    case MapNotify:
+      OnMapNotify(event.xmap);
+      break;
+    case UnmapNotify:
+      OnUnmapNotify(event.xunmap);
+      break;
+    case DestroyNotify:
+      OnDestroyNotify(event.xdestroywindow);
+      wm_utils::ForgetWindow(event.xdestroywindow.window);
+      reconciler_.OnDestroyNotify(event.xdestroywindow.window);
+      break;
+    case PropertyNotify:
+      OnPropertyNotify(event.xproperty);
+      break;
+    case KeyPress:
+      OnKeyPress(event.xkey);
+      break;
+    case ButtonPress:
+      OnButtonPress(event.xbutton);
+      break;
+    case ButtonRelease:
+      OnButtonRelease(event.xbutton);
+      break;
+    case MotionNotify:
+      OnMotionNotify(event.xbutton);
+      break;
+    case ClientMessage:
+      OnClientMessage(event.xclient);
+      break;
+    default:
+      // Unhandled X Events are ignored.
+      break;
+  }
+
+  // Window information prefetched while handling this event may be outdated
+  // by the time the next event arrives.
+  wm_utils::ReleasePrefetched();
+  stats_.RecordEvent(event.type, Stats::Clock::now() - start);
+}
+
+// Runs the autostart_cmds defined in user's config. They are skipped when
+// the WM takes over from a previous process (see Journal::Restore()), since
+// whatever they started is still running.
+void WindowManager::Autostart() {
+  for (const auto& cmd : config_->autostart_cmds()) {
+    sys_utils::ExecuteCmd(cmd);
+  }
+}
+
+// Requests the windows in current workspace to be arranged. The actual work
+// is deferred until all pending X events have been handled, see
+// WindowManager::FlushArrangeRequests().
+void WindowManager::ArrangeWindows() {
+  GetWorkspace(current_)->set_layout_dirty(true);
+  event_stats_.arrange_requests++;
+}
+
+void WindowManager::FlushArrangeRequests() {
+  if (!GetWorkspace(current_)->is_layout_dirty()) {
+    return;
+  }
+
+  ArrangeCurrentWorkspace();
+  GetWorkspace(current_)->set_layout_dirty(false);
+  event_stats_.arranges++;
+}
+
 // Arranges the windows in current workspace to how they ought to be.
-void WindowManager::ArrangeWindows() const {
-  Client* focused_client = workspaces_[current_]->GetFocusedClient();
+void WindowManager::ArrangeCurrentWorkspace() {
+  Client* focused_client = GetWorkspace(current_)->GetFocusedClient();
 
   if (!focused_client) {
     MapDocks();
-    wm_utils::ClearNetActiveWindow();
+    reconciler_.SetActiveWindow(None);
+    RestackWindows();
     return;
   } else {
-    wm_utils::SetNetActiveWindow(focused_client->window());
+    reconciler_.SetActiveWindow(focused_client->window());
   }
 
-  if (workspaces_[current_]->is_fullscreen()) {
+  if (GetWorkspace(current_)->is_fullscreen()) {
     UnmapDocks();
     focused_client->SetBorderWidth(0);
     focused_client->MoveResize(0, 0, GetDisplayResolution());
-    focused_client->Raise();
   } else {
     MapDocks();
-    workspaces_[current_]->MapAllClients();
-    workspaces_[current_]->Tile(GetTilingArea());
-    workspaces_[current_]->SetFocusedClient(focused_client->window());
-    workspaces_[current_]->RaiseAllFloatingClients();
-    RaiseNotifications();
+    GetWorkspace(current_)->MapAllClients();
+    GetWorkspace(current_)->Tile(GetTilingArea());
+    GetWorkspace(current_)->SetFocusedClient(focused_client->window());
   }
+  RestackWindows();
+}
+
+// Declares the stacking order of the windows on the screen, from bottom to
+// top: the clients in current workspace (see Workspace::GetStackingOrder()),
+// the docks and then the notifications. The clients in the other workspaces
+// are unmapped or parked off-screen, so their order doesn't matter. The
+// reconciler applies it only if it has changed.
+void WindowManager::RestackWindows() {
+  auto clients = GetWorkspace(current_)->GetStackingOrder();
+
+  ArenaVector<Window> order;
+  order.reserve(clients.size() + registry_->count(WindowRegistry::DOCK) +
+                registry_->count(WindowRegistry::NOTIFICATION));
+  for (const auto client : clients) {
+    order.push_back(client->window());
+  }
+
+  registry_->ForEach(WindowRegistry::DOCK,
+                     [&order](const WindowRegistry::Entry& e) { order.push_back(e.window); });
+  registry_->ForEach(WindowRegistry::NOTIFICATION,
+                     [&order](const WindowRegistry::Entry& e) { order.push_back(e.window); });
+
+  reconciler_.Restack(order.data(), order.size());
 }
 
 void WindowManager::OnConfigureRequest(const XConfigureRequestEvent& e) {
+  // A parked client stays off-screen until its workspace is visited.
+  Client* c = registry_->GetClient(e.window);
+  unsigned long value_mask = e.value_mask;
+  if (c && c->is_parked()) {
+    value_mask &= ~(CWX | CWY);
+  }
+
   XWindowChanges changes;
   changes.x = e.x;
   changes.y = e.y;
@@ -266,29 +434,88 @@ void WindowManager::OnConfigureRequest(const XConfigureRequestEvent& e) {
   changes.border_width = e.border_width;
   changes.sibling = e.above;
   changes.stack_mode = e.detail;
-  XConfigureWindow(dpy_, e.window, e.value_mask, &changes);
+  XConfigureWindow(dpy_, e.window, value_mask, &changes);
+  reconciler_.OnConfigureRequest(e.window);
+
+  // Keep track of the client's geometry, so that it will be re-tiled
+  // by the ArrangeWindows() below if it's a tiling client.
+  if (c) {
+    Client::Area geometry = c->geometry();
+    if (value_mask & CWX) geometry.x = e.x;
+    if (value_mask & CWY) geometry.y = e.y;
+    if (value_mask & CWWidth) geometry.w = e.width;
+    if (value_mask & CWHeight) geometry.h = e.height;
+    c->set_geometry(geometry);
+  }
 
-  if (hidden_windows_.find(e.window) != hidden_windows_.end()) {
-    hidden_windows_.erase(e.window);
+  if (registry_->HasRole(e.window, WindowRegistry::HIDDEN)) {
+    registry_->RemoveRole(e.window, WindowRegistry::HIDDEN);
     Manage(e.window);
   }
 
   ArrangeWindows();
 }
 
+// Keeps the geometry cache of the root window, docks and clients in sync
+// with the X server.
+void WindowManager::OnConfigureNotify(const XConfigureEvent& e) {
+  Client::Area geometry(e.x, e.y, e.width, e.height);
+
+  if (e.window == root_window_) {
+    if (display_resolution_ != std::make_pair(e.width, e.height)) {
+      display_resolution_ = {e.width, e.height};
+      ArrangeWindows();
+    }
+    return;
+  }
+
+  WindowRegistry::Entry* entry = registry_->Find(e.window);
+  if (!entry) {
+    return;
+  }
+
+  if (entry->roles & WindowRegistry::DOCK) {
+    reconciler_.OnConfigureNotify(e.window, geometry, e.border_width);
+    if (entry->area != geometry) {
+      entry->area = geometry;
+      ArrangeWindows();
+    }
+    return;
+  }
+
+  // If we've sent another configure request after the one which generated
+  // this event, then this event is outdated and should be ignored. The
+  // geometry cache of a parked client is where it will be when unparked.
+  if (entry->client && e.serial >= entry->client->configure_serial()) {
+    if (!entry->client->is_parked()) {
+      entry->client->set_geometry(geometry);
+    }
+    reconciler_.OnConfigureNotify(e.window, geometry, e.border_width);
+  }
+}
+
 void WindowManager::OnMapRequest(const XMapRequestEvent& e) {
+  // A window which asks to be mapped is (still) unmapped.
+  reconciler_.OnUnmapNotify(e.window);
+
+  // Fetch everything we need to know about this window in one go.
+  wm_utils::Prefetch(e.window);
+
   // If user has requested to prohibit this window from being mapped,
   // then don't map it.
-  if (config_->ShouldProhibit(e.window)) {
+  if (config_->GetWindowRules(e.window).should_prohibit) {
     return;
   }
 
-  // If this window is a dock (or bar), map it, add it to docks_
+  // If this window is a dock (or bar), map it, register it as a dock
   // and arrange the workspace.
-  if (wm_utils::IsDock(e.window) && docks_.find(e.window) == docks_.end()) {
-    XMapWindow(dpy_, e.window);
-    docks_.insert(e.window);
-    workspaces_[current_]->Tile(GetTilingArea());
+  if (wm_utils::IsDock(e.window) && !registry_->HasRole(e.window, WindowRegistry::DOCK)) {
+    XWindowAttributes attr = wm_utils::GetXWindowAttributes(e.window);
+    reconciler_.Map(e.window);
+    registry_->AddRole(e.window, WindowRegistry::DOCK).area = {attr.x, attr.y, attr.width,
+                                                               attr.height};
+    journal_.MarkRolesDirty();
+    GetWorkspace(current_)->Tile(GetTilingArea());
     return;
   }
 
@@ -297,60 +524,77 @@ void WindowManager::OnMapRequest(const XMapRequestEvent& e) {
 }
 
 void WindowManager::OnMapNotify(const XMapEvent& e) {
+  reconciler_.OnMapNotify(e.window, e.override_redirect);
+
   // Checking if a window is a notification in OnMapRequest() will fail
   // (especially dunst), So we perform the check here (after the window is
   // mapped) instead.
-  if (wm_utils::IsNotification(e.window) &&
-      notifications_.find(e.window) == notifications_.end()) {
-    notifications_.insert(e.window);
+  if (wm_utils::IsNotification(e.window)) {
+    registry_->AddRole(e.window, WindowRegistry::NOTIFICATION);
+    journal_.MarkRolesDirty();
   }
 
-  auto it = Client::mapper_.find(e.window);
-  if (it == Client::mapper_.end()) {
+  Client* c = registry_->GetClient(e.window);
+  if (!c) {
     return;
   }
 
-  Client* c = it->second;
   c->set_mapped(true);
 }
 
 void WindowManager::OnUnmapNotify(const XUnmapEvent& e) {
-  auto it = Client::mapper_.find(e.window);
-  if (it == Client::mapper_.end()) {
+  reconciler_.OnUnmapNotify(e.window);
+
+  Client* c = registry_->GetClient(e.window);
+  if (!c) {
     return;
   }
 
   // Some program unmaps their windows but does not remove them,
   // so if this window has just been unmapped, but it was not unmapped
   // by the user, then we will remove them for user.
-  Client* c = it->second;
   c->set_mapped(false);
 
   if (c->has_unmap_req_from_wm()) {
     c->set_has_unmap_req_from_wm(false);
   } else {
-    hidden_windows_.insert(e.window);
+    registry_->AddRole(e.window, WindowRegistry::HIDDEN);
     Unmanage(c->window());
   }
 }
 
 void WindowManager::OnDestroyNotify(const XDestroyWindowEvent& e) {
-  if (docks_.find(e.window) != docks_.end()) {
-    docks_.erase(e.window);
-    workspaces_[current_]->Tile(GetTilingArea());
+  if (registry_->HasRole(e.window, WindowRegistry::DOCK)) {
+    registry_->RemoveRole(e.window, WindowRegistry::DOCK);
+    journal_.MarkRolesDirty();
+    GetWorkspace(current_)->Tile(GetTilingArea());
     return;
   }
 
   if (wm_utils::IsNotification(e.window)) {
-    notifications_.erase(e.window);
+    registry_->RemoveRole(e.window, WindowRegistry::NOTIFICATION);
+    journal_.MarkRolesDirty();
     return;
   }
 
   wm_utils::SetWindowWmState(e.window, WithdrawnState);
-  hidden_windows_.erase(e.window);
+  registry_->RemoveRole(e.window, WindowRegistry::HIDDEN);
   Unmanage(e.window);
 }
 
+void WindowManager::OnPropertyNotify(const XPropertyEvent& e) {
+  wm_utils::InvalidateProperty(e.window, e.atom);
+
+  // The fence of a workspace switch, see FinishWorkspaceSwitch(). A later
+  // switch may have sent another fence by now, which is the one to wait for.
+  if (e.window == wmcheckwin_ && switch_.is_measuring && e.serial >= switch_.fence_serial) {
+    const char* name =
+        (switch_.is_parking) ? "workspace_switch_park" : "workspace_switch_unmap";
+    stats_.RecordLatency(name, Stats::Clock::now() - switch_.start);
+    switch_.is_measuring = false;
+  }
+}
+
 void WindowManager::OnKeyPress(const XKeyEvent& e) {
   for (const auto& action : config_->GetKeybindActions(e.state, e.keycode)) {
     HandleAction(action);
@@ -358,56 +602,69 @@ void WindowManager::OnKeyPress(const XKeyEvent& e) {
 }
 
 void WindowManager::OnButtonPress(const XButtonEvent& e) {
-  auto it = Client::mapper_.find(e.subwindow);
-  if (it == Client::mapper_.end()) {
+  Client* c = registry_->GetClient(e.subwindow);
+  if (!c) {
     return;
   }
 
-  Client* c = it->second;
-  wm_utils::SetNetActiveWindow(c->window());
+  reconciler_.SetActiveWindow(c->window());
   c->workspace()->UnsetFocusedClient();
   c->workspace()->SetFocusedClient(c->window());
-  c->workspace()->RaiseAllFloatingClients();
+  RestackWindows();
 
   if (c->is_floating() && !c->is_fullscreen()) {
     XDefineCursor(dpy_, root_window_, cursors_[e.button]);
 
-    c->Raise();
-    c->set_attr_cache(c->GetXWindowAttributes());
     btn_pressed_event_ = e;
+
+    drag_.target = registry_->GetHandle(c->window());
+    drag_.origin = c->geometry();
+    drag_.geometry = drag_.origin;
+    drag_.last_update_time = e.time;
+    drag_.has_pending_update = false;
   }
 }
 
 void WindowManager::OnButtonRelease(const XButtonEvent&) {
-  auto it = Client::mapper_.find(btn_pressed_event_.subwindow);
-  if (it == Client::mapper_.end()) {
+  Client* c = GetDragTarget();
+  if (!c) {
     return;
   }
 
-  Client* c = it->second;
+  // Make sure the final geometry is applied even if the last motion
+  // events were throttled (see WindowManager::OnMotionNotify).
+  FlushDragUpdate();
+
   if (c->is_floating()) {
-    XWindowAttributes attr = wm_utils::GetXWindowAttributes(btn_pressed_event_.subwindow);
-    cookie_.Put(c->window(), {attr.x, attr.y, attr.width, attr.height});
+    cookie_.Put(c->window(), drag_.geometry);
   }
 
-  btn_pressed_event_.subwindow = None;
+  drag_.target = WindowRegistry::Handle();
   XDefineCursor(dpy_, root_window_, cursors_[CURSOR_NORMAL]);
 }
 
 void WindowManager::OnMotionNotify(const XButtonEvent& e) {
-  auto it = Client::mapper_.find(btn_pressed_event_.subwindow);
-  if (it == Client::mapper_.end()) {
+  Client* c = GetDragTarget();
+  if (!c) {
     return;
   }
 
-  Client* c = it->second;
-  const XWindowAttributes& attr = c->attr_cache();
-  int xdiff = e.x - btn_pressed_event_.x;
-  int ydiff = e.y - btn_pressed_event_.y;
-  int new_x = attr.x + ((btn_pressed_event_.button == MOUSE_BTN_LEFT) ? xdiff : 0);
-  int new_y = attr.y + ((btn_pressed_event_.button == MOUSE_BTN_LEFT) ? ydiff : 0);
-  int new_width = attr.width + ((btn_pressed_event_.button == MOUSE_BTN_RIGHT) ? xdiff : 0);
-  int new_height = attr.height + ((btn_pressed_event_.button == MOUSE_BTN_RIGHT) ? ydiff : 0);
+  // Motion compression: only the latest pending motion event matters, so
+  // discard the stale ones which are already in the event queue.
+  XEvent latest;
+  latest.xbutton = e;
+  while (XCheckTypedWindowEvent(dpy_, e.window, MotionNotify, &latest)) {
+  }
+
+  const XMotionEvent& motion = latest.xmotion;
+  int xdiff = motion.x - btn_pressed_event_.x;
+  int ydiff = motion.y - btn_pressed_event_.y;
+  bool is_moving = btn_pressed_event_.button == MOUSE_BTN_LEFT;
+  bool is_resizing = btn_pressed_event_.button == MOUSE_BTN_RIGHT;
+  int new_x = drag_.origin.x + ((is_moving) ? xdiff : 0);
+  int new_y = drag_.origin.y + ((is_moving) ? ydiff : 0);
+  int new_width = drag_.origin.w + ((is_resizing) ? xdiff : 0);
+  int new_height = drag_.origin.h + ((is_resizing) ? ydiff : 0);
 
   int min_width =
       (c->size_hints().min_width > 0) ? c->size_hints().min_width : MIN_WINDOW_WIDTH;
@@ -415,7 +672,49 @@ void WindowManager::OnMotionNotify(const XButtonEvent& e) {
       (c->size_hints().min_height > 0) ? c->size_hints().min_height : MIN_WINDOW_HEIGHT;
   new_width = (new_width < min_width) ? min_width : new_width;
   new_height = (new_height < min_height) ? min_height : new_height;
-  c->MoveResize(new_x, new_y, new_width, new_height);
+  drag_.geometry = {new_x, new_y, new_width, new_height};
+
+  // Frame pacing: send at most config_->move_resize_rate() updates per
+  // second. A throttled update will be flushed by a later motion event, by
+  // WindowManager::OnButtonRelease, or by a timer if the pointer stops.
+  unsigned int rate = config_->move_resize_rate();
+  Time elapsed = motion.time - drag_.last_update_time;
+  if (rate > 0 && elapsed < 1000 / rate) {
+    drag_.has_pending_update = true;
+    if (drag_.update_timer == EventLoop::kNoTimer_) {
+      std::chrono::milliseconds delay(1000 / rate - elapsed);
+      drag_.update_timer = event_loop_.AddTimer(delay, [this]() { FlushDragUpdate(); });
+    }
+    return;
+  }
+
+  drag_.last_update_time = motion.time;
+  drag_.has_pending_update = true;
+  FlushDragUpdate();
+}
+
+// Sends the latest geometry computed by WindowManager::OnMotionNotify (if it
+// has not been sent yet) to the window being moved/resized.
+void WindowManager::FlushDragUpdate() {
+  if (drag_.update_timer != EventLoop::kNoTimer_) {
+    event_loop_.CancelTimer(drag_.update_timer);
+    drag_.update_timer = EventLoop::kNoTimer_;
+  }
+
+  Client* c = GetDragTarget();
+  if (!c || !drag_.has_pending_update) {
+    return;
+  }
+
+  c->MoveResize(drag_.geometry.x, drag_.geometry.y, drag_.geometry.w, drag_.geometry.h);
+  drag_.has_pending_update = false;
+}
+
+// Returns the client being moved/resized, or nullptr if there is no drag in
+// progress or the window is gone.
+Client* WindowManager::GetDragTarget() {
+  WindowRegistry::Entry* entry = registry_->Get(drag_.target);
+  return (entry) ? entry->client : nullptr;
 }
 
 void WindowManager::OnClientMessage(const XClientMessageEvent& e) {
@@ -423,19 +722,17 @@ void WindowManager::OnClientMessage(const XClientMessageEvent& e) {
     ipc_evmgr_.Handle(e);
 
   } else if (e.message_type == prop_->net[atom::NET_CURRENT_DESKTOP]) {
-    if (e.data.l[0] >= 0 && e.data.l[0] < WORKSPACE_COUNT) {
-      GotoWorkspace(e.data.l[0]);
-    }
+    GotoWorkspace(e.data.l[0]);
 
   } else if (e.message_type == prop_->net[atom::NET_WM_STATE]) {
     if (static_cast<Atom>(e.data.l[1]) == prop_->net[atom::NET_WM_STATE_FULLSCREEN] ||
         static_cast<Atom>(e.data.l[2]) == prop_->net[atom::NET_WM_STATE_FULLSCREEN]) {
-      auto it = Client::mapper_.find(e.window);
-      if (it == Client::mapper_.end()) {
+      Client* c = registry_->GetClient(e.window);
+      if (!c) {
         return;
       }
       bool should_fullscreen = e.data.l[0] == 1 /* _NET_WM_STATE_ADD */
-          || (e.data.l[0] == 2 /* _NET_WM_STATE_TOGGLE */ && !it->second->is_fullscreen());
+          || (e.data.l[0] == 2 /* _NET_WM_STATE_TOGGLE */ && !c->is_fullscreen());
       SetFullscreen(e.window, should_fullscreen);
     }
   }
@@ -446,7 +743,7 @@ void WindowManager::OnClientMessage(const XClientMessageEvent& e) {
 // 3. Run all commands in config->autostart_cmds_on_reload_
 void WindowManager::OnConfigReload() {
   for (const auto& workspace : workspaces_) {
-    for (const auto client : workspace->GetClients()) {
+    for (const auto client : workspace.second->GetClients()) {
       client->SetBorderWidth(config_->border_width());
       client->SetBorderColor(config_->unfocused_color());
     }
@@ -456,6 +753,18 @@ void WindowManager::OnConfigReload() {
   for (const auto& cmd : config_->autostart_cmds_on_reload()) {
     sys_utils::ExecuteCmd(cmd);
   }
+
+  ScheduleStatsTextfile();
+}
+
+// Reap the terminated child processes, see sys_utils::ExecuteCmd() and
+// Cookie::Compact().
+void WindowManager::OnSigchld() {
+  pid_t pid;
+  int status;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    cookie_.OnChildExit(pid, status);
+  }
 }
 
 int WindowManager::OnXError(Display*, XErrorEvent*) {
@@ -468,36 +777,40 @@ int WindowManager::OnWmDetected(Display*, XErrorEvent*) {
 }
 
 void WindowManager::Manage(Window window) {
-  // If this window id has a corresponding Client* in Client::mapper_,
-  // don't process further.
-  auto it = Client::mapper_.find(window);
-  if (it != Client::mapper_.end()) {
+  // If this window is already a client, don't process further.
+  if (registry_->HasRole(window, WindowRegistry::CLIENT)) {
     return;
   }
 
+  // Fetch everything we need to know about this window in one go
+  // (no-op if it has already been prefetched in OnMapRequest).
+  wm_utils::Prefetch(window);
+
   // Spawn this window in the specified workspace if such rule exists,
   // otherwise spawn it in current workspace.
-  int target = config_->GetSpawnWorkspaceId(window);
-  if (target == UNSPECIFIED_WORKSPACE) {
+  WindowRules rules = config_->GetWindowRules(window);
+  int target = rules.spawn_workspace_id;
+  if (target < 0 || target >= MAX_WORKSPACE_COUNT) {
     target = current_;
   }
 
-  Client* prev_focused_client = workspaces_[target]->GetFocusedClient();
-  workspaces_[target]->UnsetFocusedClient();
-  workspaces_[target]->Add(window);
+  Client* prev_focused_client = GetWorkspace(target)->GetFocusedClient();
+  GetWorkspace(target)->UnsetFocusedClient();
+  GetWorkspace(target)->Add(window);
+  journal_.MarkDirty(target);
   UpdateClientList();  // update NET_CLIENT_LIST
 
-  bool should_float = config_->ShouldFloat(window) || wm_utils::IsDialog(window) ||
+  bool should_float = rules.should_float || wm_utils::IsDialog(window) ||
       wm_utils::IsSplash(window) || wm_utils::IsUtility(window);
 
   bool should_fullscreen =
-      config_->ShouldFullscreen(window) || wm_utils::HasNetWmStateFullscreen(window);
+      rules.should_fullscreen || wm_utils::HasNetWmStateFullscreen(window);
 
-  workspaces_[target]->GetClient(window)->set_mapped(true);
-  workspaces_[target]->GetClient(window)->set_floating(should_float);
+  GetWorkspace(target)->GetClient(window)->set_mapped(true);
+  GetWorkspace(target)->GetClient(window)->set_floating(should_float);
 
-  if (workspaces_[target]->is_fullscreen()) {
-    workspaces_[target]->SetFocusedClient(prev_focused_client->window());
+  if (GetWorkspace(target)->is_fullscreen()) {
+    GetWorkspace(target)->SetFocusedClient(prev_focused_client->window());
   }
 
   if (should_float) {
@@ -508,74 +821,95 @@ void WindowManager::Manage(Window window) {
     SetFullscreen(window, true);
   }
 
-  if (target == current_ && !workspaces_[current_]->is_fullscreen()) {
+  if (target == current_ && !GetWorkspace(current_)->is_fullscreen()) {
     ArrangeWindows();
   }
 }
 
 void WindowManager::Unmanage(Window window) {
   // If we aren't managing this window, there's no need to proceed further.
-  auto it = Client::mapper_.find(window);
-  if (it == Client::mapper_.end()) {
+  Client* c = registry_->GetClient(window);
+  if (!c) {
     return;
   }
 
-  Client* c = it->second;
-
   // If the client being destroyed is in fullscreen mode, make sure to unset the
   // workspace's fullscreen state.
   if (c->is_fullscreen()) {
     c->workspace()->set_fullscreen(false);
   }
 
-  // Remove the corresponding client from the client tree.
+  // Remove the corresponding client from the client tree, and the workspace
+  // too if it's empty now (unless it's the current one).
+  int workspace_id = c->workspace()->id();
+  journal_.MarkDirty(workspace_id);
   c->workspace()->Remove(window);
+  ReclaimWorkspace(workspace_id);
   UpdateClientList();
   ArrangeWindows();
 }
 
 void WindowManager::HandleAction(const Action& action) {
-  Client* focused_client = workspaces_[current_]->GetFocusedClient();
+  Stats::Clock::time_point start = Stats::Clock::now();
+  Client* focused_client = GetWorkspace(current_)->GetFocusedClient();
 
   switch (action.type()) {
     case Action::Type::NAVIGATE_LEFT:
     case Action::Type::NAVIGATE_RIGHT:
     case Action::Type::NAVIGATE_UP:
     case Action::Type::NAVIGATE_DOWN:
-      workspaces_[current_]->Navigate(action.type());
+      GetWorkspace(current_)->Navigate(action.type());
       break;
     case Action::Type::TILE_H:
-      workspaces_[current_]->SetTilingDirection(TilingDirection::HORIZONTAL);
+      GetWorkspace(current_)->SetTilingDirection(TilingDirection::HORIZONTAL);
+      journal_.MarkDirty(current_);
       break;
     case Action::Type::TILE_V:
-      workspaces_[current_]->SetTilingDirection(TilingDirection::VERTICAL);
+      GetWorkspace(current_)->SetTilingDirection(TilingDirection::VERTICAL);
+      journal_.MarkDirty(current_);
       break;
     case Action::Type::TOGGLE_FLOATING:
-      if (!focused_client) return;
+      if (!focused_client) break;
       SetFloating(focused_client->window(), !focused_client->is_floating(),
                   /*use_default_size=*/true);
       break;
     case Action::Type::TOGGLE_FULLSCREEN:
-      if (!focused_client) return;
+      if (!focused_client) break;
       SetFullscreen(focused_client->window(), !focused_client->is_fullscreen());
       break;
     case Action::Type::GOTO_WORKSPACE:
-      GotoWorkspace(std::stoi(action.argument()) - 1);
+      GotoWorkspace(GetWorkspaceId(action.argument()));
       break;
-    case Action::Type::WORKSPACE:
-      GotoWorkspace(current_ + std::stoi(action.argument()));
+    case Action::Type::WORKSPACE: {
+      // The offset is user input, so reject anything that could overflow
+      // current_ before GotoWorkspace() gets a chance to range check it.
+      const char* arg = action.argument().c_str();
+      char* end = nullptr;
+      errno = 0;
+      long offset = std::strtol(arg, &end, 10);
+      if (end == arg || *end || errno == ERANGE ||
+          offset <= -MAX_WORKSPACE_COUNT || offset >= MAX_WORKSPACE_COUNT) {
+        break;
+      }
+      GotoWorkspace(current_ + static_cast<int>(offset));
       break;
+    }
     case Action::Type::MOVE_WINDOW_TO_WORKSPACE:
-      if (!focused_client) return;
-      MoveWindowToWorkspace(focused_client->window(), std::stoi(action.argument()) - 1);
+      if (!focused_client) break;
+      MoveWindowToWorkspace(focused_client->window(), GetWorkspaceId(action.argument()));
       break;
     case Action::Type::KILL:
-      if (!focused_client) return;
+      if (!focused_client) break;
       KillClient(focused_client->window());
       break;
     case Action::Type::EXIT:
       is_running_ = false;
       break;
+    case Action::Type::RESTART:
+      WM_LOG(INFO, "Restarting...");
+      is_restarting_ = true;
+      is_running_ = false;
+      break;
     case Action::Type::RELOAD:
       sys_utils::NotifySend("Reloading config...");
       config_->Load();
@@ -585,22 +919,125 @@ void WindowManager::HandleAction(const Action& action) {
       WM_LOG(INFO, "Debug crash on demand.");
       throw std::runtime_error("Debug crash");
       break;
+    case Action::Type::DUMP_STATS:
+      stats_.Dump();
+      break;
+    case Action::Type::DUMP_TREES:
+      DumpTrees();
+      break;
+    case Action::Type::SET_LAYOUT:
+      GetWorkspace(current_)->set_layout(Layout::StrToType(action.argument()));
+      journal_.MarkDirty(current_);
+      ArrangeWindows();
+      break;
     case Action::Type::EXEC:
       sys_utils::ExecuteCmd(action.argument());
       break;
     default:
       break;
   }
+
+  stats_.RecordAction(action.type(), Stats::Clock::now() - start);
+}
+
+// Returns the workspace with the given id, creating it if needed. The id
+// must be in [0, MAX_WORKSPACE_COUNT).
+Workspace* WindowManager::GetWorkspace(int id) {
+  std::unique_ptr<Workspace>& workspace = workspaces_[id];
+  if (!workspace) {
+    workspace = std::make_unique<Workspace>(dpy_, root_window_, config_.get(), id);
+    UpdateDesktops();
+  }
+  return workspace.get();
+}
+
+// A workspace is given either by its number (starting from 1), or by its
+// name, in which case a workspace with that name is created if there's no
+// such workspace yet. Returns -1 if there's no room for another one.
+int WindowManager::GetWorkspaceId(const std::string& s) {
+  if (!s.empty() && std::all_of(s.begin(), s.end(), ::isdigit)) {
+    errno = 0;
+    long id = std::strtol(s.c_str(), nullptr, 10);
+    if (errno == ERANGE || id < 1 || id > MAX_WORKSPACE_COUNT) {
+      return -1;
+    }
+    return static_cast<int>(id) - 1;
+  }
+
+  for (const auto& workspace : workspaces_) {
+    if (s == workspace.second->name()) {
+      return workspace.first;
+    }
+  }
+
+  for (int id = WORKSPACE_COUNT; id < MAX_WORKSPACE_COUNT; id++) {
+    if (!workspaces_.count(id)) {
+      GetWorkspace(id)->set_name(s);
+      UpdateDesktops();
+      return id;
+    }
+  }
+  return -1;
+}
+
+void WindowManager::ReclaimWorkspace(int id) {
+  auto it = workspaces_.find(id);
+  if (id == current_ || it == workspaces_.end() || !it->second->is_empty()) {
+    return;
+  }
+
+  workspaces_.erase(it);
+  UpdateDesktops();
+}
+
+// Updates _NET_NUMBER_OF_DESKTOPS and _NET_DESKTOP_NAMES. The desktops are
+// numbered by workspace id, so there are at least WORKSPACE_COUNT of them,
+// or enough to include the workspace with the largest id.
+void WindowManager::UpdateDesktops() {
+  int desktop_count = WORKSPACE_COUNT;
+  for (const auto& workspace : workspaces_) {
+    desktop_count = std::max(desktop_count, workspace.first + 1);
+  }
+
+  unsigned long number_of_desktops = desktop_count;
+  XChangeProperty(dpy_, root_window_, prop_->net[atom::NET_NUMBER_OF_DESKTOPS], XA_CARDINAL,
+                  32, PropModeReplace, reinterpret_cast<unsigned char*>(&number_of_desktops),
+                  1);
+
+  // NET_DESKTOP_NAMES is a list of null-terminated strings.
+  std::string names;
+  for (int id = 0; id < desktop_count; id++) {
+    auto it = workspaces_.find(id);
+    names += (it != workspaces_.end()) ? it->second->name() : std::to_string(id);
+    names += '\0';
+  }
+  XChangeProperty(dpy_, root_window_, prop_->net[atom::NET_DESKTOP_NAMES], prop_->utf8string,
+                  8, PropModeReplace,
+                  reinterpret_cast<unsigned char*>(const_cast<char*>(names.data())),
+                  names.size());
 }
 
 void WindowManager::GotoWorkspace(int next) {
-  if (current_ == next || next < 0 || next >= (int)workspaces_.size()) {
+  if (current_ == next || next < 0 || next >= MAX_WORKSPACE_COUNT) {
     return;
   }
 
-  workspaces_[current_]->UnmapAllClients();
-  workspaces_[next]->MapAllClients();
+  switch_.start = Stats::Clock::now();
+  switch_.is_parking = config_->park_workspaces();
+  switch_.is_pending = true;
+
+  if (switch_.is_parking) {
+    GetWorkspace(current_)->ParkAllClients();
+  } else {
+    GetWorkspace(current_)->UnmapAllClients();
+  }
+  GetWorkspace(next)->MapAllClients();
+  journal_.MarkDirty(current_);  // the clients are now unmapped or parked
+  journal_.MarkDirty(next);
+
+  int prev = current_;
   current_ = next;
+  ReclaimWorkspace(prev);
   ArrangeWindows();
 
   // Update _NET_CURRENT_DESKTOP
@@ -608,31 +1045,48 @@ void WindowManager::GotoWorkspace(int next) {
                   PropModeReplace, reinterpret_cast<unsigned char*>(&next), 1);
 }
 
+// A workspace switch is finished when the X server has processed all of
+// our requests, which is measured separately for parking and unmapping,
+// so the two modes can be compared. Rather than waiting for a round trip,
+// a zero-length append to a property of wmcheckwin_ is sent after the
+// switch, and the switch is over once its PropertyNotify comes back, see
+// OnPropertyNotify().
+void WindowManager::FinishWorkspaceSwitch() {
+  switch_.fence_serial = NextRequest(dpy_);
+  XChangeProperty(dpy_, wmcheckwin_, prop_->net[atom::NET_WM_NAME], prop_->utf8string, 8,
+                  PropModeAppend, nullptr, 0);
+  switch_.is_pending = false;
+  switch_.is_measuring = true;
+}
+
 void WindowManager::MoveWindowToWorkspace(Window window, int next) {
-  auto it = Client::mapper_.find(window);
-  if (current_ == next || it == Client::mapper_.end() || next < 0 ||
-      next >= (int)workspaces_.size()) {
+  Client* c = registry_->GetClient(window);
+  if (current_ == next || !c || next < 0 || next >= MAX_WORKSPACE_COUNT) {
     return;
   }
 
-  Client* c = it->second;
-  if (workspaces_[current_]->is_fullscreen()) {
+  if (GetWorkspace(current_)->is_fullscreen()) {
     SetFullscreen(c->window(), false);
   }
 
-  c->Unmap();
-  workspaces_[next]->UnsetFocusedClient();
-  workspaces_[current_]->Move(window, workspaces_[next].get());
+  if (config_->park_workspaces()) {
+    c->Park();
+  } else {
+    c->Unmap();
+  }
+  GetWorkspace(next)->UnsetFocusedClient();
+  GetWorkspace(current_)->Move(window, GetWorkspace(next));
+  journal_.MarkDirty(current_);
+  journal_.MarkDirty(next);
   ArrangeWindows();
 }
 
 void WindowManager::SetFloating(Window window, bool floating, bool use_default_size) {
-  auto it = Client::mapper_.find(window);
-  if (it == Client::mapper_.end()) {
+  Client* c = registry_->GetClient(window);
+  if (!c) {
     return;
   }
 
-  Client* c = it->second;
   if (c->is_fullscreen()) {
     return;
   }
@@ -643,44 +1097,41 @@ void WindowManager::SetFloating(Window window, bool floating, bool use_default_s
   }
 
   c->set_floating(floating);
+  journal_.MarkDirty(c->workspace()->id());
   ArrangeWindows();  // floating windows won't be tiled
 }
 
 void WindowManager::SetFullscreen(Window window, bool fullscreen) {
-  auto it = Client::mapper_.find(window);
-  if (it == Client::mapper_.end()) {
+  Client* c = registry_->GetClient(window);
+  if (!c) {
     return;
   }
 
-  Client* c = it->second;
   if (c->is_fullscreen() == fullscreen) {
     return;
   }
 
   c->set_fullscreen(fullscreen);
   c->workspace()->set_fullscreen(fullscreen);
+  journal_.MarkDirty(c->workspace()->id());
   c->SetBorderWidth((fullscreen) ? 0 : config_->border_width());
 
   if (fullscreen) {
     UnmapDocks();
-    c->set_attr_cache(c->GetXWindowAttributes());
+    c->set_saved_geometry(c->geometry());
     c->MoveResize(0, 0, GetDisplayResolution());
     c->workspace()->UnmapAllClients();
     c->Map();
     c->workspace()->SetFocusedClient(c->window());
   } else {
     MapDocks();
-    const XWindowAttributes& attr = c->attr_cache();
-    c->MoveResize(attr.x, attr.y, attr.width, attr.height);
+    const Client::Area& geometry = c->saved_geometry();
+    c->MoveResize(geometry.x, geometry.y, geometry.w, geometry.h);
     ArrangeWindows();
   }
 
   // Update window's _NET_WM_STATE_FULLSCREEN property.
-  // If the window is set to be NOT fullscreen, we will simply write a nullptr
-  // with 0 elements.
-  Atom* atom = (fullscreen) ? &prop_->net[atom::NET_WM_STATE_FULLSCREEN] : nullptr;
-  XChangeProperty(dpy_, window, prop_->net[atom::NET_WM_STATE], XA_ATOM, 32, PropModeReplace,
-                  reinterpret_cast<unsigned char*>(atom), fullscreen);
+  wm_utils::SetNetWmStateFullscreen(window, fullscreen);
 }
 
 void WindowManager::KillClient(Window window) {
@@ -706,52 +1157,43 @@ void WindowManager::KillClient(Window window) {
   }
 }
 
-inline void WindowManager::MapDocks() const {
-  for (const auto window : docks_) {
-    XMapWindow(dpy_, window);
-  }
-}
-
-inline void WindowManager::UnmapDocks() const {
-  for (const auto window : docks_) {
-    XUnmapWindow(dpy_, window);
-  }
+inline void WindowManager::MapDocks() {
+  registry_->ForEach(WindowRegistry::DOCK,
+                     [this](const WindowRegistry::Entry& e) { reconciler_.Map(e.window); });
 }
 
-inline void WindowManager::RaiseNotifications() const {
-  for (const auto window : notifications_) {
-    XRaiseWindow(dpy_, window);
-  }
+inline void WindowManager::UnmapDocks() {
+  registry_->ForEach(WindowRegistry::DOCK,
+                     [this](const WindowRegistry::Entry& e) { reconciler_.Unmap(e.window); });
 }
 
 pair<int, int> WindowManager::GetDisplayResolution() const {
-  XWindowAttributes root_window_attr = wm_utils::GetXWindowAttributes(root_window_);
-  return {root_window_attr.width, root_window_attr.height};
+  return display_resolution_;
 }
 
 Client::Area WindowManager::GetTilingArea() const {
   pair<int, int> res = GetDisplayResolution();
   Client::Area tiling_area = {0, 0, res.first, res.second};
 
-  for (const auto window : docks_) {
-    XWindowAttributes dock_attr = wm_utils::GetXWindowAttributes(window);
+  registry_->ForEach(WindowRegistry::DOCK, [&tiling_area](const WindowRegistry::Entry& e) {
+    const Client::Area& dock = e.area;
 
-    if (dock_attr.y == 0) {
+    if (dock.y == 0) {
       // If the dock is at the top of the screen.
-      tiling_area.y += dock_attr.height;
-      tiling_area.h -= dock_attr.height;
-    } else if (dock_attr.y + dock_attr.height == tiling_area.y + tiling_area.h) {
+      tiling_area.y += dock.h;
+      tiling_area.h -= dock.h;
+    } else if (dock.y + dock.h == tiling_area.y + tiling_area.h) {
       // If the dock is at the bottom of the screen.
-      tiling_area.h -= dock_attr.height;
-    } else if (dock_attr.x == 0) {
+      tiling_area.h -= dock.h;
+    } else if (dock.x == 0) {
       // If the dock is at the leftmost of the screen.
-      tiling_area.x += dock_attr.width;
-      tiling_area.w -= dock_attr.width;
-    } else if (dock_attr.x + dock_attr.width == tiling_area.x + tiling_area.w) {
+      tiling_area.x += dock.w;
+      tiling_area.w -= dock.w;
+    } else if (dock.x + dock.w == tiling_area.x + tiling_area.w) {
       // If the dock is at the rightmost of the screen.
-      tiling_area.w -= dock_attr.width;
+      tiling_area.w -= dock.w;
     }
-  }
+  });
 
   return tiling_area;
 }
@@ -759,8 +1201,8 @@ Client::Area WindowManager::GetTilingArea() const {
 Client::Area WindowManager::GetFloatingWindowArea(Window window, bool use_default_size) {
   Client::Area area;
 
-  auto it = Client::mapper_.find(window);
-  if (it == Client::mapper_.end()) {
+  Client* c = registry_->GetClient(window);
+  if (!c) {
     return area;
   }
 
@@ -786,9 +1228,9 @@ Client::Area WindowManager::GetFloatingWindowArea(Window window, bool use_defaul
     area.y = hints.y;
   } else {
     pair<int, int> res = GetDisplayResolution();
-    XWindowAttributes attr = wm_utils::GetXWindowAttributes(window);
-    area.x = res.first / 2 - attr.width / 2;
-    area.y = res.second / 2 - attr.height / 2;
+    const Client::Area& geometry = c->geometry();
+    area.x = res.first / 2 - geometry.w / 2;
+    area.y = res.second / 2 - geometry.h / 2;
   }
 
   // Determine floating window's w and h.
@@ -812,15 +1254,84 @@ Client::Area WindowManager::GetFloatingWindowArea(Window window, bool use_defaul
   return area;
 }
 
+// Cross-checks the geometry cache against the X server. This costs one
+// round trip per window, so it's only enabled with -DWITH_GEOMETRY_CHECK=ON.
+void WindowManager::CheckGeometryCache() const {
+  auto check = [](Window window, const Client::Area& cached) {
+    XWindowAttributes attr = wm_utils::GetXWindowAttributes(window);
+    Client::Area actual(attr.x, attr.y, attr.width, attr.height);
+    if (cached != actual) {
+      WM_LOG(WARNING, "stale geometry cache of " << window << ": (" << cached.x << ","
+                                                 << cached.y << "," << cached.w << ","
+                                                 << cached.h << "), actual: (" << actual.x
+                                                 << "," << actual.y << "," << actual.w << ","
+                                                 << actual.h << ")");
+    }
+  };
+
+  // Wait until all of our configure requests have been processed.
+  XSync(dpy_, false);
+
+  pair<int, int> res = GetDisplayResolution();
+  check(root_window_, Client::Area(0, 0, res.first, res.second));
+  registry_->ForEach(WindowRegistry::DOCK,
+                     [&check](const WindowRegistry::Entry& e) { check(e.window, e.area); });
+  registry_->ForEach(WindowRegistry::CLIENT, [&check](const WindowRegistry::Entry& e) {
+    if (!e.client->is_parked()) {
+      check(e.window, e.client->geometry());
+    }
+  });
+}
+
 void WindowManager::UpdateClientList() {
-  XDeleteProperty(dpy_, root_window_, prop_->net[atom::NET_CLIENT_LIST]);
+  ArenaVector<Window> windows;
+  windows.reserve(registry_->count(WindowRegistry::CLIENT));
+  for (const auto& workspace : workspaces_) {
+    for (const auto client : workspace.second->GetClients()) {
+      windows.push_back(client->window());
+    }
+  }
+
+  XChangeProperty(dpy_, root_window_, prop_->net[atom::NET_CLIENT_LIST], XA_WINDOW, 32,
+                  PropModeReplace, reinterpret_cast<unsigned char*>(windows.data()),
+                  windows.size());
+}
 
+// Writes the client tree of each workspace to TREES_FILE, one line per
+// workspace: its id followed by the tree in the text form (see
+// Tree::Serialize()). The buffer is kept for the next dump, so usually
+// nothing is allocated at all.
+void WindowManager::DumpTrees() {
+  ArenaVector<int> ids;
+  ids.reserve(workspaces_.size());
   for (const auto& workspace : workspaces_) {
-    for (const auto client : workspace->GetClients()) {
-      Window window = client->window();
-      XChangeProperty(dpy_, root_window_, prop_->net[atom::NET_CLIENT_LIST], XA_WINDOW, 32,
-                      PropModeAppend, reinterpret_cast<unsigned char*>(&window), 1);
+    ids.push_back(workspace.first);
+  }
+  std::sort(ids.begin(), ids.end());
+
+  tree_dump_.clear();
+  for (const auto id : ids) {
+    tree_dump_ += std::to_string(id);
+    tree_dump_ += ' ';
+
+    // Try whatever capacity is left first, and only grow if it's too small.
+    const Workspace* workspace = workspaces_[id].get();
+    size_t offset = tree_dump_.size();
+    tree_dump_.resize(tree_dump_.capacity());
+    size_t length = workspace->Serialize(&tree_dump_[offset], tree_dump_.size() - offset);
+    if (offset + length > tree_dump_.size()) {
+      tree_dump_.resize(offset + length);
+      workspace->Serialize(&tree_dump_[offset], length);
     }
+    tree_dump_.resize(offset + length);
+    tree_dump_ += '\n';
+  }
+
+  std::string filename = sys_utils::ToAbsPath(TREES_FILE);
+  std::ofstream fout(filename);
+  fout.write(tree_dump_.data(), tree_dump_.size());
+  if (!fout) {
+    WM_LOG(ERROR, "Failed to write " << filename);
   }
 }
 
@@ -828,4 +1339,16 @@ Snapshot& WindowManager::snapshot() {
   return snapshot_;
 }
 
+Journal& WindowManager::journal() {
+  return journal_;
+}
+
+Reconciler& WindowManager::reconciler() {
+  return reconciler_;
+}
+
+bool WindowManager::is_restarting() const {
+  return is_restarting_;
+}
+
 }  // namespace wmderland
@@ -7,17 +7,22 @@ extern "C" {
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 }
-#include <array>
 #include <memory>
-#include <unordered_set>
+#include <string>
+#include <unordered_map>
 
 #include "action.h"
 #include "config.h"
 #include "cookie.h"
+#include "event_loop.h"
 #include "ipc.h"
+#include "journal.h"
 #include "properties.h"
+#include "reconciler.h"
 #include "snapshot.h"
+#include "stats.h"
 #include "util.h"
+#include "window_registry.h"
 #include "workspace.h"
 
 namespace wmderland {
@@ -28,9 +33,13 @@ class WindowManager {
   virtual ~WindowManager();
 
   void Run();
-  void ArrangeWindows() const;
+  void Autostart();
+  void ArrangeWindows();
+  bool is_restarting() const;
 
   Snapshot& snapshot();
+  Journal& journal();
+  Reconciler& reconciler();
 
  private:
   static WindowManager* instance_;
@@ -42,19 +51,33 @@ class WindowManager {
   void InitCursors();
   void InitProperties();
   void InitWorkspaces();
+  void InitEventLoop();
+  void InitStats();
+  void ScheduleStatsTextfile();
+
+  // XEvent dispatching
+  void HandleXEvent(const XEvent& event);
+  void FlushArrangeRequests();
+  void ArrangeCurrentWorkspace();
+  void RestackWindows();
 
   // XEvent handlers
   void OnConfigureRequest(const XConfigureRequestEvent& e);
+  void OnConfigureNotify(const XConfigureEvent& e);
   void OnMapRequest(const XMapRequestEvent& e);
   void OnMapNotify(const XMapEvent& e);
   void OnUnmapNotify(const XUnmapEvent& e);
   void OnDestroyNotify(const XDestroyWindowEvent& e);
+  void OnPropertyNotify(const XPropertyEvent& e);
   void OnKeyPress(const XKeyEvent& e);
   void OnButtonPress(const XButtonEvent& e);
   void OnButtonRelease(const XButtonEvent& e);
   void OnMotionNotify(const XButtonEvent& e);
+  void FlushDragUpdate();
+  Client* GetDragTarget();
   void OnClientMessage(const XClientMessageEvent& e);
   void OnConfigReload();
+  void OnSigchld();
   static int OnXError(Display* dpy, XErrorEvent* e);
   static int OnWmDetected(Display* dpy, XErrorEvent* e);
 
@@ -63,7 +86,12 @@ class WindowManager {
   void HandleAction(const Action& action);
 
   // Workspace manipulation
+  Workspace* GetWorkspace(int id);
+  int GetWorkspaceId(const std::string& s);
+  void ReclaimWorkspace(int id);
+  void UpdateDesktops();
   void GotoWorkspace(int next);
+  void FinishWorkspaceSwitch();
   void MoveWindowToWorkspace(Window window, int next);
 
   // Client manipulation
@@ -72,17 +100,18 @@ class WindowManager {
   void KillClient(Window window);
 
   // Docks, bars and notifications
-  inline void MapDocks() const;
-  inline void UnmapDocks() const;
-  inline void RaiseNotifications() const;
+  inline void MapDocks();
+  inline void UnmapDocks();
 
   // Window position and size
   std::pair<int, int> GetDisplayResolution() const;
   Client::Area GetTilingArea() const;
   Client::Area GetFloatingWindowArea(Window window, bool use_default_size);
+  void CheckGeometryCache() const;
 
   // Misc
   void UpdateClientList();
+  void DumpTrees();
 
   Display* dpy_;
   Window root_window_;
@@ -94,28 +123,70 @@ class WindowManager {
   Cookie cookie_;                     // remembers pos/size of each window
   IpcEventManager ipc_evmgr_;         // client event manager
   Snapshot snapshot_;                 // error recovery
-
-  // The floating windows unordered_set contains windows that should not be
-  // tiled but must be kept on the top, e.g., dock, notifications, etc.
-  std::unordered_set<Window> docks_;
-  std::unordered_set<Window> notifications_;
-
+  Journal journal_;                   // crash recovery without saving on the way down
+  EventLoop event_loop_;              // X connection, timers, signals and fds
+  Stats stats_;                       // latency histograms and counters
+  EventLoop::TimerId stats_timer_;    // periodically writes the stats textfile
+  Reconciler reconciler_;             // sends only the changes to the X server
+  std::string tree_dump_;             // reused by DumpTrees()
+
+  // All the windows we know about: clients, and the windows that should not
+  // be tiled but must be kept on the top, e.g., docks, notifications, etc.
+  // The geometry of each dock is cached in its registry entry, and the
+  // geometry of the root window in display_resolution_ (see
+  // OnConfigureNotify()).
+  //
   // Some programs (e.g., WPS office, Steam) might unmap its window(s)
   // but keep them in the background instead of destroying them. It is
   // up to the programs (i.e., owner of the windows) when to reuse them,
-  // so we should not simply destroy these windows! We should store them
-  // somewhere instead.
-  std::unordered_set<Window> hidden_windows_;
+  // so we should not simply destroy these windows! They are kept in the
+  // registry as WindowRegistry::HIDDEN instead.
+  WindowRegistry* registry_;
+  std::pair<int, int> display_resolution_;
 
   // Workspaces contain clients, where a client is a window that can be tiled
-  // by the window manager.
-  std::array<std::unique_ptr<Workspace>, WORKSPACE_COUNT> workspaces_;
+  // by the window manager. A workspace is created on first use, and
+  // reclaimed once it's empty and not the current one, so only the
+  // workspaces with clients in them (and the current one) are kept.
+  std::unordered_map<int, std::unique_ptr<Workspace>> workspaces_;
   int current_;  // current workspace
+  bool is_restarting_;  // Run() has returned for the restart action
 
   // Window move, resize event cache.
   XButtonEvent btn_pressed_event_;
 
+  // Floating window move/resize state. The new geometry is always derived
+  // from the geometry at the time the drag started plus the pointer deltas.
+  struct DragState {
+    WindowRegistry::Handle target;  // the window being moved/resized
+    Client::Area origin;    // window geometry when the drag started
+    Client::Area geometry;  // latest geometry computed from pointer motion
+    Time last_update_time;  // server time of the last geometry update sent
+    bool has_pending_update;
+    EventLoop::TimerId update_timer;  // flushes the pending update if no motion follows
+  } drag_;
+
+  // The workspace switch in progress, see WindowManager::GotoWorkspace().
+  struct SwitchState {
+    Stats::Clock::time_point start;
+    unsigned long fence_serial;  // the request which marks the end of the switch
+    bool is_parking;             // parking the clients instead of unmapping them
+    bool is_pending;             // its requests haven't been sent yet
+    bool is_measuring;           // waiting for the fence to come back
+  } switch_;
+
+  // Statistics of the batched event dispatching in WindowManager::Run().
+  // The number of skipped arrangements is arrange_requests - arranges.
+  struct EventStats {
+    unsigned long batches;
+    unsigned long events;
+    unsigned long arrange_requests;
+    unsigned long arranges;
+  } event_stats_;
+
+  friend class Cookie;
   friend class IpcEventManager;
+  friend class Journal;
   friend class Snapshot;
 };
 
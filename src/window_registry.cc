@@ -0,0 +1,188 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#include "window_registry.h"
+
+namespace wmderland {
+
+const uint32_t WindowRegistry::kNoSlot_ = UINT32_MAX;
+
+WindowRegistry* WindowRegistry::GetInstance() {
+  static WindowRegistry registry;
+  return &registry;
+}
+
+WindowRegistry::WindowRegistry()
+    : slots_(),
+      free_list_(kNoSlot_),
+      role_counts_(),
+      index_(kInitialIndexSize_, Bucket{None, kNoSlot_}),
+      index_shift_(64 - 6),
+      size_() {}
+
+WindowRegistry::Entry* WindowRegistry::Find(Window window) {
+  const Bucket& bucket = index_[Probe(window)];
+  return (bucket.window != None) ? &slots_[bucket.slot].entry : nullptr;
+}
+
+const WindowRegistry::Entry* WindowRegistry::Find(Window window) const {
+  const Bucket& bucket = index_[Probe(window)];
+  return (bucket.window != None) ? &slots_[bucket.slot].entry : nullptr;
+}
+
+Client* WindowRegistry::GetClient(Window window) const {
+  const Entry* entry = Find(window);
+  return (entry) ? entry->client : nullptr;
+}
+
+bool WindowRegistry::HasRole(Window window, Role role) const {
+  const Entry* entry = Find(window);
+  return entry && (entry->roles & role);
+}
+
+WindowRegistry::Entry& WindowRegistry::AddRole(Window window, Role role) {
+  Entry* entry = Find(window);
+  if (entry) {
+    CountRoles(role & ~entry->roles, 1);
+    entry->roles |= role;
+    return *entry;
+  }
+
+  uint32_t slot = free_list_;
+  if (slot != kNoSlot_) {
+    free_list_ = slots_[slot].next_free;
+  } else {
+    slot = slots_.size();
+    slots_.push_back(Slot{Entry(), 0, kNoSlot_});
+  }
+
+  slots_[slot].entry.window = window;
+  slots_[slot].entry.roles = role;
+  CountRoles(role, 1);
+  Insert(window, slot);
+  return slots_[slot].entry;
+}
+
+void WindowRegistry::RemoveRole(Window window, Role role) {
+  size_t bucket = Probe(window);
+  if (index_[bucket].window == None) {
+    return;
+  }
+
+  uint32_t slot = index_[bucket].slot;
+  Entry& entry = slots_[slot].entry;
+  CountRoles(entry.roles & role, -1);
+  entry.roles &= ~role;
+  if (role == CLIENT) {
+    entry.client = nullptr;
+    entry.node = Tree::kNull_;
+  }
+
+  if (!entry.roles) {
+    Erase(bucket);
+    entry = Entry();
+    slots_[slot].generation++;
+    slots_[slot].next_free = free_list_;
+    free_list_ = slot;
+  }
+}
+
+WindowRegistry::Handle WindowRegistry::GetHandle(Window window) const {
+  Handle handle;
+  const Bucket& bucket = index_[Probe(window)];
+  if (bucket.window != None) {
+    handle.slot = bucket.slot;
+    handle.generation = slots_[bucket.slot].generation;
+  }
+  return handle;
+}
+
+WindowRegistry::Entry* WindowRegistry::Get(Handle handle) {
+  if (handle.slot >= slots_.size() || slots_[handle.slot].generation != handle.generation ||
+      !slots_[handle.slot].entry.roles) {
+    return nullptr;
+  }
+  return &slots_[handle.slot].entry;
+}
+
+size_t WindowRegistry::count(Role role) const {
+  for (size_t i = 0; i < kRoleCount_; i++) {
+    if (role == (1u << i)) {
+      return role_counts_[i];
+    }
+  }
+  return 0;
+}
+
+// Adds delta to the count of each of the given roles.
+void WindowRegistry::CountRoles(unsigned roles, int delta) {
+  for (size_t i = 0; i < kRoleCount_; i++) {
+    if (roles & (1u << i)) {
+      role_counts_[i] += delta;
+    }
+  }
+}
+
+// Fibonacci hashing, which spreads the sequential window ids
+// (as allocated by the X server) evenly across the index.
+size_t WindowRegistry::Hash(Window window) const {
+  return (static_cast<uint64_t>(window) * 11400714819323198485ull) >> index_shift_;
+}
+
+// Returns the bucket which holds the given window, or the empty bucket
+// where it would be inserted.
+size_t WindowRegistry::Probe(Window window) const {
+  size_t mask = index_.size() - 1;
+  size_t i = Hash(window);
+  while (index_[i].window != None && index_[i].window != window) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+void WindowRegistry::Insert(Window window, uint32_t slot) {
+  if ((size_ + 1) * 2 > index_.size()) {
+    Grow();
+  }
+  index_[Probe(window)] = {window, slot};
+  size_++;
+}
+
+// Backward shift deletion: the buckets following the erased one are moved
+// back to fill the hole, so that no tombstones are needed.
+void WindowRegistry::Erase(size_t bucket) {
+  size_t mask = index_.size() - 1;
+  size_t hole = bucket;
+
+  for (size_t i = (hole + 1) & mask; index_[i].window != None; i = (i + 1) & mask) {
+    // The distance from a bucket's home (the bucket it hashes to) to where it
+    // actually is. It may fill the hole only if its home isn't after the hole.
+    size_t home = Hash(index_[i].window);
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      index_[hole] = index_[i];
+      hole = i;
+    }
+  }
+
+  index_[hole] = {None, kNoSlot_};
+  size_--;
+}
+
+void WindowRegistry::Grow() {
+  std::vector<Bucket> old_index(index_.size() * 2, Bucket{None, kNoSlot_});
+  old_index.swap(index_);
+  index_shift_--;
+  size_ = 0;
+
+  for (const auto& bucket : old_index) {
+    if (bucket.window != None) {
+      index_[Probe(bucket.window)] = bucket;
+      size_++;
+    }
+  }
+}
+
+WindowRegistry::Entry::Entry()
+    : window(None), roles(), client(), node(Tree::kNull_), area() {}
+
+WindowRegistry::Handle::Handle() : slot(kNoSlot_), generation() {}
+
+}  // namespace wmderland
@@ -0,0 +1,129 @@
+// Copyright (c) 2018-2019 Marco Wang <m.aesophor@gmail.com>
+#ifndef WMDERLAND_WINDOW_REGISTRY_H_
+#define WMDERLAND_WINDOW_REGISTRY_H_
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "client.h"
+#include "tree.h"
+
+namespace wmderland {
+
+// The WindowRegistry keeps track of every window the WM cares about, and
+// what role(s) each of them plays. The entries live in a slot map (a dense
+// array whose free slots are recycled), and are looked up by Window through
+// a flat open addressing index, so a lookup is a single probe most of the
+// time and never chases a pointer out of these two arrays.
+class WindowRegistry {
+ public:
+  // A window may play more than one role at a time, e.g., a client which
+  // unmaps itself is HIDDEN but remains a CLIENT until it is unmanaged.
+  enum Role : unsigned {
+    CLIENT = 1 << 0,
+    DOCK = 1 << 1,
+    NOTIFICATION = 1 << 2,
+    HIDDEN = 1 << 3,
+  };
+
+  struct Entry {
+    Entry();
+
+    Window window;
+    unsigned roles;
+    Client* client;      // CLIENT: the client object
+    Tree::NodeId node;   // CLIENT: its node in its workspace's client tree
+    Client::Area area;   // DOCK: the geometry of the dock
+  };
+
+  // Unlike Window or Entry*, a Handle can be held across events. Once its
+  // window leaves the registry, the slot's generation is bumped, so the
+  // handle goes stale even if the slot or the window id gets reused.
+  struct Handle {
+    Handle();
+
+    uint32_t slot;
+    uint32_t generation;
+  };
+
+  static WindowRegistry* GetInstance();
+
+  WindowRegistry();
+  virtual ~WindowRegistry() = default;
+
+  Entry* Find(Window window);
+  const Entry* Find(Window window) const;
+  Client* GetClient(Window window) const;
+  bool HasRole(Window window, Role role) const;
+
+  // Adding a role to an unknown window registers it, and removing the last
+  // role of a window unregisters it.
+  Entry& AddRole(Window window, Role role);
+  void RemoveRole(Window window, Role role);
+
+  Handle GetHandle(Window window) const;
+  Entry* Get(Handle handle);
+
+  // Calls f(Entry&) for each window which plays the given role. The
+  // registry must not be modified in f.
+  template <typename Function>
+  void ForEach(Role role, Function f) {
+    for (auto& slot : slots_) {
+      if (slot.entry.roles & role) {
+        f(slot.entry);
+      }
+    }
+  }
+
+  template <typename Function>
+  void ForEach(Role role, Function f) const {
+    for (const auto& slot : slots_) {
+      if (slot.entry.roles & role) {
+        f(slot.entry);
+      }
+    }
+  }
+
+  size_t count(Role role) const;  // O(1), of a single role
+
+ private:
+  static const uint32_t kNoSlot_;
+  static const size_t kRoleCount_ = 4;
+  static const size_t kInitialIndexSize_ = 64;  // must be a power of 2
+
+  struct Slot {
+    Entry entry;  // entry.roles is 0 iff this slot is free
+    uint32_t generation;
+    uint32_t next_free;
+  };
+
+  // An empty bucket has its window set to None.
+  struct Bucket {
+    Window window;
+    uint32_t slot;
+  };
+
+  size_t Hash(Window window) const;
+  size_t Probe(Window window) const;
+  void Insert(Window window, uint32_t slot);
+  void Erase(size_t bucket);
+  void Grow();
+  void CountRoles(unsigned roles, int delta);
+
+  std::vector<Slot> slots_;
+  uint32_t free_list_;
+  std::array<size_t, kRoleCount_> role_counts_;  // the windows playing each role
+
+  // Linear probing, kept at most half full.
+  std::vector<Bucket> index_;
+  size_t index_shift_;
+  size_t size_;
+};
+
+}  // namespace wmderland
+
+#endif  // WMDERLAND_WINDOW_REGISTRY_H_
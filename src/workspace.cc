@@ -7,11 +7,11 @@
 #include "client.h"
 #include "util.h"
 #include "window_manager.h"
+#include "window_registry.h"
 
 using std::stack;
 using std::string;
 using std::unique_ptr;
-using std::vector;
 
 namespace wmderland {
 
@@ -22,9 +22,15 @@ Workspace::Workspace(Display* dpy, Window root_window, Config* config, int id)
       root_window_(root_window),
       config_(config),
       client_tree_(),
+      navigation_index_(),
+      layout_(Layout::Create(Layout::Type::SPLIT)),
       id_(id),
       name_(std::to_string(id)),
-      is_fullscreen_() {}
+      is_fullscreen_(),
+      is_layout_dirty_(),
+      focus_count_(),
+      tiled_border_width_(-1),
+      tiled_gap_width_(-1) {}
 
 bool Workspace::Has(Window window) const {
   return GetClient(window) != nullptr;
@@ -32,21 +38,20 @@ bool Workspace::Has(Window window) const {
 
 void Workspace::Add(Window window) {
   unique_ptr<Client> client = std::make_unique<Client>(dpy_, window, this);
-  unique_ptr<Tree::Node> new_node = std::make_unique<Tree::Node>(std::move(client));
-
-  Tree::Node* new_node_raw = new_node.get();
+  navigation_index_.Update(window, client->geometry());
+  Tree::NodeId new_node = client_tree_.CreateNode(std::move(client));
 
   // If there are no windows at all, then add this new node as the root's child.
   // Otherwise, add this new node as current node's sibling.
-  if (!client_tree_.current_node()) {
-    client_tree_.root_node()->AddChild(std::move(new_node));
+  Tree::NodeId current_node = client_tree_.current_node();
+  if (current_node == Tree::kNull_) {
+    client_tree_.AddChild(client_tree_.root_node(), new_node);
   } else {
-    Tree::Node* current_node = client_tree_.current_node();
-    current_node->parent()->InsertChildAfter(std::move(new_node), current_node);
+    client_tree_.InsertChildAfter(client_tree_.parent(current_node), new_node, current_node);
   }
 
   if (!is_fullscreen_) {
-    client_tree_.set_current_node(new_node_raw);
+    client_tree_.set_current_node(new_node);
   }
 }
 
@@ -56,41 +61,33 @@ void Workspace::Remove(Window window) {
     return;
   }
 
-  Tree::Node* node = client_tree_.GetTreeNode(c);
-  if (!node) {
+  Tree::NodeId node = client_tree_.GetTreeNode(c);
+  if (node == Tree::kNull_) {
     return;
   }
-
-  // Get leaves and find the index of the node we're going to remove.
-  vector<Tree::Node*> nodes = client_tree_.GetLeaves();
-  ptrdiff_t idx = find(nodes.begin(), nodes.end(), node) - nodes.begin();
+  navigation_index_.Remove(window);
+
+  // The leaf next to this node shall be the new current node, or the one
+  // before it if this node is the rightmost leaf. If there are no windows
+  // left, current node will be Tree::kNull_.
+  Tree::NodeId new_current_node = client_tree_.next_leaf(node);
+  if (new_current_node == Tree::kNull_) {
+    new_current_node = client_tree_.prev_leaf(node);
+  }
 
   // Remove this node from its parent.
-  Tree::Node* parent_node = node->parent();
-  parent_node->RemoveChild(node);
+  Tree::NodeId parent_node = client_tree_.parent(node);
+  client_tree_.RemoveChild(parent_node, node);
 
   // If its parent has no children left, then remove parent from its grandparent
   // (If this parent is not the root).
-  while (parent_node->children().empty() && parent_node != client_tree_.root_node()) {
-    Tree::Node* grandparent_node = parent_node->parent();
-    grandparent_node->RemoveChild(parent_node);
+  while (client_tree_.leaf(parent_node) && parent_node != client_tree_.root_node()) {
+    Tree::NodeId grandparent_node = client_tree_.parent(parent_node);
+    client_tree_.RemoveChild(grandparent_node, parent_node);
     parent_node = grandparent_node;
   }
 
-  // Decide which node shall be set as the new current Tree::Node. If there are
-  // no windows left, set current to nullptr.
-  nodes.erase(std::remove(nodes.begin(), nodes.end(), node), nodes.end());
-
-  if (nodes.empty()) {
-    client_tree_.set_current_node(nullptr);
-    return;
-  }
-
-  // If idx is out of bound, decrement it by one.
-  if (idx >= static_cast<ptrdiff_t>(nodes.size())) {
-    idx--;
-  }
-  client_tree_.set_current_node(nodes[idx]);
+  client_tree_.set_current_node(new_current_node);
 }
 
 void Workspace::Move(Window window, Workspace* new_workspace) {
@@ -100,123 +97,127 @@ void Workspace::Move(Window window, Workspace* new_workspace) {
   }
 
   bool is_floating = c->is_floating();
+  bool is_parked = c->is_parked();
   bool has_unmap_req_from_wm = c->has_unmap_req_from_wm();
 
-  // This will delete current Client* c, and erase it from Client::mapper_
+  // This will delete current Client* c, and unregister it
   this->Remove(window);
 
-  // This will allocate a new Client* c', and insert it into Client::mapper_
+  // This will allocate a new Client* c', and register it
   new_workspace->Add(window);
 
   // Transfer old client's state to the new client.
   c = new_workspace->GetClient(window);
   c->set_floating(is_floating);
   c->set_fullscreen(false);
+  c->set_parked(is_parked);
   c->set_has_unmap_req_from_wm(has_unmap_req_from_wm);
 }
 
-void Workspace::Tile(const Client::Area& tiling_area) const {
+// The layout computes the geometry of every tiling client (the split layout
+// only of the subtrees which have changed), and only the clients whose
+// geometry differs from what we've requested last time are
+// moved/resized. Unless the border width or gap width has changed, in which
+// case every client will be moved/resized.
+void Workspace::Tile(const Client::Area& tiling_area) {
   // If there are no clients in this workspace or all clients are floating,
   // return at once.
-  if (!client_tree_.current_node() || GetTilingClients().empty()) {
+  Tree::NodeId root_node = client_tree_.root_node();
+  if (client_tree_.current_node() == Tree::kNull_ || !client_tree_.tiling_count(root_node)) {
     return;
   }
 
   int border_width = config_->border_width();
   int gap_width = config_->gap_width();
 
+  bool force = border_width != tiled_border_width_ || gap_width != tiled_gap_width_;
+  tiled_border_width_ = border_width;
+  tiled_gap_width_ = gap_width;
+  if (force) {
+    client_tree_.MarkAllDirty();
+  }
+
+  // If nothing in the tree has changed since last time, neither has the plan.
+  if (!client_tree_.dirty(root_node) && client_tree_.tile_area(root_node) == tiling_area) {
+    return;
+  }
+
   int x = tiling_area.x + gap_width / 2;
   int y = tiling_area.y + gap_width / 2;
   int w = tiling_area.w - gap_width;
   int h = tiling_area.h - gap_width;
 
-  DfsTileHelper(client_tree_.root_node(), x, y, w, h, border_width, gap_width);
-}
-
-void Workspace::DfsTileHelper(Tree::Node* node, int x, int y, int w, int h, int border_width,
-                              int gap_width) const {
-  vector<Tree::Node*> children = node->children();
-
-  // We don't care about two kinds of `Tree::Node`s
-  // 1. an internal node with no tiling clients in its subtree
-  // 2. a leaf but it has a floating client
-  // Tree::Node::HasTilingClientsInSubtree() can check 1 and 2 at the same time.
-  children.erase(std::remove_if(children.begin(), children.end(),
-                                [](Tree::Node* n) { return !n->HasTilingClientsInSubtree(); }),
-                 children.end());
-
-  if (children.empty()) {
-    return;
+  Layout::Plan plan = layout_->Compute(client_tree_, {x, y, w, h}, border_width, gap_width);
+  for (const auto& placement : plan) {
+    Client* c = client_tree_.client(placement.node);
+    const Client::Area& area = placement.area;
+    if (c && (force || c->geometry() != area)) {
+      c->MoveResize(area.x, area.y, area.w, area.h);
+    }
   }
 
-  // Calculate each child's x, y, width and height based on node's tiling
-  // direction.
-  TilingDirection dir = node->tiling_direction();
-  int child_x = x;
-  int child_y = y;
-  int child_width = (dir == TilingDirection::HORIZONTAL) ? w / children.size() : w;
-  int child_height = (dir == TilingDirection::VERTICAL) ? h / children.size() : h;
-
-  for (size_t i = 0; i < children.size(); i++) {
-    Tree::Node* child = children[i];
-    if (node->tiling_direction() == TilingDirection::HORIZONTAL) child_x = x + child_width * i;
-    if (node->tiling_direction() == TilingDirection::VERTICAL) child_y = y + child_height * i;
-
-    if (child->leaf()) {
-      int new_x = child_x + gap_width / 2;
-      int new_y = child_y + gap_width / 2;
-      int new_width = child_width - border_width * 2 - gap_width;
-      int new_height = child_height - border_width * 2 - gap_width;
-      child->client()->MoveResize(new_x, new_y, new_width, new_height);
-    } else {
-      DfsTileHelper(child, child_x, child_y, child_width, child_height, border_width,
-                    gap_width);
-    }
+  // Moving/resizing the clients above has marked the tree dirty again.
+  // Every dirty node is clean now, and the ones the layout has placed
+  // remember their area, so they can be skipped next time.
+  client_tree_.MarkSubtreeClean(root_node);
+  for (const auto& placement : plan) {
+    client_tree_.MarkClean(placement.node, placement.area);
   }
+  client_tree_.MarkClean(root_node, tiling_area);
 }
 
 void Workspace::SetTilingDirection(TilingDirection tiling_direction) {
-  if (!client_tree_.current_node()) {
-    client_tree_.root_node()->set_tiling_direction(tiling_direction);
+  Tree::NodeId current_node = client_tree_.current_node();
+  if (current_node == Tree::kNull_) {
+    client_tree_.set_tiling_direction(client_tree_.root_node(), tiling_direction);
     return;
   }
 
-  Tree::Node* current_node = client_tree_.current_node();
-
   // If current node has no siblings, we can simply set the new
   // tiling direction on its parent and return.
-  if (current_node->parent()->children().size() == 1) {
-    current_node->parent()->set_tiling_direction(tiling_direction);
+  Tree::NodeId parent_node = client_tree_.parent(current_node);
+  if (client_tree_.child_count(parent_node) == 1) {
+    client_tree_.set_tiling_direction(parent_node, tiling_direction);
     return;
   }
 
-  unique_ptr<Client> client(current_node->release_client());
-  unique_ptr<Tree::Node> new_node = std::make_unique<Tree::Node>(std::move(client));
+  unique_ptr<Client> client(client_tree_.release_client(current_node));
+  Tree::NodeId new_node = client_tree_.CreateNode(std::move(client));
 
   // If the user has specified a tiling direction on current node, then
   // 1. Let current node become an internal node.
   // 2. Add the original current node as this internal node's child.
   // 3. Set the first child of this internal node as the new current node.
-  current_node->set_tiling_direction(tiling_direction);
-  current_node->AddChild(std::move(new_node));
-  client_tree_.set_current_node(current_node->children().front());
+  client_tree_.set_tiling_direction(current_node, tiling_direction);
+  client_tree_.AddChild(current_node, new_node);
+  client_tree_.set_current_node(client_tree_.first_child(current_node));
 }
 
 void Workspace::MapAllClients() const {
-  for (const auto c : GetClients()) {
-    c->Map();
+  for (const auto leaf : client_tree_.leaves()) {
+    Client* c = client_tree_.client(leaf);
+    if (c) {
+      c->Unpark();
+      c->Map();
+    }
   }
 }
 
 void Workspace::UnmapAllClients() const {
-  for (const auto c : GetClients()) {
-    c->Unmap();
+  for (const auto leaf : client_tree_.leaves()) {
+    Client* c = client_tree_.client(leaf);
+    if (c) {
+      c->Unmap();
+    }
   }
 }
 
-void Workspace::RaiseAllFloatingClients() const {
-  for (const auto c : GetFloatingClients()) {
-    c->Raise();
+void Workspace::ParkAllClients() const {
+  for (const auto leaf : client_tree_.leaves()) {
+    Client* c = client_tree_.client(leaf);
+    if (c) {
+      c->Park();
+    }
   }
 }
 
@@ -226,120 +227,166 @@ void Workspace::SetFocusedClient(Window window) {
     return;
   }
 
-  // Raise the window to the top and set input focus to it.
-  c->Raise();
+  // The window will be put on the top of its kind (see GetStackingOrder()),
+  // and input focus is set to it.
+  c->set_focus_order(++focus_count_);
   c->SetInputFocus();
   c->SetBorderColor(config_->focused_color());
   client_tree_.set_current_node(client_tree_.GetTreeNode(c));
 }
 
 void Workspace::UnsetFocusedClient() const {
-  if (!client_tree_.current_node()) {
+  if (client_tree_.current_node() == Tree::kNull_) {
     return;
   }
 
-  Client* c = client_tree_.current_node()->client();
+  Client* c = client_tree_.client(client_tree_.current_node());
   if (c) {
     c->SetBorderColor(config_->unfocused_color());
   }
 }
 
 Client* Workspace::GetFocusedClient() const {
-  if (!client_tree_.current_node()) {
+  if (client_tree_.current_node() == Tree::kNull_) {
     return nullptr;
   }
-  return client_tree_.current_node()->client();
+  return client_tree_.client(client_tree_.current_node());
 }
 
 Client* Workspace::GetClient(Window window) const {
-  // We'll get the corresponding client using client mapper
+  // We'll get the corresponding client from the window registry
   // whose time complexity is O(1).
-  auto it = Client::mapper_.find(window);
-  if (it == Client::mapper_.end()) {
-    return nullptr;
-  }
+  Client* c = WindowRegistry::GetInstance()->GetClient(window);
 
   // But we have to check if it belongs to current workspace!
-  Client* c = it->second;
-  return (c->workspace() == this) ? c : nullptr;
+  return (c && c->workspace() == this) ? c : nullptr;
 }
 
-vector<Client*> Workspace::GetClients() const {
-  vector<Client*> clients;
+ArenaVector<Client*> Workspace::GetClients() const {
+  ArenaVector<Client*> clients;
 
-  for (auto leaf : client_tree_.GetLeaves()) {
-    if (leaf != client_tree_.root_node()) {
-      clients.push_back(leaf->client());
+  for (const auto leaf : client_tree_.leaves()) {
+    Client* c = client_tree_.client(leaf);
+    if (c) {
+      clients.push_back(c);
     }
   }
   return clients;
 }
 
-vector<Client*> Workspace::GetFloatingClients() const {
-  vector<Client*> clients = GetClients();
+ArenaVector<Client*> Workspace::GetFloatingClients() const {
+  ArenaVector<Client*> clients = GetClients();
   clients.erase(std::remove_if(clients.begin(), clients.end(),
                                [](Client* c) { return !c->is_floating(); }),
                 clients.end());
   return clients;
 }
 
-vector<Client*> Workspace::GetTilingClients() const {
-  vector<Client*> clients = GetClients();
+ArenaVector<Client*> Workspace::GetTilingClients() const {
+  ArenaVector<Client*> clients = GetClients();
   clients.erase(std::remove_if(clients.begin(), clients.end(),
                                [](Client* c) { return c->is_floating(); }),
                 clients.end());
   return clients;
 }
 
+// Returns the clients from bottom to top: the tiling clients (the focused
+// one on the top of them), then the floating clients from the least
+// recently focused one to the most recently focused one, and then the
+// fullscreen client.
+ArenaVector<Client*> Workspace::GetStackingOrder() const {
+  ArenaVector<Client*> clients = GetClients();
+  Client* focused_client = GetFocusedClient();
+
+  auto layer = [focused_client](const Client* c) {
+    if (c->is_fullscreen()) {
+      return 3;
+    } else if (c->is_floating()) {
+      return 2;
+    } else {
+      return (c == focused_client) ? 1 : 0;
+    }
+  };
+
+  std::stable_sort(clients.begin(), clients.end(), [&layer](const Client* a, const Client* b) {
+    int layer_a = layer(a);
+    int layer_b = layer(b);
+    if (layer_a != layer_b) {
+      return layer_a < layer_b;
+    }
+    return layer_a == 2 && a->focus_order() < b->focus_order();
+  });
+  return clients;
+}
+
 void Workspace::Navigate(Action::Type focus_action_type) {
   // Do not let user navigate between windows if
   // 1. there's no currently focused client
   // 2. current workspace is in fullscreen mode (there's a fullscreen window)
-  if (!client_tree_.current_node() || this->is_fullscreen()) {
+  if (client_tree_.current_node() == Tree::kNull_ || this->is_fullscreen()) {
     return;
   }
 
-  TilingDirection target_direction = TilingDirection::HORIZONTAL;
-  bool find_leftward = true;
+  NavigationIndex::Direction direction;
 
   switch (focus_action_type) {
     case Action::Type::NAVIGATE_LEFT:
-      target_direction = TilingDirection::HORIZONTAL;
-      find_leftward = true;
+      direction = NavigationIndex::Direction::LEFT;
       break;
     case Action::Type::NAVIGATE_RIGHT:
-      target_direction = TilingDirection::HORIZONTAL;
-      find_leftward = false;
+      direction = NavigationIndex::Direction::RIGHT;
       break;
     case Action::Type::NAVIGATE_UP:
-      target_direction = TilingDirection::VERTICAL;
-      find_leftward = true;
+      direction = NavigationIndex::Direction::UP;
       break;
     case Action::Type::NAVIGATE_DOWN:
-      target_direction = TilingDirection::VERTICAL;
-      find_leftward = false;
+      direction = NavigationIndex::Direction::DOWN;
       break;
     default:
       return;
   }
 
-  for (Tree::Node* node = client_tree_.current_node(); node; node = node->parent()) {
-    Tree::Node* sibling = (find_leftward) ? node->GetLeftSibling() : node->GetRightSibling();
+  // The target is decided by where the windows actually are on the screen
+  // (floating windows included), rather than by the shape of the tree.
+  // Except in the monocle layout, where the tiling clients are all on top
+  // of each other, so they are cycled through from left to right instead.
+  Client* c = client_tree_.client(client_tree_.current_node());
+  Window target = None;
+  if (layout_->type() == Layout::Type::MONOCLE && !c->is_floating()) {
+    bool forward = direction == NavigationIndex::Direction::RIGHT ||
+                   direction == NavigationIndex::Direction::DOWN;
+    target = GetAdjacentTilingClient(client_tree_.current_node(), forward);
+  } else {
+    target = navigation_index_.FindNearest(c->window(), direction);
+  }
+  if (target == None) {
+    return;
+  }
 
-    if (node->parent()->tiling_direction() == target_direction && sibling) {
-      node = sibling;
-      while (!node->leaf()) {
-        node = (find_leftward) ? node->children().back() : node->children().front();
-      }
-      UnsetFocusedClient();
-      SetFocusedClient(node->client()->window());
-      client_tree_.set_current_node(node);
-      WindowManager::GetInstance()->ArrangeWindows();
-      return;
-    } else if (node->parent() == client_tree_.root_node()) {
-      return;
+  UnsetFocusedClient();
+  SetFocusedClient(target);
+  WindowManager::GetInstance()->ArrangeWindows();
+}
+
+// Returns the tiling client next to (or before) the one at `node` in tree
+// order, wrapping around at either end, or None if it's the only one.
+Window Workspace::GetAdjacentTilingClient(Tree::NodeId node, bool forward) const {
+  Tree::NodeId root_node = client_tree_.root_node();
+  Tree::NodeId adjacent = node;
+
+  do {
+    adjacent = (forward) ? client_tree_.next_leaf(adjacent) : client_tree_.prev_leaf(adjacent);
+    if (adjacent == Tree::kNull_) {
+      adjacent = (forward) ? client_tree_.GetFirstLeaf(root_node)
+                           : client_tree_.GetLastLeaf(root_node);
     }
-  }
+    Client* c = client_tree_.client(adjacent);
+    if (c && !c->is_floating()) {
+      return (adjacent != node) ? c->window() : None;
+    }
+  } while (adjacent != node);
+
+  return None;
 }
 
 Config* Workspace::config() const {
@@ -358,6 +405,18 @@ bool Workspace::is_fullscreen() const {
   return is_fullscreen_;
 }
 
+bool Workspace::is_empty() const {
+  return !client_tree_.client_count(client_tree_.root_node());
+}
+
+Layout::Type Workspace::layout() const {
+  return layout_->type();
+}
+
+bool Workspace::is_layout_dirty() const {
+  return is_layout_dirty_;
+}
+
 void Workspace::set_name(const string& name) {
   name_ = name;
 }
@@ -366,12 +425,76 @@ void Workspace::set_fullscreen(bool fullscreen) {
   is_fullscreen_ = fullscreen;
 }
 
+void Workspace::set_layout(Layout::Type type) {
+  if (type == Layout::Type::UNDEFINED || type == layout_->type()) {
+    return;
+  }
+
+  layout_ = Layout::Create(type);
+  client_tree_.MarkAllDirty();
+}
+
+void Workspace::set_layout_dirty(bool layout_dirty) {
+  is_layout_dirty_ = layout_dirty;
+}
+
+// Called by a client in this workspace when it has changed in a way
+// which affects the layout, see Workspace::Tile().
+void Workspace::MarkDirty(Client* c) {
+  Tree::NodeId node = client_tree_.GetTreeNode(c);
+  if (node != Tree::kNull_) {
+    client_tree_.MarkDirty(node);
+  }
+}
+
+// Called by a client in this workspace when it has started or stopped
+// floating. This also marks its node dirty.
+void Workspace::UpdateClientCounts(Client* c) {
+  Tree::NodeId node = client_tree_.GetTreeNode(c);
+  if (node != Tree::kNull_) {
+    client_tree_.UpdateClientCounts(node);
+  }
+}
+
+// Called by a client in this workspace when it has been moved or resized.
+void Workspace::UpdateNavigationIndex(Client* c) {
+  navigation_index_.Update(c->window(), c->geometry());
+}
+
 string Workspace::Serialize() const {
   return client_tree_.Serialize();
 }
 
-void Workspace::Deserialize(string data) {
-  client_tree_.Deserialize(data);
+size_t Workspace::Serialize(char* buf, size_t size) const {
+  return client_tree_.Serialize(buf, size);
+}
+
+bool Workspace::Deserialize(const string& data, Tree::TextError* error) {
+  if (!client_tree_.Deserialize(data, error)) {
+    return false;
+  }
+
+  navigation_index_.Clear();
+  for (const auto c : GetClients()) {
+    navigation_index_.Update(c->window(), c->geometry());
+  }
+  return true;
+}
+
+void Workspace::Serialize(std::vector<Tree::Record>& records) const {
+  client_tree_.Serialize(records);
+}
+
+bool Workspace::Deserialize(const Tree::Record* records, size_t count, Window current_window) {
+  if (!client_tree_.Deserialize(records, count, current_window)) {
+    return false;
+  }
+
+  navigation_index_.Clear();
+  for (const auto c : GetClients()) {
+    navigation_index_.Update(c->window(), c->geometry());
+  }
+  return true;
 }
 
 }  // namespace wmderland
@@ -5,11 +5,15 @@
 extern "C" {
 #include <X11/Xlib.h>
 }
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "arena.h"
 #include "client.h"
 #include "config.h"
+#include "layout.h"
+#include "navigation_index.h"
 #include "tree.h"
 
 namespace wmderland {
@@ -23,45 +27,64 @@ class Workspace {
   void Add(Window window);
   void Remove(Window window);
   void Move(Window window, Workspace* new_workspace);
-  void Tile(const Client::Area& tiling_area) const;
+  void Tile(const Client::Area& tiling_area);
   void SetTilingDirection(TilingDirection tiling_direction);
 
   void MapAllClients() const;
   void UnmapAllClients() const;
-  void RaiseAllFloatingClients() const;
+  void ParkAllClients() const;
   void SetFocusedClient(Window window);
   void UnsetFocusedClient() const;
 
   void Navigate(Action::Type navigate_action_type);
   Client* GetFocusedClient() const;
   Client* GetClient(Window window) const;
-  std::vector<Client*> GetClients() const;
-  std::vector<Client*> GetFloatingClients() const;
-  std::vector<Client*> GetTilingClients() const;
+  ArenaVector<Client*> GetClients() const;
+  ArenaVector<Client*> GetFloatingClients() const;
+  ArenaVector<Client*> GetTilingClients() const;
+  ArenaVector<Client*> GetStackingOrder() const;
 
   Config* config() const;
   int id() const;
   const char* name() const;
   bool is_fullscreen() const;
+  bool is_empty() const;
+  Layout::Type layout() const;
+  bool is_layout_dirty() const;
 
   void set_name(const std::string& name);
   void set_fullscreen(bool fullscreen);
+  void set_layout(Layout::Type type);
+  void set_layout_dirty(bool layout_dirty);
+  void MarkDirty(Client* c);
+  void UpdateClientCounts(Client* c);
+  void UpdateNavigationIndex(Client* c);
 
   std::string Serialize() const;
-  void Deserialize(std::string data);
+  size_t Serialize(char* buf, size_t size) const;
+  bool Deserialize(const std::string& data, Tree::TextError* error = nullptr);
+  void Serialize(std::vector<Tree::Record>& records) const;
+  bool Deserialize(const Tree::Record* records, size_t count, Window current_window);
 
  private:
-  void DfsTileHelper(Tree::Node* node, int x, int y, int w, int h, int border_width,
-                     int gap_width) const;
+  Window GetAdjacentTilingClient(Tree::NodeId node, bool forward) const;
 
   Display* dpy_;
   Window root_window_;
   Config* config_;
   Tree client_tree_;
+  NavigationIndex navigation_index_;  // the geometry of each client
+  std::unique_ptr<Layout> layout_;    // decides where the tiling clients go
 
   int id_;
   std::string name_;
   bool is_fullscreen_;
+  bool is_layout_dirty_;  // see WindowManager::ArrangeWindows()
+  unsigned long focus_count_;  // see Client::focus_order()
+
+  // The border width and gap width used by the last Tile().
+  int tiled_border_width_;
+  int tiled_gap_width_;
 };
 
 }  // namespace wmderland